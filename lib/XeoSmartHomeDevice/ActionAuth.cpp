@@ -0,0 +1,105 @@
+#include "ActionAuth.hpp"
+
+
+int XeoSmartHomeInternals :: base64UrlDecode(const char * input, size_t len, uint8_t * output) {
+	uint32_t bits = 0;
+	uint8_t bits_count = 0;
+	int out = 0;
+
+	for(size_t i = 0; i < len; i++){
+		char c = input[i];
+		uint8_t value;
+		if(c >= 'A' and c <= 'Z')
+			value = c - 'A';
+		else if(c >= 'a' and c <= 'z')
+			value = c - 'a' + 26;
+		else if(c >= '0' and c <= '9')
+			value = c - '0' + 52;
+		else if(c == '-')
+			value = 62;
+		else if(c == '_')
+			value = 63;
+		else
+			return -1;
+
+		// a full byte is written only after its last character was read, so output never overtakes input
+		bits = bits << 6 | value;
+		bits_count += 6;
+		if(bits_count >= 8){
+			bits_count -= 8;
+			output[out++] = bits >> bits_count;
+		}
+	}
+	return len % 4 == 1 ? -1 : out;
+}
+
+
+void XeoSmartHomeInternals::ActionAuthenticator :: setKey(const uint8_t * key, size_t len) {
+	br_hmac_key_init(&this->_key, &br_sha256_vtable, key, std::min<size_t>(len, ACTION_KEY_MAX_LENGTH));
+	this->_keySet = len > 0;
+}
+
+
+bool XeoSmartHomeInternals::ActionAuthenticator :: hasKey() {
+	return this->_keySet;
+}
+
+
+size_t XeoSmartHomeInternals::ActionAuthenticator :: verifyJwt(char * token, size_t len) {
+	const char * header_end = (const char *) memchr(token, '.', len);
+	if(header_end == nullptr)
+		return 0;
+	const char * claims = header_end + 1;
+	const char * claims_end = (const char *) memchr(claims, '.', token + len - claims);
+	if(claims_end == nullptr)
+		return 0;
+
+	// only HS256 is accepted, whatever the header asks for
+	char header[JWT_HEADER_MAX_LENGTH];
+	size_t header_len = header_end - token;
+	int header_size = header_len < sizeof(header) ? base64UrlDecode(token, header_len, (uint8_t *) header) : -1;
+	if(header_size <= 0)
+		return 0;
+	StaticJsonDocument<JSON_OBJECT_SIZE(3)> header_doc;
+	if(deserializeJson(header_doc, (char *) header, header_size) or header_doc["alg"] != "HS256")
+		return 0;
+
+	uint8_t mac[ACTION_MAC_SIZE + 1];
+	const char * signature = claims_end + 1;
+	size_t signature_len = token + len - signature;
+	if(signature_len > (ACTION_MAC_SIZE * 4 + 2) / 3 or base64UrlDecode(signature, signature_len, mac) != ACTION_MAC_SIZE)
+		return 0;
+
+	if(not this->verify((const uint8_t *) token, claims_end - token, mac))
+		return 0;
+
+	int claims_size = base64UrlDecode(claims, claims_end - claims, (uint8_t *) token);
+	return claims_size > 0 ? claims_size : 0;
+}
+
+
+size_t XeoSmartHomeInternals::ActionAuthenticator :: verifyEnvelope(const char * message, size_t len) {
+	if(len <= ACTION_MAC_SIZE)
+		return 0;
+
+	size_t message_len = len - ACTION_MAC_SIZE;
+	return this->verify((const uint8_t *) message, message_len, (const uint8_t *) message + message_len) ? message_len : 0;
+}
+
+
+bool XeoSmartHomeInternals::ActionAuthenticator :: verify(const uint8_t * data, size_t len, const uint8_t * mac) {
+	if(not this->_keySet)
+		return false;
+
+	uint8_t expected[ACTION_MAC_SIZE];
+	br_hmac_context context;
+	br_hmac_init(&context, &this->_key, ACTION_MAC_SIZE);
+	br_hmac_update(&context, data, len);
+	br_hmac_out(&context, expected);
+
+	// compare all bytes so the time taken does not reveal how much of the mac was right
+	uint8_t difference = 0;
+	for(size_t i = 0; i < ACTION_MAC_SIZE; i++)
+		difference |= expected[i] ^ mac[i];
+	return difference == 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <bearssl/bearssl.h>
+
+#define ACTION_MAC_SIZE 32 // bytes, HMAC-SHA256
+#define ACTION_KEY_MAX_LENGTH 32 // bytes
+#define JWT_HEADER_MAX_LENGTH 64 // base64url characters
+
+
+namespace XeoSmartHomeInternals {
+	/*
+	* Decode base64url without padding, output may be the same buffer as input
+	* @param input: base64url characters
+	* @param len: number of characters
+	* @param output: buffer of at least len * 3 / 4 bytes
+	* @return decoded length, -1 if input is not valid base64url
+	*/
+	int base64UrlDecode(const char * input, size_t len, uint8_t * output);
+
+
+	/*
+	* Verifies signed actions with HMAC-SHA256
+	* The key is hashed into the inner and outer pad states once, every message is then a single pass over its bytes
+	* Messages are JWT HS256 tokens on the JSON action topic and MessagePack followed by a 32 byte MAC on the
+	* MessagePack topic. Expiry (exp) and replay counter (ctr) claims are checked by the caller.
+	*/
+	class ActionAuthenticator {
+		public:
+			/*
+			* @param key: HMAC key, up to ACTION_KEY_MAX_LENGTH bytes
+			* @param len: key length, 0 removes the key
+			*/
+			void setKey(const uint8_t * key, size_t len);
+
+			bool hasKey();
+
+			/*
+			* Verify a JWT HS256 token and decode its claims in place
+			* @param token: header.claims.signature, overwritten with the claims JSON
+			* @param len: token length
+			* @return claims length, 0 if the token is not valid
+			*/
+			size_t verifyJwt(char * token, size_t len);
+
+			/*
+			* Verify a MessagePack message followed by its MAC
+			* @param message: MessagePack action, then ACTION_MAC_SIZE bytes of HMAC-SHA256 over it
+			* @param len: message length, MAC included
+			* @return MessagePack length, 0 if the MAC is not valid
+			*/
+			size_t verifyEnvelope(const char * message, size_t len);
+
+			/*
+			* @param data: signed bytes
+			* @param len: data length
+			* @param mac: ACTION_MAC_SIZE bytes of HMAC-SHA256 over data
+			* @return true if a key is set and mac is valid
+			*/
+			bool verify(const uint8_t * data, size_t len, const uint8_t * mac);
+
+		private:
+			br_hmac_key_context _key; // inner and outer pad hashes
+			bool _keySet = false;
+	};
+};
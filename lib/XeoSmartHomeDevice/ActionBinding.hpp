@@ -0,0 +1,75 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <type_traits>
+
+
+namespace XeoSmartHomeInternals {
+	template<size_t... I>
+	struct IndexSequence {};
+
+	template<size_t N, size_t... I>
+	struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+
+	template<size_t... I>
+	struct MakeIndexSequence<0, I...> {
+		typedef IndexSequence<I...> type;
+	};
+
+	// types that can be read from an action parameters array without allocation
+	template<typename T>
+	struct IsActionParameter : std::integral_constant<bool, std::is_arithmetic<T>::value or std::is_same<T, const char *>::value> {};
+
+	template<typename... Args>
+	struct AreActionParameters : std::true_type {};
+
+	template<typename T, typename... Args>
+	struct AreActionParameters<T, Args...> : std::integral_constant<bool, IsActionParameter<T>::value and AreActionParameters<Args...>::value> {};
+
+
+	/*
+	* Binds a handler with typed arguments to the JsonArray action parameters
+	* Parameters are checked once by validate() when the action is received, call() then reads them without checks
+	* @param Args: handler argument types, arithmetic types or const char *
+	*/
+	template<typename... Args>
+	struct ActionBinding {
+		static_assert(AreActionParameters<Args...>::value, "action parameters must be arithmetic types or const char *");
+
+		typedef typename MakeIndexSequence<sizeof...(Args)>::type Indexes;
+
+		/*
+		* @param parameters: action parameters
+		* @return true if parameters has exactly one value of the right type for every handler argument
+		*/
+		static bool validate(JsonArray & parameters) {
+			return parameters.size() == sizeof...(Args) and _validate(parameters, Indexes());
+		}
+
+		/*
+		* Call handler with the decoded parameters, parameters must be validated first
+		* @param callback: handler, callable with Args...
+		* @param parameters: action parameters
+		*/
+		template<typename Callback>
+		static void call(Callback & callback, JsonArray & parameters) {
+			_call(callback, parameters, Indexes());
+		}
+
+		private:
+			template<size_t... I>
+			static bool _validate(JsonArray & parameters, IndexSequence<I...>) {
+				const bool valid[] = {true, parameters[I].template is<Args>()...};
+				for(bool value : valid){
+					if(not value)
+						return false;
+				}
+				return true;
+			}
+
+			template<typename Callback, size_t... I>
+			static void _call(Callback & callback, JsonArray & parameters, IndexSequence<I...>) {
+				callback(parameters[I].template as<Args>()...);
+			}
+	};
+};
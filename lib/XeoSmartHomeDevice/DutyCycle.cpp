@@ -0,0 +1,78 @@
+#include "DutyCycle.hpp"
+
+
+void XeoSmartHomeInternals::DutyCycle :: begin(uint32_t sleep_seconds, uint32_t awake_budget) {
+	this->_phase = DUTY_CYCLE_CONNECTING;
+	this->_sleepSeconds = sleep_seconds;
+	this->_budget = awake_budget;
+	this->_budgetExceeded = false;
+}
+
+
+bool XeoSmartHomeInternals::DutyCycle :: isEnabled() {
+	return this->_phase != DUTY_CYCLE_OFF;
+}
+
+
+XeoSmartHomeInternals::DutyCyclePhase XeoSmartHomeInternals::DutyCycle :: getPhase() {
+	return this->_phase;
+}
+
+
+uint32_t XeoSmartHomeInternals::DutyCycle :: getSleepSeconds() {
+	return this->_sleepSeconds;
+}
+
+
+bool XeoSmartHomeInternals::DutyCycle :: isBudgetExceeded() {
+	return this->_budgetExceeded;
+}
+
+
+void XeoSmartHomeInternals::DutyCycle :: onActivity(uint32_t now) {
+	this->_lastActivity = now;
+}
+
+
+XeoSmartHomeInternals::DutyCycleStep XeoSmartHomeInternals::DutyCycle :: run(uint32_t now, bool connected, bool busy) {
+	if(this->_phase == DUTY_CYCLE_OFF)
+		return DUTY_CYCLE_STEP_NONE;
+
+	if(now > this->_budget){
+		this->_budgetExceeded = true;
+		return DUTY_CYCLE_STEP_SLEEP;
+	}
+
+	switch(this->_phase){
+	case DUTY_CYCLE_CONNECTING:
+		if(connected){
+			this->_phase = DUTY_CYCLE_DRAINING;
+			this->_lastActivity = now;
+			return DUTY_CYCLE_STEP_SEND_READINGS;
+		}
+		break;
+
+	case DUTY_CYCLE_DRAINING:
+		if(not busy and now - this->_lastActivity >= DUTY_CYCLE_QUIET_TIME){
+			this->_phase = DUTY_CYCLE_DISCONNECTING;
+			this->_phaseStart = now;
+			return DUTY_CYCLE_STEP_DISCONNECT;
+		}
+		break;
+
+	case DUTY_CYCLE_DISCONNECTING:
+		if(not connected or now - this->_phaseStart >= DUTY_CYCLE_DISCONNECT_TIMEOUT)
+			return DUTY_CYCLE_STEP_SLEEP;
+		break;
+
+	default:
+		break;
+	}
+	return DUTY_CYCLE_STEP_NONE;
+}
+
+
+uint32_t XeoSmartHomeInternals :: dutyCycleEnergy(uint32_t awake_time, uint64_t sleep_time) {
+	return awake_time * DUTY_CYCLE_ACTIVE_CURRENT * DUTY_CYCLE_VOLTAGE // mA * V * ms = uJ
+		+ sleep_time / 1000000 * DUTY_CYCLE_SLEEP_CURRENT * DUTY_CYCLE_VOLTAGE; // uA * V * s = uJ
+}
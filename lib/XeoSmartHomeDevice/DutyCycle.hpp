@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DUTY_CYCLE_AWAKE_BUDGET 10000 // miliseconds, the device goes back to sleep after this even if it is not done
+#define DUTY_CYCLE_QUIET_TIME 300 // miliseconds without MQTT traffic before the device goes to sleep
+#define DUTY_CYCLE_DISCONNECT_TIMEOUT 500 // miliseconds to wait for a clean MQTT disconnect
+#define DUTY_CYCLE_ACTIVE_CURRENT 80 // mA, average current while awake, used for energy estimates
+#define DUTY_CYCLE_SLEEP_CURRENT 20 // uA, deep sleep current, used for energy estimates
+#define DUTY_CYCLE_VOLTAGE 3.3f
+
+
+namespace XeoSmartHomeInternals {
+	enum DutyCyclePhase {
+		DUTY_CYCLE_OFF, // always on
+		DUTY_CYCLE_CONNECTING, // waiting for WiFi and MQTT
+		DUTY_CYCLE_DRAINING, // readings sent, waiting for actions and acknowledgements
+		DUTY_CYCLE_DISCONNECTING // waiting for a clean MQTT disconnect before sleeping
+	};
+
+	// what the device has to do after DutyCycle::run()
+	enum DutyCycleStep {
+		DUTY_CYCLE_STEP_NONE,
+		DUTY_CYCLE_STEP_SEND_READINGS, // MQTT is connected, send the cycle report and the sensor readings
+		DUTY_CYCLE_STEP_DISCONNECT, // nothing left to do, publish the sleeping presence and disconnect
+		DUTY_CYCLE_STEP_SLEEP // save state and go to deep sleep
+	};
+
+
+	/*
+	* Wake cycle state machine of duty-cycle mode, without any SDK calls so it can be run on the host
+	* The device reports MQTT traffic with onActivity() and calls run() from loop() with its current state.
+	* A cycle disconnects only when no action is waiting, every QoS 1 and 2 publish was acknowledged and the
+	* connection was quiet for DUTY_CYCLE_QUIET_TIME; the awake budget ends the cycle whatever the state.
+	*/
+	class DutyCycle {
+		public:
+			/*
+			* Enable duty-cycle mode, the cycle starts in DUTY_CYCLE_CONNECTING
+			* @param sleep_seconds: deep sleep time
+			* @param awake_budget: max miliseconds awake per cycle, counted from boot
+			*/
+			void begin(uint32_t sleep_seconds, uint32_t awake_budget = DUTY_CYCLE_AWAKE_BUDGET);
+
+			bool isEnabled();
+			DutyCyclePhase getPhase();
+			uint32_t getSleepSeconds();
+
+			/*
+			* @return true if the last DUTY_CYCLE_STEP_SLEEP was forced by the awake budget
+			*/
+			bool isBudgetExceeded();
+
+			/*
+			* MQTT message or acknowledgement received, restarts the quiet time
+			* @param now: millis()
+			*/
+			void onActivity(uint32_t now);
+
+			/*
+			* Advance the cycle
+			* @param now: millis(), time since boot
+			* @param connected: MQTT is connected
+			* @param busy: actions are queued or held, or publishes are not acknowledged yet
+			* @return what the device has to do now
+			*/
+			DutyCycleStep run(uint32_t now, bool connected, bool busy);
+
+		private:
+			DutyCyclePhase _phase = DUTY_CYCLE_OFF;
+			uint32_t _sleepSeconds = 0;
+			uint32_t _budget = DUTY_CYCLE_AWAKE_BUDGET; // miliseconds
+			uint32_t _phaseStart = 0; // millis() when the current phase started
+			uint32_t _lastActivity = 0; // millis() of the last MQTT message or acknowledgement
+			bool _budgetExceeded = false;
+	};
+
+
+	/*
+	* Estimated energy of a wake cycle from the DUTY_CYCLE_*_CURRENT constants
+	* @param awake_time: miliseconds awake
+	* @param sleep_time: microseconds of deep sleep
+	* @return uJ
+	*/
+	uint32_t dutyCycleEnergy(uint32_t awake_time, uint64_t sleep_time);
+};
@@ -0,0 +1,141 @@
+#include "LocalControl.hpp"
+
+
+void XeoSmartHomeInternals::LocalControl :: setKey(const uint8_t * key, size_t len) {
+	br_hmac_key_init(&this->_key, &br_sha256_vtable, key, std::min<size_t>(len, LOCAL_KEY_MAX_LENGTH));
+	this->_keySet = len > 0;
+}
+
+
+bool XeoSmartHomeInternals::LocalControl :: hasKey() {
+	return this->_keySet;
+}
+
+
+void XeoSmartHomeInternals::LocalControl :: begin(const char * serial, const char * name) {
+	if(this->_started)
+		return;
+
+	this->_serial = serial;
+	this->_name = name;
+	this->_nonce = ESP.random();
+	this->_counter = 0;
+
+	if(not this->_udp.listen(LOCAL_CONTROL_PORT))
+		return;
+
+	this->_udp.onPacket([this](AsyncUDPPacket & packet){
+		this->_onPacket(packet);
+	});
+
+	char hostname[32];
+	snprintf(hostname, sizeof(hostname), "xeo-%s", serial);
+	if(MDNS.begin(hostname)){
+		MDNS.addService(LOCAL_CONTROL_SERVICE, "udp", LOCAL_CONTROL_PORT);
+		MDNS.addServiceTxt(LOCAL_CONTROL_SERVICE, "udp", "serial", serial);
+	}
+	this->_started = true;
+}
+
+
+void XeoSmartHomeInternals::LocalControl :: loop() {
+	if(this->_started)
+		MDNS.update();
+}
+
+
+void XeoSmartHomeInternals::LocalControl :: onAction(OnLocalActionCallback callback) {
+	this->_onAction = callback;
+}
+
+
+const XeoSmartHomeInternals::LocalControlStats & XeoSmartHomeInternals::LocalControl :: getStats() {
+	return this->_stats;
+}
+
+
+void XeoSmartHomeInternals::LocalControl :: _onPacket(AsyncUDPPacket & packet) {
+	if(packet.length() == 0 or not this->_keySet)
+		return;
+
+	switch(packet.data()[0]){
+		case LOCAL_PACKET_DISCOVER:
+			this->_announce(packet);
+			break;
+		case LOCAL_PACKET_ACTION:
+			this->_onActionPacket(packet);
+			break;
+	}
+}
+
+
+void XeoSmartHomeInternals::LocalControl :: _announce(AsyncUDPPacket & packet) {
+	this->_stats.discoveries++;
+
+	uint8_t buffer[LOCAL_ANNOUNCE_MAX_SIZE];
+	buffer[0] = LOCAL_PACKET_ANNOUNCE;
+	writeUint32(&buffer[1], this->_nonce);
+	writeUint32(&buffer[5], this->_counter);
+
+	int len = snprintf((char *) &buffer[9], sizeof(buffer) - 9, "{\"serial\":\"%s\",\"name\":\"%s\",\"port\":%d}", this->_serial, this->_name, LOCAL_CONTROL_PORT);
+	if(len < 0 or len >= (int) sizeof(buffer) - 9)
+		return;
+
+	packet.write(buffer, 9 + len);
+}
+
+
+void XeoSmartHomeInternals::LocalControl :: _onActionPacket(AsyncUDPPacket & packet) {
+	const uint8_t * data = packet.data();
+	size_t len = packet.length();
+	if(len < LOCAL_HEADER_SIZE + LOCAL_MAC_SIZE){
+		this->_stats.bad_mac++;
+		return;
+	}
+
+	// compare all bytes so the time taken does not reveal how much of the mac was right
+	uint8_t mac[LOCAL_MAC_SIZE];
+	this->_mac(data, len - LOCAL_MAC_SIZE, mac);
+	uint8_t difference = 0;
+	for(size_t i = 0; i < LOCAL_MAC_SIZE; i++)
+		difference |= mac[i] ^ data[len - LOCAL_MAC_SIZE + i];
+	if(difference != 0){
+		this->_stats.bad_mac++;
+		return;
+	}
+
+	uint32_t nonce = readUint32(&data[2]);
+	uint32_t counter = readUint32(&data[6]);
+	if(nonce != this->_nonce or counter <= this->_counter){
+		this->_stats.replayed++;
+		this->_ack(packet, LOCAL_ACK_REPLAYED);
+		return;
+	}
+	this->_counter = counter;
+
+	bool accepted = this->_onAction and this->_onAction((const char *) &data[LOCAL_HEADER_SIZE], len - LOCAL_HEADER_SIZE - LOCAL_MAC_SIZE, data[1] != 0);
+	if(accepted)
+		this->_stats.accepted++;
+	else
+		this->_stats.rejected++;
+	this->_ack(packet, accepted ? LOCAL_ACK_ACCEPTED : LOCAL_ACK_REJECTED);
+}
+
+
+void XeoSmartHomeInternals::LocalControl :: _ack(AsyncUDPPacket & packet, uint8_t status) {
+	uint8_t buffer[LOCAL_HEADER_SIZE + LOCAL_MAC_SIZE];
+	buffer[0] = LOCAL_PACKET_ACK;
+	buffer[1] = status;
+	writeUint32(&buffer[2], this->_nonce);
+	writeUint32(&buffer[6], this->_counter);
+	this->_mac(buffer, LOCAL_HEADER_SIZE, &buffer[LOCAL_HEADER_SIZE]);
+	packet.write(buffer, sizeof(buffer));
+}
+
+
+void XeoSmartHomeInternals::LocalControl :: _mac(const uint8_t * data, size_t len, uint8_t * mac) {
+	br_hmac_context context;
+	br_hmac_init(&context, &this->_key, LOCAL_MAC_SIZE);
+	br_hmac_update(&context, data, len);
+	br_hmac_out(&context, mac);
+}
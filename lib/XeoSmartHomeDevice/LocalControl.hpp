@@ -0,0 +1,109 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncUDP.h>
+#include <ESP8266mDNS.h>
+#include <bearssl/bearssl.h>
+#include <functional>
+
+#define LOCAL_CONTROL_PORT 4210
+#define LOCAL_CONTROL_SERVICE "xeosmarthome" // mDNS service, _xeosmarthome._udp
+#define LOCAL_KEY_MAX_LENGTH 32 // bytes
+#define LOCAL_MAC_SIZE 16 // bytes, truncated HMAC-SHA256
+#define LOCAL_HEADER_SIZE 10 // type, format, nonce, counter
+#define LOCAL_ANNOUNCE_MAX_SIZE 160 // bytes
+
+// packet types
+#define LOCAL_PACKET_DISCOVER 1 // type; may be broadcast
+#define LOCAL_PACKET_ANNOUNCE 2 // type, nonce (4), counter (4), JSON {"serial","name","port"}
+#define LOCAL_PACKET_ACTION 3 // type, format, nonce (4), counter (4), action payload, mac
+#define LOCAL_PACKET_ACK 4 // type, status, nonce (4), counter (4), mac
+
+// ack status
+#define LOCAL_ACK_ACCEPTED 0
+#define LOCAL_ACK_REPLAYED 1 // wrong nonce or counter not above the last one, ack carries the current counter
+#define LOCAL_ACK_REJECTED 2 // authentic but not a valid action, or the action queue is full
+
+
+namespace XeoSmartHomeInternals {
+	/*
+	* @param payload: action payload, same encoding as the MQTT action topics
+	* @param len: payload length
+	* @param msgpack: true if payload is MessagePack, JSON otherwise
+	* @return true if the action was accepted
+	*/
+	typedef std::function<bool(const char * payload, size_t len, bool msgpack)> OnLocalActionCallback;
+
+	struct LocalControlStats {
+		uint32_t accepted = 0;
+		uint32_t rejected = 0; // authentic actions refused by the device
+		uint32_t replayed = 0; // authentic packets with an old counter or nonce
+		uint32_t bad_mac = 0; // packets dropped without an answer
+		uint32_t discoveries = 0;
+	};
+
+
+	/*
+	* Authenticated action channel over UDP on the local network, with mDNS and broadcast discovery
+	* Every action packet carries the device session nonce and a counter, and is signed with HMAC-SHA256
+	* using a per-device key. The nonce changes on every boot and the counter must increase, so captured
+	* packets can not be replayed. Clients learn the nonce and the current counter from the announce packet.
+	*/
+	class LocalControl {
+		public:
+			/*
+			* @param key: per-device key shared with the app
+			* @param len: key length, up to LOCAL_KEY_MAX_LENGTH bytes
+			*/
+			void setKey(const uint8_t * key, size_t len);
+
+			bool hasKey();
+
+			/*
+			* Start listening and announce the device over mDNS, call once the station has an IP
+			* @param serial: device serial, must outlive this object
+			* @param name: device name, must outlive this object
+			*/
+			void begin(const char * serial, const char * name);
+
+			/*
+			* Answer mDNS queries, must be called in loop()
+			*/
+			void loop();
+
+			void onAction(OnLocalActionCallback callback);
+
+			const LocalControlStats & getStats();
+
+		private:
+			AsyncUDP _udp;
+			OnLocalActionCallback _onAction;
+			LocalControlStats _stats;
+			br_hmac_key_context _key; // inner and outer key hashes, computed once
+			bool _keySet = false;
+			bool _started = false;
+			const char * _serial = nullptr;
+			const char * _name = nullptr;
+			uint32_t _nonce = 0;
+			uint32_t _counter = 0; // last accepted counter
+
+			void _onPacket(AsyncUDPPacket & packet);
+			void _announce(AsyncUDPPacket & packet);
+			void _onActionPacket(AsyncUDPPacket & packet);
+			void _ack(AsyncUDPPacket & packet, uint8_t status);
+			void _mac(const uint8_t * data, size_t len, uint8_t * mac);
+	};
+
+
+	inline void writeUint32(uint8_t * buffer, uint32_t value) {
+		buffer[0] = value >> 24;
+		buffer[1] = value >> 16;
+		buffer[2] = value >> 8;
+		buffer[3] = value;
+	}
+
+
+	inline uint32_t readUint32(const uint8_t * buffer) {
+		return (uint32_t) buffer[0] << 24 | (uint32_t) buffer[1] << 16 | (uint32_t) buffer[2] << 8 | buffer[3];
+	}
+};
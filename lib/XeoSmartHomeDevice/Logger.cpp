@@ -0,0 +1,108 @@
+#include "Logger.hpp"
+
+
+XeoSmartHomeInternals::Logger XeoSmartHomeInternals::logger;
+
+
+void XeoSmartHomeInternals::Logger :: log(uint8_t level, const char * format, ...) {
+	static const char LEVELS[] PROGMEM = "-EWID";
+
+	char message[LOG_MESSAGE_MAX_LENGTH];
+	int len = snprintf(message, sizeof(message), "%lu %c ", millis(), pgm_read_byte(&LEVELS[level]));
+
+	va_list args;
+	va_start(args, format);
+	int message_len = vsnprintf_P(message + len, sizeof(message) - len - 1, format, args);
+	va_end(args);
+
+	len = std::min<int>(len + std::max(message_len, 0), sizeof(message) - 2);
+	message[len++] = '\n';
+
+	// with an output, bytes not written yet must be kept; without one, old messages are overwritten
+	if(this->_output != nullptr and this->_head + len - this->_tail > LOG_BUFFER_SIZE){
+		this->_dropped++;
+		return;
+	}
+
+	this->_write(message, len);
+}
+
+
+void XeoSmartHomeInternals::Logger :: setOutput(Print * output) {
+	this->_tail = this->_head;
+	this->_output = output;
+}
+
+
+void XeoSmartHomeInternals::Logger :: drain(uint32_t budget) {
+	if(this->_output == nullptr)
+		return;
+
+	uint32_t start = micros();
+	while(this->_tail != this->_head and micros() - start < budget){
+		uint32_t offset = this->_tail & (LOG_BUFFER_SIZE - 1);
+		size_t len = std::min<size_t>(this->_head - this->_tail, LOG_BUFFER_SIZE - offset); // contiguous bytes
+		len = std::min<size_t>(len, this->_output->availableForWrite());
+		if(len == 0)
+			break; // output buffer is full, continue in the next loop()
+
+		this->_tail = this->_tail + this->_output->write((const uint8_t *) &this->_buffer[offset], len);
+	}
+}
+
+
+void XeoSmartHomeInternals::Logger :: flush() {
+	if(this->_output == nullptr)
+		return;
+
+	while(this->_tail != this->_head){
+		uint32_t offset = this->_tail & (LOG_BUFFER_SIZE - 1);
+		size_t len = std::min<size_t>(this->_head - this->_tail, LOG_BUFFER_SIZE - offset);
+		this->_tail = this->_tail + this->_output->write((const uint8_t *) &this->_buffer[offset], len);
+	}
+	this->_output->flush();
+}
+
+
+size_t XeoSmartHomeInternals::Logger :: copyTo(char * buffer, size_t size) {
+	if(size == 0)
+		return 0;
+
+	uint32_t head = this->_head;
+	uint32_t available = std::min<uint32_t>(head, LOG_BUFFER_SIZE);
+	uint32_t len = std::min<uint32_t>(available, size - 1);
+	uint32_t start = head - len;
+
+	for(uint32_t i = 0; i < len; i++)
+		buffer[i] = this->_buffer[(start + i) & (LOG_BUFFER_SIZE - 1)];
+	buffer[len] = '\0';
+
+	// drop the first message if it was cut
+	bool cut = len < head and (len == LOG_BUFFER_SIZE or this->_buffer[(start - 1) & (LOG_BUFFER_SIZE - 1)] != '\n');
+	if(cut and len > 0){
+		char * first_line_end = (char *) memchr(buffer, '\n', len);
+		if(first_line_end != nullptr){
+			size_t skip = first_line_end - buffer + 1;
+			memmove(buffer, buffer + skip, len - skip + 1);
+			len -= skip;
+		}
+	}
+	return len;
+}
+
+
+uint32_t XeoSmartHomeInternals::Logger :: getDropped() {
+	return this->_dropped;
+}
+
+
+void XeoSmartHomeInternals::Logger :: _write(const char * data, size_t len) {
+	for(size_t i = 0; i < len; i++)
+		this->_buffer[(this->_head + i) & (LOG_BUFFER_SIZE - 1)] = data[i];
+
+	__sync_synchronize(); // message must be written before the new head is visible
+	this->_head = this->_head + len;
+
+	if(this->_head - this->_tail > LOG_BUFFER_SIZE)
+		this->_tail = this->_head - LOG_BUFFER_SIZE; // no output, oldest bytes were overwritten
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// messages above this level are removed at compile time, set with -D XEO_LOG_LEVEL=... in build_flags
+#ifndef XEO_LOG_LEVEL
+#define XEO_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_BUFFER_SIZE 2048 // bytes, must be a power of two
+#define LOG_MESSAGE_MAX_LENGTH 128 // bytes, longer messages are truncated
+#define LOG_DRAIN_BUDGET 1000 // microseconds spent writing logs to Serial in each loop()
+
+#if XEO_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define XEO_LOG_ERROR(format, ...) XeoSmartHomeInternals::logger.log(LOG_LEVEL_ERROR, PSTR(format), ##__VA_ARGS__)
+#else
+#define XEO_LOG_ERROR(format, ...) do {} while(0)
+#endif
+
+#if XEO_LOG_LEVEL >= LOG_LEVEL_WARNING
+#define XEO_LOG_WARNING(format, ...) XeoSmartHomeInternals::logger.log(LOG_LEVEL_WARNING, PSTR(format), ##__VA_ARGS__)
+#else
+#define XEO_LOG_WARNING(format, ...) do {} while(0)
+#endif
+
+#if XEO_LOG_LEVEL >= LOG_LEVEL_INFO
+#define XEO_LOG_INFO(format, ...) XeoSmartHomeInternals::logger.log(LOG_LEVEL_INFO, PSTR(format), ##__VA_ARGS__)
+#else
+#define XEO_LOG_INFO(format, ...) do {} while(0)
+#endif
+
+#if XEO_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define XEO_LOG_DEBUG(format, ...) XeoSmartHomeInternals::logger.log(LOG_LEVEL_DEBUG, PSTR(format), ##__VA_ARGS__)
+#else
+#define XEO_LOG_DEBUG(format, ...) do {} while(0)
+#endif
+
+
+namespace XeoSmartHomeInternals {
+	/*
+	* Deferred logger, messages are formatted into a RAM ring buffer and written to the output from loop()
+	* Logging never waits for Serial, so it is safe in network callbacks
+	* Messages can be logged from loop() and network callbacks, which do not preempt each other; not from interrupts
+	*/
+	class Logger {
+		static_assert((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) == 0, "LOG_BUFFER_SIZE must be a power of two");
+
+		public:
+			/*
+			* Format a message into the ring buffer
+			* If the output can not keep up the message is dropped, without output the oldest messages are overwritten
+			* @param level: LOG_LEVEL_ERROR, LOG_LEVEL_WARNING, LOG_LEVEL_INFO or LOG_LEVEL_DEBUG
+			* @param format: printf format string in flash (PSTR)
+			*/
+			void log(uint8_t level, const char * format, ...) __attribute__((format(printf, 3, 4)));
+
+			/*
+			* Set where messages are written, nullptr keeps messages only in the ring buffer
+			* @param output: Serial or any other Print
+			*/
+			void setOutput(Print * output);
+
+			/*
+			* Write buffered messages to the output without blocking, called from loop()
+			* @param budget: max microseconds spent
+			*/
+			void drain(uint32_t budget);
+
+			/*
+			* Write all buffered messages to the output and wait until they are sent, use before reboot or sleep
+			*/
+			void flush();
+
+			/*
+			* Copy the most recent messages, the ring buffer is not changed
+			* @param buffer: destination
+			* @param size: destination size
+			* @return number of bytes copied, buffer is null terminated
+			*/
+			size_t copyTo(char * buffer, size_t size);
+
+			/*
+			* @return number of messages dropped because the output was too slow
+			*/
+			uint32_t getDropped();
+
+		private:
+			char _buffer[LOG_BUFFER_SIZE];
+			volatile uint32_t _head = 0; // next byte to write, free running
+			volatile uint32_t _tail = 0; // next byte to write to the output, free running
+			uint32_t _dropped = 0;
+			Print * _output = nullptr;
+
+			void _write(const char * data, size_t len);
+	};
+
+	extern Logger logger;
+};
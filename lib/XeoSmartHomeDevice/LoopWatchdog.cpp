@@ -0,0 +1,80 @@
+#include "LoopWatchdog.hpp"
+
+
+void XeoSmartHomeInternals::LoopWatchdog :: begin(uint32_t threshold) {
+	this->_threshold = threshold;
+
+	uint32_t breadcrumb[2];
+	rst_info * reset_info = ESP.getResetInfoPtr();
+	bool watchdog_reset = reset_info->reason == REASON_WDT_RST or reset_info->reason == REASON_SOFT_WDT_RST or reset_info->reason == REASON_EXCEPTION_RST;
+
+	// RTC memory is random after power on, the breadcrumb is only trusted after a reset that kept it
+	if(watchdog_reset and ESP.rtcUserMemoryRead(RTC_WATCHDOG_OFFSET, breadcrumb, sizeof(breadcrumb)) and breadcrumb[0] >> 24 == WATCHDOG_BREADCRUMB_MAGIC){
+		uint8_t activity = breadcrumb[0] >> 16;
+		if(activity != ACTIVITY_NONE and activity < ACTIVITY_COUNT){
+			this->_resetRecord.activity = (WatchdogActivity) activity;
+			this->_resetRecord.index = breadcrumb[0];
+			this->_resetRecord.uptime = breadcrumb[1];
+			this->_resetRecord.reason = reset_info->reason;
+		}
+	}
+
+	this->_current = {ACTIVITY_NONE, 0, (uint32_t) millis()};
+	this->_store();
+}
+
+
+XeoSmartHomeInternals::WatchdogBreadcrumb XeoSmartHomeInternals::LoopWatchdog :: enter(WatchdogActivity activity, uint16_t index) {
+	WatchdogBreadcrumb previous = this->_current;
+	this->_current = {activity, index, (uint32_t) millis()};
+	this->_store();
+	return previous;
+}
+
+
+void XeoSmartHomeInternals::LoopWatchdog :: leave(const WatchdogBreadcrumb & previous) {
+	uint32_t duration = millis() - this->_current.entered_at;
+	if(this->_current.activity != ACTIVITY_NONE and duration > this->_threshold){
+		this->_lastStall.activity = this->_current.activity;
+		this->_lastStall.index = this->_current.index;
+		this->_lastStall.duration = duration;
+		this->_lastStall.at = millis();
+		this->_stallCount++;
+		this->_stallPending = true;
+	}
+
+	this->_current = previous;
+	this->_current.entered_at = millis();
+	this->_store();
+}
+
+
+bool XeoSmartHomeInternals::LoopWatchdog :: takeStall() {
+	bool stall = this->_stallPending;
+	this->_stallPending = false;
+	return stall;
+}
+
+
+const XeoSmartHomeInternals::WatchdogStall & XeoSmartHomeInternals::LoopWatchdog :: getLastStall() {
+	return this->_lastStall;
+}
+
+
+uint32_t XeoSmartHomeInternals::LoopWatchdog :: getStallCount() {
+	return this->_stallCount;
+}
+
+
+const XeoSmartHomeInternals::WatchdogResetRecord & XeoSmartHomeInternals::LoopWatchdog :: getResetRecord() {
+	return this->_resetRecord;
+}
+
+
+void XeoSmartHomeInternals::LoopWatchdog :: _store() {
+	uint32_t breadcrumb[2] = {
+		(uint32_t) WATCHDOG_BREADCRUMB_MAGIC << 24 | (uint32_t) this->_current.activity << 16 | this->_current.index,
+		this->_current.entered_at
+	};
+	ESP.rtcUserMemoryWrite(RTC_WATCHDOG_OFFSET, breadcrumb, sizeof(breadcrumb));
+}
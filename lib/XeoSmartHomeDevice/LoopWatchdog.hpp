@@ -0,0 +1,118 @@
+#pragma once
+
+#include <Arduino.h>
+#include <user_interface.h>
+#include "RtcMemory.hpp"
+
+#define WATCHDOG_STALL_THRESHOLD 1000 // miliseconds, longer activities are reported as stalls; the SDK watchdog resets after about 3 s
+#define WATCHDOG_BREADCRUMB_MAGIC 0xB5
+
+
+namespace XeoSmartHomeInternals {
+	enum WatchdogActivity : uint8_t {
+		ACTIVITY_NONE,
+		ACTIVITY_OUTSIDE_LOOP, // sketch code and network callbacks between two device loop() calls
+		ACTIVITY_SCHEDULER,
+		ACTIVITY_ACTION, // index is the action handler
+		ACTIVITY_SENSOR, // index is the sensor
+		ACTIVITY_BRIDGE, // index is the UART bridge
+		ACTIVITY_OTA,
+		ACTIVITY_BUTTON,
+		ACTIVITY_LOOP, // device loop() code outside the activities above
+		ACTIVITY_COUNT
+	};
+
+	struct WatchdogBreadcrumb {
+		WatchdogActivity activity;
+		uint16_t index;
+		uint32_t entered_at; // millis()
+	};
+
+	struct WatchdogStall {
+		WatchdogActivity activity = ACTIVITY_NONE;
+		uint16_t index = 0;
+		uint32_t duration = 0; // miliseconds
+		uint32_t at = 0; // millis() when the stall ended
+	};
+
+	// activity running when the previous boot ended with a watchdog or exception reset
+	struct WatchdogResetRecord {
+		WatchdogActivity activity = ACTIVITY_NONE;
+		uint16_t index = 0;
+		uint32_t uptime = 0; // miliseconds after boot when the activity started
+		uint8_t reason = 0; // rst_info reason, REASON_WDT_RST, REASON_SOFT_WDT_RST or REASON_EXCEPTION_RST
+	};
+
+
+	/*
+	* Software watchdog for loop() stalls
+	* The running activity is kept as a breadcrumb in RTC user memory, so after a watchdog or exception reset the
+	* next boot knows what was running. Activities that return after more than the threshold are counted as stalls.
+	* The breadcrumb is two RTC words written with every change, no CRC, cheap enough for every loop() call.
+	*/
+	class LoopWatchdog {
+		public:
+			/*
+			* Read the breadcrumb of the previous boot, call once before the first activity
+			* @param threshold: miliseconds an activity may run before it is reported as a stall
+			*/
+			void begin(uint32_t threshold = WATCHDOG_STALL_THRESHOLD);
+
+			/*
+			* Mark an activity as running
+			* @param activity: what is about to run
+			* @param index: action, sensor or bridge index
+			* @return previous breadcrumb, give it to leave()
+			*/
+			WatchdogBreadcrumb enter(WatchdogActivity activity, uint16_t index = 0);
+
+			/*
+			* Mark the current activity as done, check its duration and restore the previous breadcrumb
+			* The previous activity is timed again from now, a stall is only reported for the innermost activity
+			*/
+			void leave(const WatchdogBreadcrumb & previous);
+
+			/*
+			* @return true once for each new stall, the stall is in getLastStall()
+			*/
+			bool takeStall();
+
+			const WatchdogStall & getLastStall();
+
+			uint32_t getStallCount();
+
+			/*
+			* @return activity running at the last reset, activity is ACTIVITY_NONE if the reset was not caused by a watchdog or an exception
+			*/
+			const WatchdogResetRecord & getResetRecord();
+
+		private:
+			WatchdogBreadcrumb _current = {ACTIVITY_NONE, 0, 0};
+			uint32_t _threshold = WATCHDOG_STALL_THRESHOLD;
+			WatchdogStall _lastStall;
+			uint32_t _stallCount = 0;
+			bool _stallPending = false;
+			WatchdogResetRecord _resetRecord;
+
+			void _store();
+	};
+
+
+	/*
+	* Keeps an activity in the watchdog breadcrumb while in scope
+	*/
+	class WatchdogScope {
+		public:
+			WatchdogScope(LoopWatchdog & watchdog, WatchdogActivity activity, uint16_t index = 0) : _watchdog(watchdog) {
+				this->_previous = watchdog.enter(activity, index);
+			}
+
+			~WatchdogScope() {
+				this->_watchdog.leave(this->_previous);
+			}
+
+		private:
+			LoopWatchdog & _watchdog;
+			WatchdogBreadcrumb _previous;
+	};
+};
@@ -0,0 +1,283 @@
+#include "OtaUpdater.hpp"
+
+
+void XeoSmartHomeInternals::OtaUpdater :: onVerify(OtaVerifyCallback callback) {
+	this->_verify = callback;
+}
+
+
+void XeoSmartHomeInternals::OtaUpdater :: restore() {
+	if(not SPIFFS.exists(OTA_CHECKPOINT_FILE))
+		return;
+
+	OtaCheckpoint checkpoint;
+	File file = SPIFFS.open(OTA_CHECKPOINT_FILE, "r");
+	bool valid = file.read((uint8_t *) &checkpoint, sizeof(checkpoint)) == sizeof(checkpoint) and checkpoint.version == OTA_CHECKPOINT_VERSION and checkpoint.offset % FLASH_SECTOR_SIZE == 0 and checkpoint.offset < checkpoint.manifest.size;
+	file.close();
+	if(not valid){
+		SPIFFS.remove(OTA_CHECKPOINT_FILE);
+		return;
+	}
+
+	// the maintenance window was open when the update started, it is checked again like for a new manifest
+	this->_manifest = checkpoint.manifest;
+	this->_resumeOffset = checkpoint.offset;
+	this->_checkpointOffset = checkpoint.offset;
+	this->_checkpointSaved = true;
+	this->_state = OTA_SCHEDULED;
+}
+
+
+bool XeoSmartHomeInternals::OtaUpdater :: begin(const OtaManifest & manifest) {
+	if(this->_state == OTA_RECEIVING or this->_state == OTA_SCHEDULED){
+		if(memcmp(manifest.sha256, this->_manifest.sha256, sizeof(manifest.sha256)) == 0)
+			return true; // same image, continue from the current offset
+
+		if(this->_state == OTA_RECEIVING)
+			Update.end(); // image is not complete, the update partition is discarded
+		this->_http.end();
+		this->_httpConnected = false;
+	}
+
+	if(this->_state == OTA_DONE)
+		return false; // waiting for the reboot
+
+	if(manifest.size == 0 or manifest.size > (ESP.getFreeSketchSpace() & 0xFFFFF000)){
+		this->_fail("image does not fit");
+		return false;
+	}
+
+	this->_manifest = manifest;
+	this->_offset = 0;
+	this->_error = "";
+	this->_httpRetries = 0;
+	this->_resumeOffset = 0;
+	this->_checkpointOffset = 0;
+	this->_checkpointDue = true; // replaces the checkpoint of an earlier image
+	this->_state = OTA_SCHEDULED;
+	return true;
+}
+
+
+bool XeoSmartHomeInternals::OtaUpdater :: write(uint32_t offset, const uint8_t * data, size_t len) {
+	// new bytes are accepted once the bytes written before a reset were read back
+	if(this->_state != OTA_RECEIVING or offset != this->_offset or this->_offset < this->_resumeOffset)
+		return false;
+
+	return this->_write(data, len);
+}
+
+
+void XeoSmartHomeInternals::OtaUpdater :: loop(uint32_t now, bool time_set) {
+	if((this->_state == OTA_DONE or this->_state == OTA_FAILED) and this->_checkpointSaved){
+		SPIFFS.remove(OTA_CHECKPOINT_FILE);
+		this->_checkpointSaved = false;
+	}
+	if(this->_state == OTA_SCHEDULED or this->_state == OTA_RECEIVING){
+		if(this->_checkpointDue)
+			this->_saveCheckpoint();
+	}
+
+	if(this->_state == OTA_SCHEDULED){
+		if(this->_manifest.not_before == 0 and this->_manifest.not_after == 0)
+			this->_start();
+		else if(time_set and this->_manifest.not_after != 0 and now > this->_manifest.not_after)
+			this->_fail("maintenance window missed");
+		else if(time_set and now >= this->_manifest.not_before)
+			this->_start();
+		return;
+	}
+
+	if(this->_state == OTA_RECEIVING and this->_offset < this->_resumeOffset)
+		this->_replay();
+	else if(this->_state == OTA_RECEIVING and this->_manifest.url[0] != '\0')
+		this->_download();
+}
+
+
+XeoSmartHomeInternals::OtaState XeoSmartHomeInternals::OtaUpdater :: getState() {
+	return this->_state;
+}
+
+
+uint32_t XeoSmartHomeInternals::OtaUpdater :: getOffset() {
+	return this->_offset;
+}
+
+
+const char * XeoSmartHomeInternals::OtaUpdater :: getError() {
+	return this->_error;
+}
+
+
+const XeoSmartHomeInternals::OtaManifest & XeoSmartHomeInternals::OtaUpdater :: getManifest() {
+	return this->_manifest;
+}
+
+
+bool XeoSmartHomeInternals::OtaUpdater :: _write(const uint8_t * data, size_t len) {
+	if(len > this->_manifest.size - this->_offset){
+		this->_fail("image larger than manifest size");
+		return false;
+	}
+
+	br_sha256_update(&this->_sha256, data, len);
+
+	bool last = this->_offset + len == this->_manifest.size;
+	if(last){
+		uint8_t sha256[32];
+		br_sha256_out(&this->_sha256, sha256);
+		if(memcmp(sha256, this->_manifest.sha256, sizeof(sha256)) != 0){
+			Update.end(); // the last bytes are missing, the update partition is discarded
+			this->_fail("sha256 mismatch");
+			return false;
+		}
+		if(not this->_checkSignature()){
+			Update.end();
+			this->_fail("signature not valid");
+			return false;
+		}
+	}
+
+	if(Update.write((uint8_t *) data, len) != len){
+		Update.end();
+		this->_fail("flash write failed");
+		return false;
+	}
+	this->_offset += len;
+	if(this->_offset - this->_checkpointOffset >= OTA_CHECKPOINT_INTERVAL)
+		this->_checkpointDue = true; // saved from loop(), writes may come from network callbacks
+
+	if(last){
+		if(not Update.end()){
+			this->_fail("image rejected by updater");
+			return false;
+		}
+		this->_http.end();
+		this->_httpConnected = false;
+		this->_state = OTA_DONE;
+	}
+	return true;
+}
+
+
+bool XeoSmartHomeInternals::OtaUpdater :: _checkSignature() {
+	uint8_t data[OTA_VERSION_MAX_LENGTH + 4 + sizeof(this->_manifest.sha256)];
+	size_t len = strnlen(this->_manifest.version, OTA_VERSION_MAX_LENGTH - 1) + 1;
+	memcpy(data, this->_manifest.version, len);
+	data[len - 1] = '\0';
+	data[len++] = this->_manifest.size >> 24;
+	data[len++] = this->_manifest.size >> 16;
+	data[len++] = this->_manifest.size >> 8;
+	data[len++] = this->_manifest.size;
+	memcpy(&data[len], this->_manifest.sha256, sizeof(this->_manifest.sha256));
+	len += sizeof(this->_manifest.sha256);
+
+	return this->_verify and this->_verify(data, len, this->_manifest.signature);
+}
+
+
+void XeoSmartHomeInternals::OtaUpdater :: _start() {
+	Update.runAsync(true); // writes come from network callbacks, the updater must not yield
+	if(not Update.begin(this->_manifest.size)){
+		this->_fail("updater begin failed");
+		return;
+	}
+
+	br_sha256_init(&this->_sha256);
+	this->_offset = 0;
+	this->_lastData = millis() - OTA_HTTP_RETRY_DELAY;
+	this->_state = OTA_RECEIVING;
+}
+
+
+void XeoSmartHomeInternals::OtaUpdater :: _replay() {
+	// one buffer per loop(): the updater erases a sector only once all of it was read back
+	size_t len = std::min<uint32_t>(sizeof(this->_buffer), this->_resumeOffset - this->_offset);
+	if(not ESP.flashRead(this->_imageAddress() + this->_offset, (uint32_t *) this->_buffer, len)){
+		Update.end();
+		this->_fail("resume read failed");
+		return;
+	}
+	this->_write(this->_buffer, len);
+}
+
+
+void XeoSmartHomeInternals::OtaUpdater :: _saveCheckpoint() {
+	// bytes after the last full sector are still in the updater buffer, they are sent again after a reset
+	OtaCheckpoint checkpoint;
+	checkpoint.version = OTA_CHECKPOINT_VERSION;
+	checkpoint.offset = this->_offset & ~(FLASH_SECTOR_SIZE - 1);
+	checkpoint.manifest = this->_manifest;
+
+	File file = SPIFFS.open(OTA_CHECKPOINT_FILE, "w");
+	file.write((const uint8_t *) &checkpoint, sizeof(checkpoint));
+	file.close();
+	this->_checkpointOffset = checkpoint.offset;
+	this->_checkpointDue = false;
+	this->_checkpointSaved = true;
+}
+
+
+uint32_t XeoSmartHomeInternals::OtaUpdater :: _imageAddress() {
+	// same placement as UpdaterClass::begin(): the image ends where the file system starts
+	uint32_t rounded_size = (this->_manifest.size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+	return FS_PHYS_ADDR - rounded_size;
+}
+
+
+void XeoSmartHomeInternals::OtaUpdater :: _download() {
+	if(not this->_httpConnected){
+		if(millis() - this->_lastData < OTA_HTTP_RETRY_DELAY)
+			return;
+		if(this->_httpRetries++ > OTA_HTTP_RETRIES){
+			Update.end();
+			this->_fail("download failed");
+			return;
+		}
+		this->_lastData = millis();
+		this->_httpConnected = this->_httpConnect();
+		return;
+	}
+
+	WiFiClient * stream = this->_http.getStreamPtr();
+	size_t available = stream->available();
+	if(available == 0){
+		if(not stream->connected() or millis() - this->_lastData > OTA_HTTP_TIMEOUT){
+			// continue from the current offset with a new request
+			this->_http.end();
+			this->_httpConnected = false;
+		}
+		return;
+	}
+
+	size_t len = stream->readBytes(this->_buffer, std::min<size_t>(available, sizeof(this->_buffer)));
+	this->_lastData = millis();
+	this->_httpRetries = 0;
+	this->write(this->_offset, this->_buffer, len);
+}
+
+
+bool XeoSmartHomeInternals::OtaUpdater :: _httpConnect() {
+	if(not this->_http.begin(this->_client, this->_manifest.url))
+		return false;
+
+	char range[32];
+	snprintf(range, sizeof(range), "bytes=%u-", this->_offset);
+	this->_http.addHeader("Range", range);
+
+	int code = this->_http.GET();
+	if(code == HTTP_CODE_PARTIAL_CONTENT or (code == HTTP_CODE_OK and this->_offset == 0))
+		return true;
+
+	this->_http.end();
+	return false;
+}
+
+
+void XeoSmartHomeInternals::OtaUpdater :: _fail(const char * error) {
+	this->_error = error;
+	this->_state = OTA_FAILED;
+	this->_http.end();
+	this->_httpConnected = false;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Updater.h>
+#include <ESP8266HTTPClient.h>
+#include <FS.h>
+#include <flash_hal.h>
+#include <bearssl/bearssl.h>
+#include <functional>
+
+#define OTA_VERSION_MAX_LENGTH 32
+#define OTA_URL_MAX_LENGTH 160
+#define OTA_BUFFER_SIZE 1024 // bytes read from HTTP in each loop()
+#define OTA_HTTP_TIMEOUT 10000 // miliseconds without data before the download is restarted from the current offset
+#define OTA_HTTP_RETRIES 5 // restarts before the update fails
+#define OTA_HTTP_RETRY_DELAY 5000 // miliseconds
+#define OTA_SIGNATURE_SIZE 32 // bytes, HMAC-SHA256
+#define OTA_CHECKPOINT_FILE "/ota.bin" // manifest and resume offset of the update in progress
+#define OTA_CHECKPOINT_INTERVAL 32768 // bytes written between two checkpoints, a multiple of FLASH_SECTOR_SIZE
+#define OTA_CHECKPOINT_VERSION 1
+
+
+namespace XeoSmartHomeInternals {
+	enum OtaState {
+		OTA_IDLE,
+		OTA_SCHEDULED, // waiting for the maintenance window
+		OTA_RECEIVING,
+		OTA_DONE, // image written and verified, applied on the next boot
+		OTA_FAILED
+	};
+
+	struct OtaManifest {
+		char version[OTA_VERSION_MAX_LENGTH];
+		uint32_t size; // image size, as sent; gzip images are decompressed by the bootloader
+		uint8_t sha256[32]; // hash of the image, as sent
+		char url[OTA_URL_MAX_LENGTH]; // http:// url to pull the image from, empty if chunks are pushed over MQTT
+		uint32_t not_before; // maintenance window start, epoch, 0 to start now
+		uint32_t not_after; // maintenance window end, epoch, 0 for no end
+		uint8_t signature[OTA_SIGNATURE_SIZE]; // HMAC-SHA256 of the version with its null terminator, the size (4 bytes, big endian) and sha256
+	};
+
+	struct OtaCheckpoint {
+		uint16_t version;
+		uint32_t offset; // image bytes in flash, a multiple of FLASH_SECTOR_SIZE
+		OtaManifest manifest;
+	};
+
+	/*
+	* @param data: signed bytes
+	* @param len: data length
+	* @param mac: OTA_SIGNATURE_SIZE bytes
+	* @return true if mac is the signature of data
+	*/
+	typedef std::function<bool(const uint8_t * data, size_t len, const uint8_t * mac)> OtaVerifyCallback;
+
+
+	/*
+	* Streams a firmware image into the update partition
+	* The image is written as it arrives, from MQTT chunks or an HTTP download, without buffering it. gzip images
+	* are written as they are and decompressed by the bootloader when it copies them, so no inflate window is needed
+	* on the device. The SHA-256 and the signature from the manifest are checked before the last bytes are written,
+	* a bad or unsigned image never becomes bootable. Interrupted transfers continue from the current offset: MQTT
+	* senders resume from the offset in the status, HTTP downloads are restarted with a Range request.
+	* The manifest and the offset are saved in OTA_CHECKPOINT_FILE every OTA_CHECKPOINT_INTERVAL bytes. After a
+	* reset the bytes already in the update partition are read back and written again, the hash needs them, and the
+	* transfer continues from the checkpoint.
+	*/
+	class OtaUpdater {
+		public:
+			/*
+			* @param callback: checks the manifest signature, images are rejected without it
+			*/
+			void onVerify(OtaVerifyCallback callback);
+
+			/*
+			* Resume the update that was in progress before a reset, call once the file system is mounted
+			*/
+			void restore();
+
+			/*
+			* Start an update, or schedule it for the maintenance window
+			* A manifest for the update in progress resumes it instead of starting again
+			* @param manifest: image description, checked by the caller
+			* @return false if the update can not start
+			*/
+			bool begin(const OtaManifest & manifest);
+
+			/*
+			* Write the next part of the image
+			* @param offset: offset of data in the image, must be the current offset
+			* @param data: image bytes
+			* @param len: number of bytes
+			* @return false if offset is not the current offset or the update failed
+			*/
+			bool write(uint32_t offset, const uint8_t * data, size_t len);
+
+			/*
+			* Start scheduled updates, download, resume and save checkpoints, must be called in loop()
+			* @param now: current epoch
+			* @param time_set: now is a wall clock time
+			*/
+			void loop(uint32_t now, bool time_set);
+
+			OtaState getState();
+
+			/*
+			* @return number of image bytes written
+			*/
+			uint32_t getOffset();
+
+			/*
+			* @return reason of the last failure, empty if none
+			*/
+			const char * getError();
+
+			const OtaManifest & getManifest();
+
+		private:
+			OtaManifest _manifest = {};
+			OtaState _state = OTA_IDLE;
+			const char * _error = "";
+			uint32_t _offset = 0;
+			br_sha256_context _sha256;
+			OtaVerifyCallback _verify;
+
+			// resume after a reset
+			uint32_t _resumeOffset = 0; // bytes read back from the update partition before new bytes are accepted
+			uint32_t _checkpointOffset = 0; // offset of the last checkpoint
+			bool _checkpointDue = false;
+			bool _checkpointSaved = false;
+
+			// HTTP download
+			WiFiClient _client;
+			HTTPClient _http;
+			bool _httpConnected = false;
+			uint8_t _httpRetries = 0;
+			uint32_t _lastData = 0; // millis() of the last byte received or connection attempt
+			alignas(4) uint8_t _buffer[OTA_BUFFER_SIZE]; // ESP.flashRead() needs an aligned buffer
+
+			bool _write(const uint8_t * data, size_t len);
+			bool _checkSignature();
+			void _start();
+			void _replay();
+			void _saveCheckpoint();
+
+			/*
+			* @return flash address of the update partition, where UpdaterClass::begin() places the image
+			*/
+			uint32_t _imageAddress();
+
+			void _download();
+			bool _httpConnect();
+			void _fail(const char * error);
+	};
+};
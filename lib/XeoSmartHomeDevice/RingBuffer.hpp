@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+* Fixed capacity single-producer/single-consumer ring buffer
+* The producer only moves _head and the consumer only moves _tail, so no lock is needed
+* Elements are written and read in place to avoid copying large slots
+* @param T: element type
+* @param N: capacity, must be a power of two
+*/
+template<typename T, size_t N>
+class RingBuffer {
+	static_assert(N > 0 and (N & (N - 1)) == 0, "RingBuffer capacity must be a power of two");
+
+	public:
+		/*
+		* Producer: get the next free slot
+		* @return pointer to slot or nullptr if buffer is full
+		*/
+		T * reserve();
+
+		/*
+		* Producer: make the slot returned by reserve() visible to the consumer
+		*/
+		void commit();
+
+		/*
+		* Consumer: get the oldest element
+		* @return pointer to element or nullptr if buffer is empty
+		*/
+		T * front();
+
+		/*
+		* Consumer: get the element at position index, 0 is the oldest
+		* @return pointer to element or nullptr if index is out of range
+		*/
+		T * peek(size_t index);
+
+		/*
+		* Consumer: release the oldest element
+		*/
+		void pop();
+
+		size_t size() const;
+		bool empty() const;
+		bool full() const;
+
+		static constexpr size_t capacity() { return N; }
+
+	private:
+		T _items[N];
+		volatile size_t _head = 0; // next slot to write, free running
+		volatile size_t _tail = 0; // next slot to read, free running
+};
+
+
+template<typename T, size_t N>
+T * RingBuffer<T, N> :: reserve() {
+	if(this->full())
+		return nullptr;
+	return &this->_items[this->_head & (N - 1)];
+}
+
+
+template<typename T, size_t N>
+void RingBuffer<T, N> :: commit() {
+	__sync_synchronize(); // slot content must be written before the new head is visible
+	this->_head = this->_head + 1;
+}
+
+
+template<typename T, size_t N>
+T * RingBuffer<T, N> :: front() {
+	return this->peek(0);
+}
+
+
+template<typename T, size_t N>
+T * RingBuffer<T, N> :: peek(size_t index) {
+	if(index >= this->size())
+		return nullptr;
+	__sync_synchronize();
+	return &this->_items[(this->_tail + index) & (N - 1)];
+}
+
+
+template<typename T, size_t N>
+void RingBuffer<T, N> :: pop() {
+	if(this->empty())
+		return;
+	__sync_synchronize(); // slot must be consumed before it can be reused
+	this->_tail = this->_tail + 1;
+}
+
+
+template<typename T, size_t N>
+size_t RingBuffer<T, N> :: size() const {
+	return this->_head - this->_tail;
+}
+
+
+template<typename T, size_t N>
+bool RingBuffer<T, N> :: empty() const {
+	return this->size() == 0;
+}
+
+
+template<typename T, size_t N>
+bool RingBuffer<T, N> :: full() const {
+	return this->size() >= N;
+}
@@ -0,0 +1,13 @@
+#include "RtcMemory.hpp"
+
+
+uint32_t XeoSmartHomeInternals :: crc32(const void * data, size_t len, uint32_t crc) {
+	const uint8_t * bytes = (const uint8_t *) data;
+	crc = ~crc;
+	while(len--){
+		crc ^= *bytes++;
+		for(uint8_t bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320UL & -(crc & 1));
+	}
+	return ~crc;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Arduino.h>
+
+
+namespace XeoSmartHomeInternals {
+	/*
+	* RTC user memory layout, offsets are in 4 byte blocks
+	* The first 128 bytes (blocks 0 - 31) are used by OTA updates and must not be used
+	*/
+	const uint32_t RTC_TIME_OFFSET = 32; // TimeService record, 6 blocks
+	const uint32_t RTC_WATCHDOG_OFFSET = 38; // LoopWatchdog breadcrumb, 2 blocks
+	const uint32_t RTC_SNAPSHOT_OFFSET = 40; // XeoSmartHomeDevice warm restart snapshot, up to 88 blocks
+	const uint32_t RTC_SNAPSHOT_MAX_SIZE = (128 - RTC_SNAPSHOT_OFFSET) * 4; // bytes
+
+	/*
+	* CRC-32 (IEEE 802.3)
+	* @param data: data to check
+	* @param len: data length
+	* @param crc: crc of the previous data block, to compute the crc of data split in blocks
+	*/
+	uint32_t crc32(const void * data, size_t len, uint32_t crc = 0);
+
+	/*
+	* Read a record from RTC user memory
+	* The record must start with a uint32_t crc member that covers the rest of the record
+	* @param offset: record offset in 4 byte blocks
+	* @param record: record to read
+	* @return true if the record was read and its crc is valid
+	*/
+	template<typename T>
+	bool rtcLoad(uint32_t offset, T & record);
+
+	/*
+	* Write a record to RTC user memory, the crc member is updated before writing
+	* @param offset: record offset in 4 byte blocks
+	* @param record: record to write
+	* @return true on success
+	*/
+	template<typename T>
+	bool rtcStore(uint32_t offset, T & record);
+};
+
+
+template<typename T>
+bool XeoSmartHomeInternals :: rtcLoad(uint32_t offset, T & record) {
+	static_assert(sizeof(T) % 4 == 0, "RTC records must be a multiple of 4 bytes");
+
+	if(not ESP.rtcUserMemoryRead(offset, (uint32_t *) &record, sizeof(T)))
+		return false;
+
+	const uint8_t * data = (const uint8_t *) &record + sizeof(uint32_t);
+	return *((uint32_t *) &record) == crc32(data, sizeof(T) - sizeof(uint32_t));
+}
+
+
+template<typename T>
+bool XeoSmartHomeInternals :: rtcStore(uint32_t offset, T & record) {
+	static_assert(sizeof(T) % 4 == 0, "RTC records must be a multiple of 4 bytes");
+
+	const uint8_t * data = (const uint8_t *) &record + sizeof(uint32_t);
+	*((uint32_t *) &record) = crc32(data, sizeof(T) - sizeof(uint32_t));
+
+	return ESP.rtcUserMemoryWrite(offset, (uint32_t *) &record, sizeof(T));
+}
@@ -0,0 +1,115 @@
+#include "TimeService.hpp"
+
+
+void XeoSmartHomeInternals::TimeService :: begin(const char * time_zone, const char * ntp_server) {
+	strncpy_P(this->_timeZone, time_zone, sizeof(this->_timeZone) - 1);
+	this->_timeZone[sizeof(this->_timeZone) - 1] = '\0';
+	strncpy_P(this->_ntpServer, ntp_server, sizeof(this->_ntpServer) - 1);
+	this->_ntpServer[sizeof(this->_ntpServer) - 1] = '\0';
+
+	this->_record.drift = 0;
+	settimeofday_cb([this](bool from_sntp){
+		this->_onTimeSet(from_sntp);
+	});
+
+	if(this->_restore())
+		this->_state = TIME_RESTORED;
+
+	configTime(this->_timeZone, this->_ntpServer);
+	this->_refreshCache();
+}
+
+
+void XeoSmartHomeInternals::TimeService :: loop() {
+	if(millis() - this->_lastSave >= TIME_PERSIST_INTERVAL)
+		this->save();
+}
+
+
+void XeoSmartHomeInternals::TimeService :: save() {
+	this->_lastSave = millis();
+	if(this->_state == TIME_NOT_SET)
+		return;
+
+	timeval tv;
+	gettimeofday(&tv, nullptr);
+	uint32_t rtc_ticks = system_get_rtc_time();
+	uint32_t rtc_calibration = system_rtc_clock_cali_proc();
+
+	// compare RTC and NTP time elapsed since the previous record, smoothed over several records
+	if(this->_state == TIME_SYNCED and this->_recordValid){
+		int64_t ntp_elapsed = ((int64_t) tv.tv_sec - this->_record.epoch) * 1000000 + ((int64_t) tv.tv_usec - this->_record.epoch_us);
+		int64_t rtc_elapsed = ((uint64_t) (rtc_ticks - this->_record.rtc_ticks) * rtc_calibration) >> 12;
+		if(rtc_elapsed > 0){
+			int32_t drift = (ntp_elapsed - rtc_elapsed) * 1000000 / rtc_elapsed;
+			this->_record.drift += (drift - this->_record.drift) / 8;
+		}
+	}
+
+	this->_record.epoch = tv.tv_sec;
+	this->_record.epoch_us = tv.tv_usec;
+	this->_record.rtc_ticks = rtc_ticks;
+	this->_record.rtc_calibration = rtc_calibration;
+	this->_recordValid = this->_state == TIME_SYNCED;
+	rtcStore(RTC_TIME_OFFSET, this->_record);
+
+	this->_refreshCache();
+}
+
+
+time_t XeoSmartHomeInternals::TimeService :: now() {
+	return this->_cachedEpoch + (millis() - this->_cachedMillis) / 1000;
+}
+
+
+XeoSmartHomeInternals::TimeSyncState XeoSmartHomeInternals::TimeService :: getSyncState() {
+	return this->_state;
+}
+
+
+int32_t XeoSmartHomeInternals::TimeService :: getDrift() {
+	return this->_record.drift;
+}
+
+
+bool XeoSmartHomeInternals::TimeService :: _restore() {
+	// the RTC counter is reset on power on and external reset
+	rst_info * reset_info = ESP.getResetInfoPtr();
+	if(reset_info->reason == REASON_DEFAULT_RST or reset_info->reason == REASON_EXT_SYS_RST)
+		return false;
+
+	TimeRecord record;
+	if(not rtcLoad(RTC_TIME_OFFSET, record))
+		return false;
+
+	int64_t elapsed = ((uint64_t) (system_get_rtc_time() - record.rtc_ticks) * record.rtc_calibration) >> 12;
+	elapsed += elapsed * record.drift / 1000000;
+	if(elapsed < 0 or elapsed > (int64_t) TIME_MAX_RESTORE_GAP * 1000000)
+		return false;
+
+	uint64_t restored = (uint64_t) record.epoch * 1000000 + record.epoch_us + elapsed;
+	timeval tv;
+	tv.tv_sec = restored / 1000000;
+	tv.tv_usec = restored % 1000000;
+
+	settimeofday(&tv, nullptr);
+
+	this->_record.drift = record.drift;
+	return true;
+}
+
+
+void XeoSmartHomeInternals::TimeService :: _onTimeSet(bool from_sntp) {
+	// the callback is deferred by the core, a restored time reaches it after _restore() returned
+	if(not from_sntp)
+		return;
+
+	this->_state = TIME_SYNCED;
+	this->save();
+}
+
+
+void XeoSmartHomeInternals::TimeService :: _refreshCache() {
+	this->_cachedEpoch = time(nullptr);
+	this->_cachedMillis = millis();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+#include <sys/time.h>
+#include <coredecls.h>
+#include <user_interface.h>
+#include "RtcMemory.hpp"
+
+#define TIME_PERSIST_INTERVAL 60000 // miliseconds between time records saved in RTC memory
+#define TIME_MAX_RESTORE_GAP 21600 // seconds, older time records are not restored; the 32 bit RTC counter wraps after about 6.8 h
+#define TIME_ZONE_MAX_LENGTH 64
+#define NTP_SERVER_MAX_LENGTH 64
+
+
+namespace XeoSmartHomeInternals {
+	enum TimeSyncState {
+		TIME_NOT_SET, // no time source yet, time is seconds since boot
+		TIME_RESTORED, // time restored from RTC memory after a warm reboot, waiting for NTP
+		TIME_SYNCED // time received from NTP
+	};
+
+	// saved in RTC user memory, survives software resets, WDT resets and deep sleep
+	struct TimeRecord {
+		uint32_t crc;
+		uint32_t epoch; // seconds, UTC
+		uint32_t epoch_us; // microseconds part of epoch
+		uint32_t rtc_ticks; // RTC counter when epoch was saved
+		uint32_t rtc_calibration; // RTC tick period in microseconds, Q12 fixed point
+		int32_t drift; // RTC clock error against NTP, parts per million
+	};
+
+
+	/*
+	* Wall-clock time that is usable right after a warm reboot
+	* The last known time is saved in RTC memory and, after a reboot, advanced by the RTC counter
+	* which keeps running during resets and deep sleep. NTP corrects it when it answers.
+	*/
+	class TimeService {
+		public:
+			/*
+			* Restore time from RTC memory and start NTP, call before any network work
+			* Both strings are copied and may be in RAM or PROGMEM
+			* @param time_zone: POSIX TZ string with DST rules, e.g. "EET-2EEST,M3.5.0/3,M10.5.0/4"
+			* @param ntp_server: NTP server host name
+			*/
+			void begin(const char * time_zone, const char * ntp_server);
+
+			/*
+			* Save the time record periodically, must be called in loop()
+			*/
+			void loop();
+
+			/*
+			* Save the time record now, call before a planned reboot or deep sleep
+			*/
+			void save();
+
+			/*
+			* Cached UTC time, does not call into the SDK
+			* @return seconds since epoch, or seconds since boot if time is not set
+			*/
+			time_t now();
+
+			TimeSyncState getSyncState();
+
+			/*
+			* @return measured RTC clock drift, parts per million
+			*/
+			int32_t getDrift();
+
+		private:
+			char _timeZone[TIME_ZONE_MAX_LENGTH];
+			char _ntpServer[NTP_SERVER_MAX_LENGTH]; // SNTP keeps a pointer to the server name
+			TimeSyncState _state = TIME_NOT_SET;
+			time_t _cachedEpoch = 0;
+			uint32_t _cachedMillis = 0;
+			uint32_t _lastSave = 0;
+			TimeRecord _record; // last saved record
+			bool _recordValid = false; // _record was saved while time was synced, used to measure drift
+
+			/*
+			* Set system time from the RTC memory record
+			* @return true if time was restored
+			*/
+			bool _restore();
+
+			/*
+			* Called by the SDK after the system time was set
+			* @param from_sntp: false when the time was set by settimeofday(), e.g. by _restore()
+			*/
+			void _onTimeSet(bool from_sntp);
+
+			void _refreshCache();
+	};
+};
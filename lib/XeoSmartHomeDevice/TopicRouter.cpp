@@ -0,0 +1,122 @@
+#include "TopicRouter.hpp"
+
+
+XeoSmartHomeInternals::TopicRouter :: TopicRouter() {
+	this->_nodes.resize(1);
+	this->_nodes[0].segment[0] = '\0';
+}
+
+
+bool XeoSmartHomeInternals::TopicRouter :: add(const char * pattern, OnTopicCallback callback) {
+	if(strlen(pattern) >= TOPIC_PATTERN_MAX_LENGTH)
+		return false;
+
+	int16_t node = 0;
+	const char * segment = pattern;
+
+	while(true){
+		const char * end = topicSegmentEnd(segment);
+		size_t len = end - segment;
+		if(len >= TOPIC_SEGMENT_MAX_LENGTH)
+			return false;
+
+		int16_t child = this->_findChild(node, segment, len);
+		if(child < 0){
+			Node new_node;
+			memcpy(new_node.segment, segment, len);
+			new_node.segment[len] = '\0';
+			new_node.sibling = this->_nodes[node].child;
+			child = this->_nodes.size();
+			this->_nodes.push_back(new_node);
+			this->_nodes[node].child = child;
+		}
+		node = child;
+
+		if(*end == '\0')
+			break;
+		segment = end + 1;
+	}
+
+	if(this->_nodes[node].handler >= 0)
+		return false;
+
+	this->_nodes[node].handler = this->_handlers.size();
+	this->_handlers.push_back(callback);
+	return true;
+}
+
+
+void XeoSmartHomeInternals::TopicRouter :: forEachPattern(OnTopicPatternCallback callback) {
+	char pattern[TOPIC_PATTERN_MAX_LENGTH];
+	pattern[0] = '\0';
+	this->_forEachPattern(0, pattern, 0, callback);
+}
+
+
+bool XeoSmartHomeInternals::TopicRouter :: route(const char * topic, char * payload, size_t len, size_t index, size_t total) {
+	int16_t handler = this->_match(0, topic);
+	if(handler < 0)
+		return false;
+
+	this->_handlers[handler](payload, len, index, total);
+	return true;
+}
+
+
+int16_t XeoSmartHomeInternals::TopicRouter :: _match(int16_t node, const char * topic) {
+	const char * end = topicSegmentEnd(topic);
+	size_t len = end - topic;
+
+	int16_t exact = -1;
+	int16_t single = -1;
+	int16_t multi = -1;
+	for(int16_t child = this->_nodes[node].child; child >= 0; child = this->_nodes[child].sibling){
+		const char * segment = this->_nodes[child].segment;
+		if(strncmp(segment, topic, len) == 0 and segment[len] == '\0')
+			exact = child;
+		else if(strcmp(segment, "+") == 0)
+			single = child;
+		else if(strcmp(segment, "#") == 0)
+			multi = child;
+	}
+
+	for(int16_t child : {exact, single}){
+		if(child < 0)
+			continue;
+		int16_t handler = *end == '\0' ? this->_nodes[child].handler : this->_match(child, end + 1);
+		if(handler < 0 and *end == '\0'){
+			// "a/#" also matches "a"
+			int16_t parent_multi = this->_findChild(child, "#", 1);
+			handler = parent_multi >= 0 ? this->_nodes[parent_multi].handler : -1;
+		}
+		if(handler >= 0)
+			return handler;
+	}
+
+	return multi >= 0 ? this->_nodes[multi].handler : -1;
+}
+
+
+int16_t XeoSmartHomeInternals::TopicRouter :: _findChild(int16_t node, const char * segment, size_t len) {
+	for(int16_t child = this->_nodes[node].child; child >= 0; child = this->_nodes[child].sibling){
+		if(strncmp(this->_nodes[child].segment, segment, len) == 0 and this->_nodes[child].segment[len] == '\0')
+			return child;
+	}
+	return -1;
+}
+
+
+void XeoSmartHomeInternals::TopicRouter :: _forEachPattern(int16_t node, char * pattern, size_t len, OnTopicPatternCallback & callback) {
+	if(this->_nodes[node].handler >= 0)
+		callback(pattern);
+
+	// add() keeps whole patterns below TOPIC_PATTERN_MAX_LENGTH
+	size_t segment_start = len;
+	if(node != 0)
+		pattern[segment_start++] = '/';
+	for(int16_t child = this->_nodes[node].child; child >= 0; child = this->_nodes[child].sibling){
+		strcpy(&pattern[segment_start], this->_nodes[child].segment);
+		this->_forEachPattern(child, pattern, segment_start + strlen(this->_nodes[child].segment), callback);
+	}
+	pattern[len] = '\0';
+}
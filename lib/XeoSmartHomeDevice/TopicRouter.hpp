@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+#define TOPIC_SEGMENT_MAX_LENGTH 24
+#define TOPIC_PATTERN_MAX_LENGTH 96
+
+
+namespace XeoSmartHomeInternals {
+	/*
+	* @param payload: message payload, or a part of it for large messages
+	* @param len: payload part length
+	* @param index: offset of this part in the message
+	* @param total: message length
+	*/
+	typedef std::function<void(char * payload, size_t len, size_t index, size_t total)> OnTopicCallback;
+
+	/*
+	* @param pattern: pattern of a handler, as given to TopicRouter::add()
+	*/
+	typedef std::function<void(const char * pattern)> OnTopicPatternCallback;
+
+	/*
+	* @return end of the first topic segment, the next '/' or the null terminator
+	*/
+	inline const char * topicSegmentEnd(const char * topic) {
+		while(*topic != '/' and *topic != '\0')
+			topic++;
+		return topic;
+	}
+
+
+	/*
+	* Routes MQTT topics to handlers with a trie of topic segments
+	* The trie is built when handlers are added, routing compares segments in place and does not allocate
+	* Patterns use MQTT wildcards: '+' matches one segment, '#' as the last segment matches the rest of the topic
+	* Exact segments are preferred over '+', and '+' over '#'
+	*/
+	class TopicRouter {
+		public:
+			TopicRouter();
+
+			/*
+			* @param pattern: topic pattern, e.g. "action/msgpack" or "sensor/+/set"
+			* @param callback: called with the messages of matching topics
+			* @return false if pattern already has a handler, or pattern or one of its segments is too long
+			*/
+			bool add(const char * pattern, OnTopicCallback callback);
+
+			/*
+			* Call callback with the pattern of every handler, e.g. to subscribe to the topics that are handled
+			*/
+			void forEachPattern(OnTopicPatternCallback callback);
+
+			/*
+			* @param topic: topic to route
+			* @return true if a handler was called
+			*/
+			bool route(const char * topic, char * payload, size_t len, size_t index, size_t total);
+
+		private:
+			struct Node {
+				char segment[TOPIC_SEGMENT_MAX_LENGTH];
+				int16_t child = -1; // first child
+				int16_t sibling = -1; // next child of the parent
+				int16_t handler = -1;
+			};
+
+			std::vector<Node> _nodes; // _nodes[0] is the root
+			std::vector<OnTopicCallback> _handlers;
+
+			/*
+			* @param node: trie node that matched the topic so far
+			* @param topic: rest of the topic, after the matched segments
+			* @return handler index, -1 if no pattern matches
+			*/
+			int16_t _match(int16_t node, const char * topic);
+
+			int16_t _findChild(int16_t node, const char * segment, size_t len);
+
+			/*
+			* @param pattern: buffer of TOPIC_PATTERN_MAX_LENGTH bytes with the segments down to node
+			* @param len: pattern length
+			*/
+			void _forEachPattern(int16_t node, char * pattern, size_t len, OnTopicPatternCallback & callback);
+	};
+};
@@ -0,0 +1,263 @@
+#include "UartBridge.hpp"
+
+
+size_t XeoSmartHomeInternals :: cobsEncode(const uint8_t * input, size_t len, uint8_t * output) {
+	size_t code_index = 0;
+	size_t out = 1;
+	uint8_t code = 1;
+
+	for(size_t i = 0; i < len; i++){
+		if(input[i] == 0){
+			output[code_index] = code;
+			code_index = out++;
+			code = 1;
+			continue;
+		}
+		output[out++] = input[i];
+		if(++code == 0xFF){
+			output[code_index] = code;
+			code_index = out++;
+			code = 1;
+		}
+	}
+	output[code_index] = code;
+	return out;
+}
+
+
+size_t XeoSmartHomeInternals :: cobsDecode(const uint8_t * input, size_t len, uint8_t * output) {
+	size_t out = 0;
+	size_t i = 0;
+
+	while(i < len){
+		uint8_t code = input[i++];
+		if(code == 0 or i + code - 1 > len)
+			return 0;
+		for(uint8_t j = 1; j < code; j++)
+			output[out++] = input[i++];
+		if(code != 0xFF and i < len)
+			output[out++] = 0;
+	}
+	return out;
+}
+
+
+uint16_t XeoSmartHomeInternals :: crc16(const uint8_t * data, size_t len) {
+	uint16_t crc = 0xFFFF;
+	while(len--){
+		crc ^= (uint16_t) *data++ << 8;
+		for(uint8_t bit = 0; bit < 8; bit++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+
+UartBridge :: UartBridge(Stream & stream, uint32_t baud) : _stream(stream) {
+	// a full frame takes 10 bits per byte, wait for it to go out and for the ack to come back
+	uint32_t frame_time = BRIDGE_ENCODED_MAX_SIZE * 10 * 1000 / baud + 1;
+	this->_ackTimeout = 2 * frame_time + BRIDGE_ACK_PROCESSING;
+}
+
+
+bool UartBridge :: send(uint8_t command, const uint8_t * data, uint8_t len) {
+	if(len > BRIDGE_COMMAND_MAX_DATA or this->_queueLen + 2 + len > BRIDGE_QUEUE_SIZE){
+		this->_stats.overflows++;
+		return false;
+	}
+
+	this->_queue[this->_queueLen++] = command;
+	this->_queue[this->_queueLen++] = len;
+	if(len > 0)
+		memcpy(&this->_queue[this->_queueLen], data, len);
+	this->_queueLen += len;
+	return true;
+}
+
+
+void UartBridge :: onCommand(XeoSmartHomeInternals::OnBridgeCommandCallback callback) {
+	this->_onCommand = callback;
+}
+
+
+void UartBridge :: loop() {
+	this->_receive();
+	this->_retransmit();
+	this->_sendQueued();
+}
+
+
+uint8_t UartBridge :: inFlight() {
+	return this->_framesCount;
+}
+
+
+const XeoSmartHomeInternals::UartBridgeStats & UartBridge :: getStats() {
+	return this->_stats;
+}
+
+
+void UartBridge :: _receive() {
+	while(this->_stream.available() > 0){
+		uint8_t byte = this->_stream.read();
+
+		if(byte != 0){
+			if(this->_rxLen < sizeof(this->_rxBuffer))
+				this->_rxBuffer[this->_rxLen++] = byte;
+			else
+				this->_rxOverflow = true;
+			continue;
+		}
+
+		// frame delimiter
+		uint8_t frame[BRIDGE_ENCODED_MAX_SIZE];
+		size_t len = this->_rxOverflow ? 0 : XeoSmartHomeInternals::cobsDecode(this->_rxBuffer, this->_rxLen, frame);
+		if(len >= 4 and XeoSmartHomeInternals::crc16(frame, len - 2) == (frame[len - 2] << 8 | frame[len - 1]))
+			this->_onFrame(frame, len - 2);
+		else if(this->_rxLen > 0)
+			this->_stats.crc_errors++;
+
+		this->_rxLen = 0;
+		this->_rxOverflow = false;
+	}
+}
+
+
+void UartBridge :: _onFrame(const uint8_t * frame, size_t len) {
+	uint8_t type = frame[0];
+	uint8_t sequence = frame[1];
+
+	if(type == BRIDGE_FRAME_ACK){
+		this->_onAck(sequence);
+		return;
+	}
+
+	if(type == BRIDGE_FRAME_SYNC)
+		this->_expectedSequence = sequence;
+
+	if(type != BRIDGE_FRAME_DATA){
+		this->_writeFrame(BRIDGE_FRAME_ACK, this->_expectedSequence - 1, nullptr, 0);
+		return;
+	}
+
+	// go-back-N receiver: only the next frame is accepted, duplicates and gaps get the last ack again
+	if(sequence == this->_expectedSequence){
+		this->_expectedSequence++;
+		size_t i = 2;
+		while(i + 2 <= len){
+			uint8_t command = frame[i];
+			uint8_t data_len = frame[i + 1];
+			if(i + 2 + data_len > len)
+				break;
+			this->_stats.commands_received++;
+			if(this->_onCommand)
+				this->_onCommand(command, &frame[i + 2], data_len);
+			i += 2 + data_len;
+		}
+	}
+
+	this->_writeFrame(BRIDGE_FRAME_ACK, this->_expectedSequence - 1, nullptr, 0);
+}
+
+
+void UartBridge :: _onAck(uint8_t sequence) {
+	// cumulative ack, every frame up to sequence was received
+	uint32_t now = millis();
+	uint8_t acked = 0;
+	while(this->_framesCount > 0){
+		Frame & frame = this->_frames[this->_framesFirst];
+		if((uint8_t) (sequence - frame.sequence) >= BRIDGE_WINDOW)
+			break; // ack is older than this frame
+
+		this->_stats.commands_sent += frame.commands;
+		this->_stats.last_latency = now - frame.first_sent_at;
+		if(this->_stats.last_latency > this->_stats.max_latency)
+			this->_stats.max_latency = this->_stats.last_latency;
+
+		this->_framesFirst = (this->_framesFirst + 1) % BRIDGE_WINDOW;
+		this->_framesCount--;
+		acked++;
+	}
+
+	// the next frame was written behind the acknowledged ones and left the UART after them, its ack timeout starts now
+	if(acked > 0 and this->_framesCount > 0)
+		this->_frames[this->_framesFirst].sent_at = now;
+}
+
+
+void UartBridge :: _retransmit() {
+	if(this->_framesCount == 0)
+		return;
+
+	Frame & oldest = this->_frames[this->_framesFirst];
+	if(millis() - oldest.sent_at < this->_ackTimeout)
+		return;
+
+	if(oldest.retries >= BRIDGE_MAX_RETRIES){
+		// co-processor is not answering, drop everything in flight so new commands are not blocked
+		this->_stats.failures += this->_framesCount;
+		this->_framesCount = 0;
+		this->_writeFrame(BRIDGE_FRAME_SYNC, this->_nextSequence, nullptr, 0);
+		return;
+	}
+
+	for(uint8_t i = 0; i < this->_framesCount; i++){
+		Frame & frame = this->_frames[(this->_framesFirst + i) % BRIDGE_WINDOW];
+		frame.retries++;
+		frame.sent_at = millis();
+		this->_writeFrame(BRIDGE_FRAME_DATA, frame.sequence, frame.payload, frame.len);
+		this->_stats.retransmissions++;
+	}
+}
+
+
+void UartBridge :: _sendQueued() {
+	size_t queue_index = 0;
+
+	while(queue_index < this->_queueLen and this->_framesCount < BRIDGE_WINDOW){
+		Frame & frame = this->_frames[(this->_framesFirst + this->_framesCount) % BRIDGE_WINDOW];
+		frame.len = 0;
+		frame.commands = 0;
+
+		// pack whole commands until the frame is full
+		while(queue_index < this->_queueLen){
+			size_t command_len = 2 + this->_queue[queue_index + 1];
+			if(frame.len + command_len > BRIDGE_FRAME_MAX_PAYLOAD)
+				break;
+			memcpy(&frame.payload[frame.len], &this->_queue[queue_index], command_len);
+			frame.len += command_len;
+			frame.commands++;
+			queue_index += command_len;
+		}
+
+		frame.sequence = this->_nextSequence++;
+		frame.retries = 0;
+		frame.first_sent_at = frame.sent_at = millis();
+		this->_framesCount++;
+
+		this->_writeFrame(BRIDGE_FRAME_DATA, frame.sequence, frame.payload, frame.len);
+		this->_stats.frames_sent++;
+	}
+
+	if(queue_index > 0){
+		memmove(this->_queue, &this->_queue[queue_index], this->_queueLen - queue_index);
+		this->_queueLen -= queue_index;
+	}
+}
+
+
+void UartBridge :: _writeFrame(uint8_t type, uint8_t sequence, const uint8_t * payload, size_t len) {
+	uint8_t frame[BRIDGE_FRAME_MAX_SIZE];
+	frame[0] = type;
+	frame[1] = sequence;
+	if(len > 0)
+		memcpy(&frame[2], payload, len);
+	uint16_t crc = XeoSmartHomeInternals::crc16(frame, len + 2);
+	frame[len + 2] = crc >> 8;
+	frame[len + 3] = crc & 0xFF;
+
+	uint8_t encoded[BRIDGE_ENCODED_MAX_SIZE];
+	size_t encoded_len = XeoSmartHomeInternals::cobsEncode(frame, len + 4, encoded);
+	encoded[encoded_len++] = 0;
+	this->_stream.write(encoded, encoded_len);
+}
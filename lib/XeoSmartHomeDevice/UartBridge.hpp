@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+
+#define BRIDGE_FRAME_MAX_PAYLOAD 64 // bytes of commands in a frame
+#define BRIDGE_FRAME_MAX_SIZE (BRIDGE_FRAME_MAX_PAYLOAD + 4) // type, sequence, payload, crc
+#define BRIDGE_ENCODED_MAX_SIZE (BRIDGE_FRAME_MAX_SIZE + BRIDGE_FRAME_MAX_SIZE / 254 + 2) // COBS overhead and delimiter
+#define BRIDGE_COMMAND_MAX_DATA (BRIDGE_FRAME_MAX_PAYLOAD - 2) // bytes of data in a command
+#define BRIDGE_QUEUE_SIZE 256 // bytes of commands waiting for a free frame
+#define BRIDGE_WINDOW 4 // frames sent without waiting for an acknowledgement
+#define BRIDGE_MAX_RETRIES 5 // retransmissions before frames are dropped
+#define BRIDGE_ACK_PROCESSING 10 // miliseconds the co-processor needs to answer, added to the ack timeout
+
+#define BRIDGE_FRAME_DATA 1
+#define BRIDGE_FRAME_ACK 2
+#define BRIDGE_FRAME_SYNC 3 // receiver restarts at the frame sequence, sent after frames were dropped
+
+
+namespace XeoSmartHomeInternals {
+	typedef std::function<void(uint8_t command, const uint8_t * data, uint8_t len)> OnBridgeCommandCallback;
+
+	struct UartBridgeStats {
+		uint32_t commands_sent = 0; // commands acknowledged by the co-processor
+		uint32_t commands_received = 0;
+		uint32_t frames_sent = 0; // frames sent the first time
+		uint32_t retransmissions = 0; // frames sent again after an ack timeout
+		uint32_t failures = 0; // frames dropped after BRIDGE_MAX_RETRIES
+		uint32_t overflows = 0; // commands dropped because the queue was full
+		uint32_t crc_errors = 0; // received frames with a bad crc or framing
+		uint32_t last_latency = 0; // miliseconds from first send to acknowledgement
+		uint32_t max_latency = 0;
+	};
+
+	/*
+	* COBS encode, the output has no zero bytes
+	* @param input: data to encode
+	* @param len: data length
+	* @param output: buffer of at least len + len / 254 + 1 bytes
+	* @return encoded length
+	*/
+	size_t cobsEncode(const uint8_t * input, size_t len, uint8_t * output);
+
+	/*
+	* COBS decode
+	* @param input: encoded data, without the zero delimiter
+	* @param len: encoded length
+	* @param output: buffer of at least len bytes
+	* @return decoded length, 0 if input is not valid COBS
+	*/
+	size_t cobsDecode(const uint8_t * input, size_t len, uint8_t * output);
+
+	/*
+	* CRC-16/CCITT-FALSE
+	*/
+	uint16_t crc16(const uint8_t * data, size_t len);
+};
+
+
+/*
+* Framed link to a co-processor over a serial port
+* Commands are batched into COBS framed, CRC checked frames with sequence numbers. Up to BRIDGE_WINDOW frames are
+* in flight, frames that are not acknowledged in time are sent again (go-back-N).
+* Frame: type (1), sequence (1), payload, crc16 (2); payload: command (1), length (1), data, ... repeated
+* When frames are dropped after too many retries a sync frame moves the receiver to the next sequence
+*/
+class UartBridge {
+	public:
+		/*
+		* @param stream: serial port, already started
+		* @param baud: serial port speed, used for the ack timeout
+		*/
+		UartBridge(Stream & stream, uint32_t baud);
+
+		/*
+		* Queue a command, commands queued before the next loop() are sent in the same frame
+		* @param command: command code
+		* @param data: command data
+		* @param len: data length, up to BRIDGE_COMMAND_MAX_DATA
+		* @return false if the queue is full
+		*/
+		bool send(uint8_t command, const uint8_t * data = nullptr, uint8_t len = 0);
+
+		/*
+		* Set callback for commands received from the co-processor
+		*/
+		void onCommand(XeoSmartHomeInternals::OnBridgeCommandCallback callback);
+
+		/*
+		* Receive, retransmit and send frames, must be called in loop()
+		*/
+		void loop();
+
+		/*
+		* @return number of frames sent and not acknowledged yet
+		*/
+		uint8_t inFlight();
+
+		const XeoSmartHomeInternals::UartBridgeStats & getStats();
+
+	private:
+		struct Frame {
+			uint8_t sequence;
+			uint8_t len; // payload length
+			uint8_t payload[BRIDGE_FRAME_MAX_PAYLOAD];
+			uint8_t commands; // commands in payload
+			uint32_t first_sent_at;
+			uint32_t sent_at;
+			uint8_t retries;
+		};
+
+		Stream & _stream;
+		uint32_t _ackTimeout; // miliseconds
+		XeoSmartHomeInternals::OnBridgeCommandCallback _onCommand;
+		XeoSmartHomeInternals::UartBridgeStats _stats;
+
+		// commands waiting for a frame
+		uint8_t _queue[BRIDGE_QUEUE_SIZE];
+		size_t _queueLen = 0;
+
+		// frames in flight, oldest first
+		Frame _frames[BRIDGE_WINDOW];
+		uint8_t _framesFirst = 0;
+		uint8_t _framesCount = 0;
+		uint8_t _nextSequence = 0;
+
+		// receiver
+		uint8_t _rxBuffer[BRIDGE_ENCODED_MAX_SIZE];
+		size_t _rxLen = 0;
+		bool _rxOverflow = false;
+		uint8_t _expectedSequence = 0;
+
+		void _receive();
+		void _onFrame(const uint8_t * frame, size_t len);
+		void _onAck(uint8_t sequence);
+		void _retransmit();
+		void _sendQueued();
+		void _writeFrame(uint8_t type, uint8_t sequence, const uint8_t * payload, size_t len);
+};
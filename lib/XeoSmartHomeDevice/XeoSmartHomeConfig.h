@@ -0,0 +1,27 @@
+#pragma once
+
+/*
+* Compile-time feature switches
+* Disabled features are not compiled, their code, tables and RAM members are left out of the image
+* Override them in platformio.ini build_flags, e.g. -D XEO_FEATURE_LED=0
+*/
+
+// access point, captive DNS, web server and WebSocket setup events; started by a long button press
+#ifndef XEO_FEATURE_CONFIG_PORTAL
+#define XEO_FEATURE_CONFIG_PORTAL 1
+#endif
+
+// status LED and its color signals, FastLED is not linked without it
+#ifndef XEO_FEATURE_LED
+#define XEO_FEATURE_LED 1
+#endif
+
+// timed actions and the schedule_update topic, CronAlarms is not linked without it
+#ifndef XEO_FEATURE_CRON
+#define XEO_FEATURE_CRON 1
+#endif
+
+// push button: short press handler and the long press that toggles config mode
+#ifndef XEO_FEATURE_BUTTON
+#define XEO_FEATURE_BUTTON 1
+#endif
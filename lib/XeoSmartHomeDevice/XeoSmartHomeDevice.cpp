@@ -0,0 +1,842 @@
+#include "XeoSmartHomeDevice.h"
+#include <TaskScheduler.h>
+
+
+const char XeoSmartHomeInternals::WEBSOCKET_SERVER_URL[] PROGMEM = "/ws";
+const char XeoSmartHomeInternals::CAPTIVE_PORTAL_URL[] PROGMEM = "http://8.8.8.8/";
+const char XeoSmartHomeInternals::ntpServer[] PROGMEM = "pool.ntp.org";
+const char XeoSmartHomeInternals::timeZone[] PROGMEM = "EET-2EEST,M3.5.0/3,M10.5.0/4";
+
+
+IPAddress stringToIpAdress(const char *string) {
+	unsigned short a, b, c, d;
+	if(sscanf(string, "%hu.%hu.%hu.%hu", &a, &b, &c, &d) != 4)
+		return IPAddress(); // e.g. "(IP unset)", written for an address that was never set
+	return IPAddress(a, b, c, d);
+}
+
+
+IPAddress stringToIpAdress(String string) {
+	return stringToIpAdress(string.c_str());
+}
+
+
+size_t hexToBytes(const char *string, uint8_t * bytes, size_t size) {
+	size_t len = strlen(string);
+	if(len % 2 != 0 or len / 2 > size)
+		return 0;
+
+	for(size_t i = 0; i < len / 2; i++){
+		unsigned int byte;
+		if(not isxdigit(string[2 * i]) or not isxdigit(string[2 * i + 1]) or sscanf(&string[2 * i], "%2x", &byte) != 1)
+			return 0;
+		bytes[i] = byte;
+	}
+	return len / 2;
+}
+
+
+const char * formatReading(char * buffer, size_t size, float value) {
+	if(isfinite(value))
+		snprintf(buffer, size, "%.3f", value);
+	else
+		strlcpy(buffer, "null", size);
+	return buffer;
+}
+
+
+// PUBLIC:
+
+XeoSmartHomeDevice :: XeoSmartHomeDevice() {
+	this->_mqttClient = new AsyncMqttClient();
+#if XEO_FEATURE_CONFIG_PORTAL
+	this->_dnsServer = new AsyncDNSServer();
+	this->_webServer = new AsyncWebServer(XeoSmartHomeInternals::WEB_SERVER_PORT);
+	this->_webSocketServer = new AsyncWebSocket(FPSTR(XeoSmartHomeInternals::WEBSOCKET_SERVER_URL));
+#endif
+	this->_initTopicRouter();
+}
+
+
+XeoSmartHomeDevice :: ~XeoSmartHomeDevice() {
+	delete(this->_mqttClient);
+#if XEO_FEATURE_CONFIG_PORTAL
+	delete(this->_dnsServer);
+	delete(this->_webServer);
+	delete(this->_webSocketServer);
+#endif
+
+	for(XeoSmartHomeInternals::Sensor * sensor : this->_sensors)
+		delete(sensor);
+
+}
+
+
+void XeoSmartHomeDevice :: setName(const char * name) {
+	strncpy(this->_name, name, sizeof(this->_name));
+}
+
+
+void XeoSmartHomeDevice :: setSerial(const char * serial) {
+	strncpy(this->_serial, serial, sizeof(this->_serial));
+}
+
+
+void XeoSmartHomeDevice :: setDebug(bool debug){
+	XeoSmartHomeInternals::logger.setOutput(debug ? &Serial : nullptr);
+}
+
+
+void XeoSmartHomeDevice :: setHealthReportInterval(uint32_t seconds){
+	this->_healthReportInterval = seconds;
+	if(seconds == 0){
+		this->_mqttHealthTimer.disable();
+		return;
+	}
+	this->_mqttHealthTimer.setInterval(seconds * 1000);
+	this->_mqttHealthTimer.setIterations(TASK_FOREVER);
+	if(this->_mqttClient->connected())
+		this->_mqttHealthTimer.enableIfNot();
+}
+
+
+void XeoSmartHomeDevice :: init() {
+	this->_watchdog.begin();
+#if XEO_FEATURE_BUTTON
+	this->_initButton();
+#endif
+#if XEO_FEATURE_LED
+	this->_initLed();
+#endif
+	SPIFFS.begin();
+	if(not this->_dutyCycle.isEnabled())
+		delay(500); // wait for file system to initialize
+	this->_loadSettings();
+	this->_restoreSnapshot();
+	if(this->_watchdog.getResetRecord().activity != XeoSmartHomeInternals::ACTIVITY_NONE){
+		char activity[48];
+		XEO_LOG_WARNING("Watchdog reset in %s", this->_watchdogActivityName(this->_watchdog.getResetRecord().activity, this->_watchdog.getResetRecord().index, activity, sizeof(activity)));
+	}
+	this->_initNtpClient(); // restore time before any network work
+	this->_initWiFi();
+	this->_initMqttClient();
+	this->_initTelemetry();
+	this->_initSensors();
+	this->_initLocalControl();
+	this->_initOta();
+#if XEO_FEATURE_CONFIG_PORTAL
+	this->_initDnsServer();
+	this->_initWebServer();
+	this->_initWebSocketServer();
+#endif
+}
+
+
+void XeoSmartHomeDevice :: loop() {
+	this->_watchdog.leave(this->_outsideLoop);
+	// a reset between the named activities below is recorded as loop, begin() ignores ACTIVITY_NONE
+	XeoSmartHomeInternals::WatchdogBreadcrumb outside = this->_watchdog.enter(XeoSmartHomeInternals::ACTIVITY_LOOP);
+#if XEO_FEATURE_BUTTON
+	this->_checkForButtonStateChanges();
+#endif
+	this->_executeQueuedActions();
+	this->_executeCoalescedActions();
+	XeoSmartHomeInternals::WatchdogBreadcrumb previous = this->_watchdog.enter(XeoSmartHomeInternals::ACTIVITY_SCHEDULER);
+	this->_taskScheduler.execute();
+	this->_watchdog.leave(previous);
+	this->_timeService.loop();
+	this->_localControl.loop();
+	if(this->_stateRequested){
+		this->_stateRequested = false;
+		this->_sendState();
+	}
+	if(this->_logsRequested){
+		this->_logsRequested = false;
+		this->_sendLogs();
+	}
+	for(size_t i = 0; i < this->_bridges.size(); i++){
+		previous = this->_watchdog.enter(XeoSmartHomeInternals::ACTIVITY_BRIDGE, i);
+		this->_bridges[i]->loop();
+		this->_watchdog.leave(previous);
+	}
+	this->_runOta();
+#if XEO_FEATURE_CONFIG_PORTAL
+	this->_runLiveFeed();
+#endif
+	this->_runWatchdog();
+	this->_saveSnapshot();
+	this->_runDutyCycle();
+	this->_runReboot();
+	this->_runConfigRollback();
+	//this->_ntpClient->update();
+#if XEO_FEATURE_CRON
+	Cron.delay();
+#endif
+	XeoSmartHomeInternals::logger.drain(LOG_DRAIN_BUDGET);
+	this->_watchdog.leave(outside);
+	this->_outsideLoop = this->_watchdog.enter(XeoSmartHomeInternals::ACTIVITY_OUTSIDE_LOOP);
+}
+
+
+void XeoSmartHomeDevice :: addActionHandler(const char * action_name, XeoSmartHomeInternals::OnActionCallback callback, XeoSmartHomeInternals::ActionPolicy policy) {
+	// queued actions and watchdog breadcrumbs keep the handler index in 16 bits
+	if(this->_ActionsVector.size() > UINT16_MAX){
+		XEO_LOG_WARNING("Too many action handlers, %s not added", action_name);
+		return;
+	}
+
+	XeoSmartHomeInternals::Action action;
+	strncpy(action.name, action_name, ACTION_NAME_MAX_LENGTH);
+	action.callback = callback;
+	action.policy = policy;
+	action.tokens = policy.burst;
+	this->_ActionsVector.push_back(action);
+}
+
+
+void XeoSmartHomeDevice :: addBridgeActionHandler(const char * action_name, UartBridge & bridge, uint8_t command, XeoSmartHomeInternals::ActionPolicy policy) {
+	if(std::find(this->_bridges.begin(), this->_bridges.end(), &bridge) == this->_bridges.end())
+		this->_bridges.push_back(&bridge);
+
+	UartBridge * bridge_ptr = &bridge;
+	this->addActionHandler(action_name, [bridge_ptr, command](JsonArray& parameters){
+		uint8_t data[BRIDGE_COMMAND_MAX_DATA];
+		size_t len = parameters.isNull() or parameters.size() == 0 ? 0 : measureMsgPack(parameters);
+		if(len > sizeof(data)){
+			XEO_LOG_WARNING("Bridge command %u parameters too long: %u bytes", command, len);
+			return;
+		}
+		if(len > 0)
+			serializeMsgPack(parameters, data, sizeof(data));
+		if(not bridge_ptr->send(command, data, len))
+			XEO_LOG_WARNING("Bridge queue full, command %u dropped", command);
+	}, policy);
+}
+
+
+const XeoSmartHomeInternals::ActionCounters * XeoSmartHomeDevice :: getActionCounters(const char * action_name){
+	for(XeoSmartHomeInternals::Action & action : this->_ActionsVector){
+		if(strcmp(action.name, action_name) == 0)
+			return &action.counters;
+	}
+	return nullptr;
+}
+
+
+
+bool XeoSmartHomeDevice :: sendSensorData(const char * sensor, float value){
+#if XEO_FEATURE_CONFIG_PORTAL
+	if(this->_liveSubscriberCount > 0){
+		char live_value[16];
+		this->_liveFeedUpdate(XeoSmartHomeInternals::LIVE_SENSOR, sensor, formatReading(live_value, sizeof(live_value), value));
+	}
+#endif
+
+	if(not this->_mqttClient->connected()){
+		this->_snapshotPendingSensorValue(sensor, value);
+		return false;
+	}
+
+	if(this->_wireFormat == XeoSmartHomeInternals::WIRE_FORMAT_MSGPACK){
+		// keep room for a new key, a nested array and the value
+		if(this->_telemetryBatch.memoryUsage() + JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(1) + strlen(sensor) + 1 > this->_telemetryBatch.capacity() and not this->_flushTelemetry()){
+			this->_snapshotPendingSensorValue(sensor, value); // batch could not be sent, keep the value like without a connection
+			return false;
+		}
+
+		// a char array key is copied into the document, the sketch's string may not outlive the batch
+		char key[SENSOR_NAME_MAX_LENGTH];
+		strlcpy(key, sensor, sizeof(key));
+		JsonArray values = this->_telemetryBatch[key].as<JsonArray>();
+		if(values.isNull())
+			values = this->_telemetryBatch.createNestedArray(key);
+		values.add(value);
+		return true;
+	}
+	
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	this->_publish(this->_topic(topic, PSTR("sensor/"), sensor), 2, false, isfinite(value) ? String(value).c_str() : "null");
+
+	return true;
+}
+
+
+bool XeoSmartHomeDevice :: sendStatusUpdate(const char * status, int value){
+	this->_snapshotStatus(status, value);
+#if XEO_FEATURE_CONFIG_PORTAL
+	if(this->_liveSubscriberCount > 0){
+		char live_value[12];
+		snprintf(live_value, sizeof(live_value), "%d", value);
+		this->_liveFeedUpdate(XeoSmartHomeInternals::LIVE_STATUS, status, live_value);
+	}
+#endif
+
+	uint8_t status_count = this->_statusCount;
+	XeoSmartHomeInternals::StatusEntry * entry = this->_getStatusEntry(status);
+	if(entry != nullptr){
+		if(entry->value != value or this->_statusCount != status_count)
+			entry->dirty = true;
+		entry->value = value;
+		entry->updated_at = this->_timeService.now();
+	}
+
+	if(not this->_mqttClient->connected())
+		return false;
+
+	// table is full, status is not tracked and always sent
+	if(entry != nullptr){
+		if(not entry->dirty)
+			return true;
+		entry->dirty = false;
+	}
+	
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	this->_publish(this->_topic(topic, PSTR("status/"), status), 2, false, String(value).c_str());
+
+	return true;
+}
+
+
+bool XeoSmartHomeDevice :: addTopicHandler(const char * topic, XeoSmartHomeInternals::OnTopicCallback callback){
+	return this->_topicRouter.add(topic, callback);
+}
+
+
+void XeoSmartHomeDevice :: addSensor(const char * sensor, XeoSmartHomeInternals::SensorReadCallback read, uint32_t sample_period, uint32_t window){
+	XeoSmartHomeInternals::Sensor * new_sensor = new XeoSmartHomeInternals::Sensor();
+	strncpy(new_sensor->name, sensor, SENSOR_NAME_MAX_LENGTH - 1);
+	new_sensor->name[SENSOR_NAME_MAX_LENGTH - 1] = '\0';
+	new_sensor->read = read;
+	new_sensor->sample_period = sample_period > 0 ? sample_period : 1;
+	new_sensor->window_samples = std::max<uint32_t>(window / new_sensor->sample_period, 1);
+	this->_sensors.push_back(new_sensor);
+}
+
+
+void XeoSmartHomeDevice :: setTimeZone(const char * time_zone){
+	this->_timeZone = time_zone;
+}
+
+
+void XeoSmartHomeDevice :: setNtpServer(const char * ntp_server){
+	this->_ntpServer = ntp_server;
+}
+
+
+time_t XeoSmartHomeDevice :: now(){
+	return this->_timeService.now();
+}
+
+
+XeoSmartHomeInternals::TimeSyncState XeoSmartHomeDevice :: getTimeSyncState(){
+	return this->_timeService.getSyncState();
+}
+
+
+void XeoSmartHomeDevice :: setDutyCycle(uint32_t sleep_seconds, uint32_t awake_budget){
+	this->_dutyCycle.begin(sleep_seconds, awake_budget);
+}
+
+
+uint16_t XeoSmartHomeDevice :: getResetCount(){
+	return this->_snapshot.reset_count;
+}
+
+
+void XeoSmartHomeDevice :: setWireFormat(XeoSmartHomeInternals::WireFormat format){
+	if(this->_wireFormat == XeoSmartHomeInternals::WIRE_FORMAT_MSGPACK)
+		this->_flushTelemetry();
+	this->_wireFormat = format;
+}
+
+
+const XeoSmartHomeInternals::ActionQueueStats & XeoSmartHomeDevice :: getActionQueueStats(){
+	this->_actionQueueStats.depth = this->_actionQueue.size();
+	return this->_actionQueueStats;
+}
+
+
+const XeoSmartHomeInternals::LocalControlStats & XeoSmartHomeDevice :: getLocalControlStats(){
+	return this->_localControl.getStats();
+}
+
+
+#if XEO_FEATURE_CONFIG_PORTAL
+const XeoSmartHomeInternals::CaptivePortalStats & XeoSmartHomeDevice :: getCaptivePortalStats(){
+	return this->_captivePortalStats;
+}
+#endif
+
+
+void XeoSmartHomeDevice :: requestReboot(const char * reason){
+	if(this->_rebootPhase != XeoSmartHomeInternals::REBOOT_NONE)
+		return;
+
+	this->_rebootReason = reason;
+	this->_rebootPhase = XeoSmartHomeInternals::REBOOT_REQUESTED;
+	this->_rebootPhaseStart = millis();
+}
+
+
+uint32_t XeoSmartHomeDevice :: getStallCount(){
+	return this->_watchdog.getStallCount();
+}
+// PRIVATE:
+
+//<SETTINGS>
+
+void XeoSmartHomeDevice :: _loadSettings() {
+	if(not SPIFFS.exists(SETTINGS_FILE))
+		this->_saveSettings(); // first boot, the defaults
+
+	this->_readSettings(this->_settings, this->_name, sizeof(this->_name));
+	this->_localControl.setKey(this->_settings.local_key, this->_settings.local_key_len);
+	this->_actionAuthenticator.setKey(this->_settings.local_key, this->_settings.local_key_len);
+	this->_configTrial = SPIFFS.exists(CONFIG_PREVIOUS_FILE);
+
+	if(SPIFFS.exists(ACTION_COUNTER_FILE)){
+		File counter_file = SPIFFS.open(ACTION_COUNTER_FILE, "r");
+		this->_settings.action_counter = strtoul(counter_file.readStringUntil('\n').c_str(), nullptr, 10);
+		counter_file.close();
+	}
+}
+
+
+bool XeoSmartHomeDevice :: _readSettings(XeoSmartHomeInternals :: Settings & settings, char * name, size_t name_size) {
+	File settings_file = SPIFFS.open(SETTINGS_FILE, "r");
+	if(not settings_file)
+		return false;
+
+	// lines end with "\r\n", see _saveSettings()
+	size_t name_len = settings_file.readBytesUntil('\n', name, name_size - 1);
+	if(name_len > 0 and name[name_len - 1] == '\r')
+		name_len--;
+	name[name_len] = '\0';
+
+	settings.dhcp = settings_file.readStringUntil('\n').toInt();
+	settings.local_ip = stringToIpAdress(settings_file.readStringUntil('\n'));
+	settings.gateway = stringToIpAdress(settings_file.readStringUntil('\n'));
+	settings.subnet_mask = stringToIpAdress(settings_file.readStringUntil('\n'));
+
+	String local_key = settings_file.readStringUntil('\n');
+	local_key.trim();
+	settings.local_key_len = hexToBytes(local_key.c_str(), settings.local_key, sizeof(settings.local_key));
+	settings_file.close();
+	return true;
+}
+
+
+bool XeoSmartHomeDevice :: _saveSettings() {
+	File settings_file = SPIFFS.open(SETTINGS_FILE, "w");
+	settings_file.println(this->_name);
+	settings_file.println(this->_settings.dhcp ? "1" : "0");
+	settings_file.println(this->_settings.local_ip);
+	settings_file.println(this->_settings.gateway);
+	settings_file.println(this->_settings.subnet_mask);
+	for(uint8_t i = 0; i < this->_settings.local_key_len; i++)
+		settings_file.printf("%02x", this->_settings.local_key[i]);
+	settings_file.println();
+	settings_file.close();
+
+	// read back: a key that does not survive the file is lost on the next boot, with local control and signed actions
+	XeoSmartHomeInternals :: Settings saved;
+	char name[sizeof(this->_name)];
+	if(not this->_readSettings(saved, name, sizeof(name)) or saved.local_key_len != this->_settings.local_key_len
+		or memcmp(saved.local_key, this->_settings.local_key, saved.local_key_len) != 0){
+		XEO_LOG_ERROR("Settings read back differ from the saved ones");
+		return false;
+	}
+	return true;
+}
+
+
+void XeoSmartHomeDevice :: _saveActionCounter() {
+	if(this->_snapshot.action_counter <= this->_settings.action_counter)
+		return; // within the reserved block
+
+	uint32_t counter = this->_snapshot.action_counter;
+	this->_settings.action_counter = counter > UINT32_MAX - ACTION_COUNTER_RESERVE ? UINT32_MAX : counter + ACTION_COUNTER_RESERVE;
+	File counter_file = SPIFFS.open(ACTION_COUNTER_FILE, "w");
+	counter_file.println(this->_settings.action_counter);
+	counter_file.close();
+}
+
+//</SETTINGS>
+// <WIFI>
+
+void XeoSmartHomeDevice :: _initWiFi() {
+	//WiFi.mode(WIFI_STA);
+	WiFi.hostname(this->_name);
+#if XEO_FEATURE_CONFIG_PORTAL
+	if(not this->_dutyCycle.isEnabled()){
+		// access point is configured once here, it is started in config mode
+		WiFi.softAP(this->_name);
+		WiFi.softAPConfig(IPAddress(8,8,8,8), IPAddress(8,8,8,8), IPAddress(255, 255, 255, 0));
+		delay(500);
+	}
+#endif
+	//WiFi.softAPConfig(accesPointIp, accesPointIp, NET_MASK);
+
+	WiFi.mode(WIFI_STA);
+
+	// static address from the config portal or a config patch, the gateway is also the DNS server
+	if(not this->_settings.dhcp and this->_settings.local_ip.isSet())
+		WiFi.config(this->_settings.local_ip, this->_settings.gateway, this->_settings.subnet_mask, this->_settings.gateway);
+
+	this->_taskScheduler.addTask(this->_wifiTimer);
+
+	this->_WiFiEventStationModeGotIP = WiFi.onStationModeGotIP([this](const WiFiEventStationModeGotIP& event){
+		this->_onWifiConnected(event);
+	});
+
+	this->_WiFiEventStationModeDisconnected = WiFi.onStationModeDisconnected([this](const WiFiEventStationModeDisconnected& event){
+		this->_onWifiDisconnected(event);
+	});
+
+	if(this->_snapshot.wifi_valid and WiFi.SSID().length() > 0){
+		// skip the scan, connect to the last access point; not persistent so flash config is not locked to this BSSID
+		this->_wifiFastConnect = true;
+		WiFi.persistent(false);
+		WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str(), this->_snapshot.channel, this->_snapshot.bssid);
+		WiFi.persistent(true);
+	} else {
+		WiFi.begin();
+	}
+}
+
+
+void XeoSmartHomeDevice :: _onWifiConnected(const WiFiEventStationModeGotIP& event) {
+	XEO_LOG_INFO("WiFi connected, IP: %s", event.ip.toString().c_str());
+	this->_snapshot.wifi_valid = true;
+	this->_snapshot.channel = WiFi.channel();
+	memcpy(this->_snapshot.bssid, WiFi.BSSID(), sizeof(this->_snapshot.bssid));
+	this->_snapshotDirty = true;
+	this->_wifiFastConnect = false; // later disconnects are ordinary, the access point from the snapshot is fine
+
+	this->_startMqttClient();
+	if(not this->_dutyCycle.isEnabled() and this->_localControl.hasKey())
+		this->_localControl.begin(this->_serial, this->_name);
+	this->_wifiTimer.disable();
+#if XEO_FEATURE_LED
+	if(not this->_config_mode){
+		this->_ledTask.disable();
+	}
+#endif
+}
+
+
+void XeoSmartHomeDevice ::_onWifiDisconnected(const WiFiEventStationModeDisconnected& event){
+	XEO_LOG_WARNING("WiFi disconnected, reason: %d", event.reason);
+
+	this->_stopMqttClient();
+
+	if(this->_wifiFastConnect){
+		// access point from the snapshot is gone, fall back to a normal connect with scan
+		this->_wifiFastConnect = false;
+		this->_snapshot.wifi_valid = false;
+		this->_snapshotDirty = true;
+		WiFi.persistent(false);
+		WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str());
+		WiFi.persistent(true);
+	}
+
+#if XEO_FEATURE_LED
+	this->_wifiTimer.setInterval(20 * 1000);
+	this->_wifiTimer.setIterations(TASK_FOREVER);
+	this->_wifiTimer.setCallback([this](){
+		if(not WiFi.isConnected() and not this->_config_mode)
+			this->_setColorSignal(XeoSmartHomeInternals::COLOR_SIGNAL_WIFI_NOT_CONNECTED);
+	});
+	this->_wifiTimer.enable();
+#endif
+}
+
+// </WIFI>
+// <SNAPSHOT>
+
+void XeoSmartHomeDevice :: _restoreSnapshot(){
+	rst_info * reset_info = ESP.getResetInfoPtr();
+	bool warm_reset = reset_info->reason != REASON_DEFAULT_RST and reset_info->reason != REASON_EXT_SYS_RST;
+
+	if(not warm_reset or not XeoSmartHomeInternals::rtcLoad(XeoSmartHomeInternals::RTC_SNAPSHOT_OFFSET, this->_snapshot) or this->_snapshot.version != SNAPSHOT_VERSION){
+		memset(&this->_snapshot, 0, sizeof(this->_snapshot));
+		this->_snapshot.version = SNAPSHOT_VERSION;
+	} else if(reset_info->reason == REASON_DEEP_SLEEP_AWAKE){
+		this->_snapshot.cycle_count++;
+	} else {
+		this->_snapshot.reset_count++;
+	}
+
+	// the snapshot is cleared on power on, the persisted counter keeps old signed messages from being replayed
+	if(this->_settings.action_counter > this->_snapshot.action_counter)
+		this->_snapshot.action_counter = this->_settings.action_counter;
+
+	// restored statuses were already reported before the reset, they are only part of the state snapshot
+	for(uint8_t i = 0; i < this->_snapshot.status_count; i++){
+		XeoSmartHomeInternals::StatusEntry * entry = this->_getStatusEntry(this->_snapshot.statuses[i].key);
+		entry->value = this->_snapshot.statuses[i].value;
+		entry->dirty = false;
+	}
+
+	XEO_LOG_INFO("Snapshot: reset %u, reason %s, %u statuses, %u pending values", this->_snapshot.reset_count, ESP.getResetReason().c_str(), this->_snapshot.status_count, this->_snapshot.pending_count);
+
+	this->_snapshotDirty = true;
+	this->_saveSnapshot();
+}
+
+
+void XeoSmartHomeDevice :: _saveSnapshot(){
+	if(not this->_snapshotDirty)
+		return;
+	this->_snapshotDirty = false;
+	XeoSmartHomeInternals::rtcStore(XeoSmartHomeInternals::RTC_SNAPSHOT_OFFSET, this->_snapshot);
+}
+
+
+void XeoSmartHomeDevice :: _snapshotStatus(const char * status, int value){
+	if(strlen(status) >= SNAPSHOT_STATUS_KEY_MAX_LENGTH)
+		return;
+
+	for(uint8_t i = 0; i < this->_snapshot.status_count; i++){
+		XeoSmartHomeInternals::SnapshotStatus & entry = this->_snapshot.statuses[i];
+		if(strcmp(entry.key, status) == 0){
+			if(entry.value != value){
+				entry.value = value;
+				this->_snapshotDirty = true;
+			}
+			return;
+		}
+	}
+
+	if(this->_snapshot.status_count == SNAPSHOT_STATUS_COUNT)
+		return;
+
+	XeoSmartHomeInternals::SnapshotStatus & entry = this->_snapshot.statuses[this->_snapshot.status_count++];
+	strcpy(entry.key, status);
+	entry.value = value;
+	this->_snapshotDirty = true;
+}
+
+
+void XeoSmartHomeDevice :: _snapshotPendingSensorValue(const char * sensor, float value){
+	if(strlen(sensor) >= SNAPSHOT_STATUS_KEY_MAX_LENGTH)
+		return;
+
+	if(this->_snapshot.pending_count == SNAPSHOT_PENDING_COUNT){
+		memmove(&this->_snapshot.pending[0], &this->_snapshot.pending[1], sizeof(XeoSmartHomeInternals::SnapshotSensorValue) * (SNAPSHOT_PENDING_COUNT - 1));
+		this->_snapshot.pending_count--;
+	}
+
+	XeoSmartHomeInternals::SnapshotSensorValue & entry = this->_snapshot.pending[this->_snapshot.pending_count++];
+	strcpy(entry.sensor, sensor);
+	entry.value = value;
+	entry.timestamp = this->_timeService.getSyncState() == XeoSmartHomeInternals::TIME_NOT_SET ? 0 : this->_timeService.now();
+	this->_snapshotDirty = true;
+}
+
+
+void XeoSmartHomeDevice :: _sendPendingSensorValues(){
+	uint8_t pending_count = this->_snapshot.pending_count;
+	if(pending_count == 0)
+		return;
+
+	this->_snapshot.pending_count = 0;
+	this->_snapshotDirty = true;
+
+	time_t now = this->_timeService.now();
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	char payload[64];
+	char value[16];
+	for(uint8_t i = 0; i < pending_count; i++){
+		XeoSmartHomeInternals::SnapshotSensorValue & entry = this->_snapshot.pending[i];
+
+		// sent late, a value is only meaningful with the time it was read
+		if(entry.timestamp == 0 or now - (time_t) entry.timestamp > SNAPSHOT_PENDING_MAX_AGE){
+			XEO_LOG_DEBUG("Pending %s value dropped, %s", entry.sensor, entry.timestamp == 0 ? "read before time was set" : "too old");
+			continue;
+		}
+
+		snprintf(payload, sizeof(payload), "{\"value\":%s,\"ts\":%u}", formatReading(value, sizeof(value), entry.value), entry.timestamp);
+		this->_publish(this->_topic(topic, PSTR("sensor/"), entry.sensor, PSTR("/pending")), 2, false, payload);
+	}
+}
+
+// </SNAPSHOT>
+// <DUTY-CYCLE>
+
+void XeoSmartHomeDevice :: _runDutyCycle(){
+	if(not this->_dutyCycle.isEnabled() or this->_config_mode or this->_rebootPhase != XeoSmartHomeInternals::REBOOT_NONE)
+		return;
+
+	if(this->_otaUpdater.getState() == XeoSmartHomeInternals::OTA_RECEIVING)
+		return; // stay awake until the image is complete
+
+	// held actions, the state to send and unacknowledged publishes keep the device awake, up to the awake budget
+	bool busy = not this->_actionQueue.empty() or this->_mqttUnacked > 0 or this->_stateRequested;
+	for(XeoSmartHomeInternals::CoalescedAction & slot : this->_coalescedActions)
+		busy = busy or slot.pending;
+
+	switch(this->_dutyCycle.run(millis(), this->_mqttClient->connected(), busy)){
+	case XeoSmartHomeInternals::DUTY_CYCLE_STEP_SEND_READINGS:
+		this->_sendDutyCycleReadings();
+		break;
+
+	case XeoSmartHomeInternals::DUTY_CYCLE_STEP_DISCONNECT:
+		// a clean disconnect does not trigger the last will
+		this->_publish(this->_mqttPresenceTopic, 1, true, MQTT_PRESENCE_SLEEPING);
+		this->_mqttClient->disconnect();
+		break;
+
+	case XeoSmartHomeInternals::DUTY_CYCLE_STEP_SLEEP:
+		if(this->_dutyCycle.isBudgetExceeded())
+			XEO_LOG_WARNING("Duty cycle: awake budget exceeded, %u messages not acknowledged", this->_mqttUnacked);
+		this->_sleep();
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+void XeoSmartHomeDevice :: _sendDutyCycleReadings(){
+	if(this->_snapshot.cycle_count > 0){
+		char payload[96];
+		snprintf(payload, sizeof(payload), "{\"cycle\":%u,\"awake_ms\":%u,\"energy_mj\":%.3f}",
+			this->_snapshot.cycle_count, this->_snapshot.last_awake_time, this->_snapshot.last_energy / 1000.0f);
+
+		char topic[MQTT_TOPIC_MAX_LENGTH];
+		this->_publish(this->_topic(topic, PSTR("duty_cycle")), 1, false, payload);
+	}
+
+	for(XeoSmartHomeInternals::Sensor * sensor : this->_sensors)
+		this->sendSensorData(sensor->name, sensor->read());
+
+	this->_flushTelemetry();
+}
+
+
+void XeoSmartHomeDevice :: _sleep(){
+	uint64_t sleep_time = std::min((uint64_t) this->_dutyCycle.getSleepSeconds() * 1000000, ESP.deepSleepMax());
+
+	// millis() starts at boot, the wake up time before the sketch starts is not counted
+	uint32_t awake_time = millis();
+	this->_snapshot.last_awake_time = awake_time;
+	this->_snapshot.last_energy = XeoSmartHomeInternals::dutyCycleEnergy(awake_time, sleep_time);
+	this->_snapshotDirty = true;
+
+	this->_runConfigRollback(true); // a whole cycle without MQTT
+	XEO_LOG_INFO("Duty cycle: awake %u ms, sleeping %u s", awake_time, (uint32_t) (sleep_time / 1000000));
+	XeoSmartHomeInternals::logger.flush();
+
+	this->_timeService.save();
+	this->_saveSnapshot();
+	ESP.deepSleep(sleep_time);
+}
+
+// </DUTY-CYCLE>
+// <NTP-CLIENT>
+
+void XeoSmartHomeDevice :: _initNtpClient(){
+	this->_timeService.begin(this->_timeZone, this->_ntpServer);
+}
+
+// </NTP-CLIENT>
+// <WATCHDOG>
+
+void XeoSmartHomeDevice :: _runWatchdog(){
+	if(not this->_watchdog.takeStall())
+		return;
+
+	const XeoSmartHomeInternals::WatchdogStall & stall = this->_watchdog.getLastStall();
+	char activity[48];
+	XEO_LOG_WARNING("Loop stalled %u ms in %s", stall.duration, this->_watchdogActivityName(stall.activity, stall.index, activity, sizeof(activity)));
+	this->_sendWatchdogReport(false);
+}
+
+
+void XeoSmartHomeDevice :: _sendWatchdogReport(bool reset){
+	if(not this->_mqttClient->connected())
+		return;
+
+	char activity[48];
+	char payload[192];
+	if(reset){
+		const XeoSmartHomeInternals::WatchdogResetRecord & record = this->_watchdog.getResetRecord();
+		snprintf_P(payload, sizeof(payload), PSTR("{\"event\":\"reset\",\"reason\":\"%s\",\"activity\":\"%s\",\"uptime\":%u}"),
+			ESP.getResetReason().c_str(), this->_watchdogActivityName(record.activity, record.index, activity, sizeof(activity)), record.uptime);
+	} else {
+		const XeoSmartHomeInternals::WatchdogStall & stall = this->_watchdog.getLastStall();
+		snprintf_P(payload, sizeof(payload), PSTR("{\"event\":\"stall\",\"activity\":\"%s\",\"duration\":%u,\"stalls\":%u}"),
+			this->_watchdogActivityName(stall.activity, stall.index, activity, sizeof(activity)), stall.duration, this->_watchdog.getStallCount());
+	}
+
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	this->_publish(this->_topic(topic, PSTR("watchdog")), 1, false, payload);
+}
+
+
+namespace XeoSmartHomeWatchdog {
+	// indexed by WatchdogActivity
+	const char ACTIVITIES[][16] PROGMEM = {"none", "outside_loop", "scheduler", "action", "sensor", "bridge", "ota", "button", "loop"};
+	static_assert(sizeof(ACTIVITIES) / sizeof(ACTIVITIES[0]) == XeoSmartHomeInternals::ACTIVITY_COUNT, "an activity has no name");
+};
+
+
+const char * XeoSmartHomeDevice :: _watchdogActivityName(XeoSmartHomeInternals::WatchdogActivity activity, uint16_t index, char * buffer, size_t size){
+	char activity_name[sizeof(XeoSmartHomeWatchdog::ACTIVITIES[0])];
+	strlcpy_P(activity_name, XeoSmartHomeWatchdog::ACTIVITIES[activity < XeoSmartHomeInternals::ACTIVITY_COUNT ? activity : 0], sizeof(activity_name));
+
+	// indexes point into vectors filled in setup(), they are the same after a reset
+	const char * name = nullptr;
+	if(activity == XeoSmartHomeInternals::ACTIVITY_ACTION and index < this->_ActionsVector.size())
+		name = this->_ActionsVector[index].name;
+	else if(activity == XeoSmartHomeInternals::ACTIVITY_SENSOR and index < this->_sensors.size())
+		name = this->_sensors[index]->name;
+
+	if(name != nullptr)
+		snprintf(buffer, size, "%s:%s", activity_name, name);
+	else if(activity == XeoSmartHomeInternals::ACTIVITY_BRIDGE)
+		snprintf(buffer, size, "%s:%u", activity_name, index);
+	else
+		strlcpy(buffer, activity_name, size);
+	return buffer;
+}
+
+// </WATCHDOG>
+// <REBOOT>
+
+void XeoSmartHomeDevice :: _runReboot(){
+	switch(this->_rebootPhase){
+	case XeoSmartHomeInternals::REBOOT_REQUESTED:
+		if(millis() - this->_rebootPhaseStart < REBOOT_FLUSH_DELAY)
+			return;
+#if XEO_FEATURE_CONFIG_PORTAL
+		this->_webSocketServer->closeAll();
+#endif
+		if(this->_mqttClient->connected()){
+			// a clean disconnect does not trigger the last will, presence is set here
+			this->_publish(this->_mqttPresenceTopic, 1, true, MQTT_PRESENCE_OFFLINE);
+			this->_mqttClient->disconnect();
+		}
+		this->_rebootPhase = XeoSmartHomeInternals::REBOOT_DISCONNECTING;
+		this->_rebootPhaseStart = millis();
+		break;
+
+	case XeoSmartHomeInternals::REBOOT_DISCONNECTING:
+		if(this->_mqttClient->connected() and millis() - this->_rebootPhaseStart < REBOOT_DISCONNECT_TIMEOUT)
+			return;
+		XEO_LOG_INFO("Rebooting: %s", this->_rebootReason);
+		this->_timeService.save();
+		this->_saveSnapshot();
+		XeoSmartHomeInternals::logger.flush();
+		SPIFFS.end();
+		ESP.restart();
+		break;
+
+	default:
+		break;
+	}
+}
+
+// </REBOOT>
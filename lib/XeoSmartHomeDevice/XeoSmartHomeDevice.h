@@ -1,24 +1,47 @@
 #pragma once
 
+#include "XeoSmartHomeConfig.h"
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
+#if XEO_FEATURE_CONFIG_PORTAL
 #include <ESPAsyncDNSServer.h>
 #include <ESPAsyncWebServer.h>
 #include <AsyncWebSocket.h>
+#endif
 #include <AsyncMqttClient.h>
+#if XEO_FEATURE_LED
 #include <FastLED.h>
-#include <CronAlarms.h> 
+#endif
+#if XEO_FEATURE_CRON
+#include <CronAlarms.h>
+#endif
 #include <FS.h>
 #include <ArduinoJson.h>
+#include <memory>
+#include <algorithm>
 #define _TASK_STD_FUNCTION 
-#include <TaskScheduler.h>
-#include <CronAlarms.h>
+#include <TaskSchedulerDeclarations.h> // TaskScheduler.h is included once, in XeoSmartHomeDevice.cpp
+#include "RingBuffer.hpp"
+#include "ActionBinding.hpp"
+#include "TimeService.hpp"
+#include "Logger.hpp"
+#include "UartBridge.hpp"
+#include "LocalControl.hpp"
+#include "TopicRouter.hpp"
+#include "ActionAuth.hpp"
+#include "OtaUpdater.hpp"
+#include "LoopWatchdog.hpp"
+#include "DutyCycle.hpp"
 
 #define XEOSMARTHOME_SERVER "xeosmarthome.com"
 #define ACTION_NAME_MAX_LENGTH 32
+#define ACTION_QUEUE_SIZE 8 // max actions waiting to be executed, must be a power of two
+#define ACTION_PARAMETERS_MAX_SIZE 128 // bytes, MessagePack encoded parameters of a queued action
+#define ACTION_COALESCE_SLOTS 4 // max actions waiting for their coalesce window at the same time
 #define BUTTON_SHORT_PRESS_MIN 50
 #define BUTTON_SHORT_PRESS_MAX 500
 #define BUTTON_LONG_PRESS 5000
+#define LED_SIGNAL_MAX_COLORS 8 // colors in the longest color signal
 
 #define SUCCESS 1
 #define FAIL 0
@@ -26,18 +49,179 @@
 
 #define NTP_TIMEOUT 1500
 
+#define MQTT_PORT 1883
+#define MQTT_KEEP_ALIVE 60 // seconds, broker publishes the last will if no packet is received in 1.5x this interval
+#define MQTT_PRESENCE_ONLINE "online"
+#define MQTT_PRESENCE_OFFLINE "offline"
+#define MQTT_PRESENCE_SLEEPING "sleeping"
+
+#define SENSOR_NAME_MAX_LENGTH 32
+
+#define STATUS_TABLE_SIZE 16 // statuses tracked by the device state shadow
+#define STATUS_KEY_MAX_LENGTH 32
+#define STATE_DOCUMENT_SIZE (JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(STATUS_TABLE_SIZE)) // keys point into the status table
+#define STATE_PAYLOAD_SIZE (40 + STATUS_TABLE_SIZE * (STATUS_KEY_MAX_LENGTH + 15)) // bytes, {"ts":<int64>,"status":{}} and "<key>":<int32>, per status
+#define GET_STATE_ACTION "get_state"
+#define GET_LOGS_ACTION "get_logs"
+
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_STATUS_COUNT 8 // last reported statuses kept across warm restarts
+#define SNAPSHOT_STATUS_KEY_MAX_LENGTH 20
+#define SNAPSHOT_PENDING_COUNT 4 // sensor values waiting for MQTT kept across warm restarts
+#define SNAPSHOT_PENDING_MAX_AGE 3600 // seconds, older pending sensor values are dropped
+#define ACTION_COUNTER_FILE "/action_counter.txt" // ctr claims reserved for signed messages, RTC memory is lost on power off
+#define ACTION_COUNTER_RESERVE 64 // ctr claims reserved per ACTION_COUNTER_FILE write, unused ones are rejected after a power on
+
+#define TELEMETRY_BATCH_SIZE 512 // bytes, MessagePack telemetry batch document capacity
+#define TELEMETRY_BATCH_INTERVAL 10000 // miliseconds between MessagePack telemetry batches
+
+#define OTA_STATUS_INTERVAL 5000 // miliseconds between status reports of an HTTP download
+
+#define CONFIG_PATCH_MAX_FIELDS 8 // members of a config patch, exp and ctr included
+#define SETTINGS_FILE "/settings.txt" // device name, addresses and local key, see _saveSettings()
+#define CONFIG_PREVIOUS_FILE "/settings.prev" // settings before a patch that needs a reboot, kept until MQTT connects
+#define CONFIG_ROLLBACK_TIMEOUT 180000 // miliseconds after boot for MQTT to connect with patched settings
+
+#define REBOOT_FLUSH_DELAY 500 // miliseconds for the answer to a reboot request to be sent
+#define REBOOT_DISCONNECT_TIMEOUT 1000 // miliseconds to wait for a clean MQTT disconnect before rebooting
+
 #define DNS_PORT 53
+#define CAPTIVE_PORTAL_DNS_TTL 60 // seconds, probe bursts are answered from the phone's cache; short enough to expire soon after commissioning
+
+#define LIVE_FEED_CLIENTS 4 // WebSocket clients that can subscribe to the live feed at the same time
+#define LIVE_FEED_VALUES 12 // latest values kept for the live feed, one per key
+#define LIVE_FEED_INTERVAL 500 // miliseconds between live feed messages to a client
+#define LIVE_KEY_MAX_LENGTH 24
+#define LIVE_VALUE_MAX_LENGTH 40 // bytes of JSON, longer action parameters are sent as null
+#define LIVE_DOCUMENT_SIZE 2048 // bytes, live feed message document capacity
+
+#define MQTT_TOPIC_MAX_LENGTH 128 // bytes, device/<serial>/ prefix included
 
 
 namespace XeoSmartHomeInternals {
 	// callbacks
 	typedef std::function<void()> OnButtonPressCallback;
 	typedef std::function<void(JsonArray& parameters)> OnActionCallback;
+	typedef std::function<bool(JsonArray& parameters)> OnActionValidator;
+	typedef std::function<float()> SensorReadCallback;
 	typedef std::function<void(const char * cron, JsonArray& parameters)> OnTimedActionCallback;
 	
+	// suppression rules applied when an action is received, all disabled by default
+	struct ActionPolicy {
+		float rate = 0; // token bucket refill rate, actions per second, 0 disables rate limiting
+		uint8_t burst = 1; // token bucket size, actions that can be executed back to back
+		uint16_t coalesce_window = 0; // miliseconds, only the latest action received in the window is executed
+		uint16_t duplicate_window = 0; // miliseconds, actions with the same parameters as the previous one are dropped
+	};
+
+	struct ActionCounters {
+		uint32_t accepted = 0; // actions queued for execution
+		uint32_t rate_limited = 0; // actions dropped by the token bucket
+		uint32_t duplicates = 0; // actions dropped because their parameters did not change
+		uint32_t coalesced = 0; // actions replaced by a newer one inside the coalesce window
+		uint32_t invalid = 0; // actions dropped because their parameters do not match the handler arguments
+	};
+
 	typedef struct Action {
 		char name[ACTION_NAME_MAX_LENGTH];
 		OnActionCallback callback;
+		OnActionValidator validator; // checks parameters before the action is queued, optional
+		ActionPolicy policy;
+		ActionCounters counters;
+		float tokens; // token bucket level
+		uint32_t last_refill = 0; // millis() of the last token bucket refill
+		uint32_t last_hash = 0; // hash of the last accepted parameters
+		uint32_t last_accepted_at = 0; // millis() of the last accepted action
+	};
+
+	// action received from the network and waiting to be executed from loop()
+	struct QueuedAction {
+		uint16_t action_index; // index of the first matching handler in the actions vector
+		uint32_t enqueued_at; // millis() when the action was received
+		uint16_t parameters_len;
+		uint8_t parameters[ACTION_PARAMETERS_MAX_SIZE]; // MessagePack encoded parameters
+	};
+
+	// action held back until its coalesce window expires, newer actions overwrite it
+	struct CoalescedAction {
+		QueuedAction action;
+		uint32_t deadline; // millis() when the action is executed
+		bool pending = false;
+	};
+
+	struct ActionQueueStats {
+		uint16_t depth = 0; // actions currently waiting
+		uint16_t max_depth = 0; // highest depth seen
+		uint32_t executed = 0; // actions executed
+		uint32_t overflows = 0; // actions dropped because the queue was full
+		uint32_t rejected = 0; // actions dropped because they are unknown or their parameters are too large
+		uint32_t unauthenticated = 0; // signed actions dropped because the signature, expiry or counter was wrong
+		uint32_t last_wait = 0; // miliseconds the last action waited in the queue
+		uint32_t max_wait = 0; // longest wait seen, miliseconds
+	};
+
+	struct Sensor {
+		char name[SENSOR_NAME_MAX_LENGTH];
+		SensorReadCallback read;
+		uint32_t sample_period; // miliseconds between readings
+		uint32_t window_samples; // readings aggregated in a window
+		// running aggregate of the current window, the same RAM whatever the window length
+		float min;
+		float max;
+		double sum;
+		float last;
+		uint32_t count = 0; // readings in the current window
+		Task task; // sampling task
+	};
+
+	// last reported value of a status, the device state shadow
+	struct StatusEntry {
+		char key[STATUS_KEY_MAX_LENGTH];
+		int32_t value;
+		bool dirty; // value changed and was not sent yet
+		time_t updated_at; // epoch of the last update, 0 if restored from the snapshot
+	};
+
+	struct SnapshotStatus {
+		char key[SNAPSHOT_STATUS_KEY_MAX_LENGTH];
+		int32_t value;
+	};
+
+	struct SnapshotSensorValue {
+		char sensor[SNAPSHOT_STATUS_KEY_MAX_LENGTH];
+		float value;
+		uint32_t timestamp; // epoch when the value was read, 0 if time was not set
+	};
+
+	// state kept in RTC user memory to recover quickly after a software or WDT reset
+	struct Snapshot {
+		uint32_t crc;
+		uint16_t version;
+		uint16_t reset_count; // warm resets since last power on
+		uint8_t bssid[6]; // last access point, used for a fast reconnect
+		uint8_t channel;
+		uint8_t wifi_valid;
+		uint8_t status_count;
+		uint8_t pending_count;
+		uint16_t reserved;
+		uint32_t cycle_count; // deep sleep wakes since last power on
+		uint32_t last_awake_time; // miliseconds awake in the last duty cycle
+		uint32_t last_energy; // estimated energy of the last duty cycle, uJ
+		uint32_t action_counter; // ctr claim of the last signed action, older counters are replays
+		SnapshotStatus statuses[SNAPSHOT_STATUS_COUNT]; // last reported statuses
+		SnapshotSensorValue pending[SNAPSHOT_PENDING_COUNT]; // sensor values not sent yet, oldest first
+	};
+	static_assert(sizeof(Snapshot) <= RTC_SNAPSHOT_MAX_SIZE, "snapshot does not fit in RTC user memory");
+
+	enum RebootPhase {
+		REBOOT_NONE,
+		REBOOT_REQUESTED, // waiting for the answer to the request to be sent
+		REBOOT_DISCONNECTING // waiting for a clean MQTT disconnect
+	};
+
+	enum WireFormat {
+		WIRE_FORMAT_JSON, // actions as JSON text, telemetry as one text publish per value
+		WIRE_FORMAT_MSGPACK // actions and batched telemetry as MessagePack
 	};
 
 	typedef struct TimedAction {
@@ -51,39 +235,78 @@ namespace XeoSmartHomeInternals {
 		IPAddress gateway;
 		IPAddress subnet_mask;
 		char device_name[WL_SSID_MAX_LENGTH] = "XeoSmartHome Device";
+		uint8_t local_key[LOCAL_KEY_MAX_LENGTH]; // device key, set by the app during setup; authenticates local control and signed cloud actions
+		uint8_t local_key_len = 0;
+		uint32_t action_counter = 0; // highest ctr claim reserved in ACTION_COUNTER_FILE, see _saveActionCounter()
 	};
 
-	// constants
-	const int WEB_SERVER_PORT = 80;
-	const char * WEBSOCKET_SERVER_URL = "/ws";
-	const byte LED_PIN = D8;
+	enum LiveValueType {
+		LIVE_SENSOR,
+		LIVE_STATUS,
+		LIVE_ACTION // executed action, value is its parameters
+	};
 
-	// NTP
-	const char * ntpServer = "pool.ntp.org";
-	int8_t timeZone = 2;
+	// latest value of a key, newer values of the same key overwrite it
+	struct LiveValue {
+		uint8_t type;
+		char key[LIVE_KEY_MAX_LENGTH];
+		char value[LIVE_VALUE_MAX_LENGTH]; // JSON text
+		uint32_t sequence = 0; // live feed sequence of the last update, 0 if unused
+	};
 
-};
+	struct LiveSubscriber {
+		bool active = false;
+		uint32_t client_id;
+		uint32_t sequence; // last sequence sent to the client
+		uint32_t sent_at; // millis() of the last message
+		uint32_t dropped; // messages skipped because the client queue was full
+	};
 
+	// config portal commissioning counters, reset when config mode starts
+	struct CaptivePortalStats {
+		uint32_t probes = 0; // OS connectivity probes answered from the probe table
+		uint32_t redirects = 0; // other unknown URLs redirected to the portal
+		uint32_t first_probe_after = 0; // miliseconds from config mode start to the first probe, 0 if none yet
+		uint32_t opened_after = 0; // miliseconds from config mode start to the first WebSocket client, 0 if the portal was not opened yet
+	};
 
-namespace XeoSmartHomeColorCodes {
-	const CRGB SETTINGS_COLORS[] = {CRGB::Blue, CRGB::Black};
-	const uint16 SETTINGS_INTERVAL = 500;
+	enum ColorSignal {
+		COLOR_SIGNAL_SETTINGS, // config mode
+		COLOR_SIGNAL_WIFI_NOT_CONNECTED
+	};
 
-	const CRGB WIFI_NOT_CONNECTED[] = {CRGB::Red, CRGB::Black, CRGB::Red, CRGB::Black, CRGB::Red, CRGB::Black, CRGB::Black, CRGB::Black};
-	const uint16 WITI_NOT_CONNECTED_INTERVAL = 250;
+	// constants
+	const int WEB_SERVER_PORT = 80;
+	const byte LED_PIN = D8;
+
+	// strings are kept in flash, copy them with the _P functions or wrap them in FPSTR()
+	extern const char WEBSOCKET_SERVER_URL[] PROGMEM;
+	extern const char CAPTIVE_PORTAL_URL[] PROGMEM; // absolute, clients do not look up the probed host again
+
+	// NTP
+	extern const char ntpServer[] PROGMEM;
+	extern const char timeZone[] PROGMEM; // POSIX TZ, UTC+2 with EU daylight saving rules
 };
 
 
-IPAddress stringToIpAdress(const char *string) {
-	unsigned short a, b, c, d;
-	sscanf(string, "%hu.%hu.%hu.%hu", &a, &b, &c, &d);
-	return IPAddress(a, b, c, d);
-}
+IPAddress stringToIpAdress(const char *string);
+IPAddress stringToIpAdress(String string);
 
+/*
+* @param string: hex digits, two per byte
+* @param bytes: output buffer
+* @param size: output buffer size
+* @return number of bytes decoded, 0 if string is not valid hex or does not fit
+*/
+size_t hexToBytes(const char *string, uint8_t * bytes, size_t size);
 
-IPAddress stringToIpAdress(String string) {
-	return stringToIpAdress(string.c_str());
-}
+/*
+* Format a reading as JSON, %.3f; NaN and infinity have no JSON number and are written as null
+* @param buffer: output buffer
+* @param size: output buffer size
+* @return buffer
+*/
+const char * formatReading(char * buffer, size_t size, float value);
 
 
 class XeoSmartHomeDevice {
@@ -108,6 +331,9 @@ class XeoSmartHomeDevice {
 
 		/*
 		* Enable/disable debug output
+		* Log messages are always kept in RAM and can be fetched with the get_logs action or WebSocket event,
+		* with debug enabled they are also written to Serial from loop()
+		* Messages above XEO_LOG_LEVEL are removed at compile time
 		* @param debug: if true enable debug outpuut, else disable debug output
 		*/
 		void setDebug(bool debug); 
@@ -122,20 +348,53 @@ class XeoSmartHomeDevice {
 		*/
 		void loop();
 
+#if XEO_FEATURE_BUTTON
 		/* 
 		* Set enent handler for button short press
 		* @param callback: function that will be executed when button is pressed
 		*/
 		void setOnButtonPressHandler(XeoSmartHomeInternals::OnButtonPressCallback callback);
+#endif
 
 		/*
 		* Set an action callback for an action name
-		* Actions are functions that will be executed imediately after them are received
+		* Actions are queued when them are received and executed from loop()
 		* @param action_name: action uri that will be received from the cloud
 		* @param callback: callback function that is paired with action_name
+		* @param policy: rate limit, coalescing and duplicate suppression rules for this action
+		*/
+		void addActionHandler(const char * action_name, XeoSmartHomeInternals::OnActionCallback callback, XeoSmartHomeInternals::ActionPolicy policy = XeoSmartHomeInternals::ActionPolicy());
+
+		/*
+		* Set an action callback with typed arguments for an action name
+		* Parameters are checked when the action is received, actions with missing or wrong parameters are dropped
+		* With several handlers for the same action name the action is only queued if the parameters fit all of them
+		* Example: addActionHandler<int, bool>("set_valve", [](int valve, bool open){ ... });
+		* @param Args: callback argument types, arithmetic types or const char *
+		* @param action_name: action uri that will be received from the cloud
+		* @param callback: callback function that is paired with action_name, callable with Args...
+		* @param policy: rate limit, coalescing and duplicate suppression rules for this action
 		*/
-		void addActionHandler(const char * action_name, XeoSmartHomeInternals::OnActionCallback callback);
+		template<typename... Args, typename Callback, typename = typename std::enable_if<(sizeof...(Args) > 0)>::type>
+		void addActionHandler(const char * action_name, Callback callback, XeoSmartHomeInternals::ActionPolicy policy = XeoSmartHomeInternals::ActionPolicy());
 
+		/*
+		* @param action_name: action uri
+		* @return accepted and suppressed action counters, nullptr if there is no handler for action_name
+		*/
+		const XeoSmartHomeInternals::ActionCounters * getActionCounters(const char * action_name);
+
+		/*
+		* Forward an action to a co-processor over a UART bridge, the bridge is polled from loop()
+		* Parameters are sent MessagePack encoded as the command data, up to BRIDGE_COMMAND_MAX_DATA bytes
+		* @param action_name: action uri that will be received from the cloud
+		* @param bridge: bridge to the co-processor, must outlive the device
+		* @param command: command code sent to the co-processor
+		* @param policy: rate limit, coalescing and duplicate suppression rules for this action
+		*/
+		void addBridgeActionHandler(const char * action_name, UartBridge & bridge, uint8_t command, XeoSmartHomeInternals::ActionPolicy policy = XeoSmartHomeInternals::ActionPolicy());
+
+#if XEO_FEATURE_CRON
 		/*
 		* Set a timed action callback
 		* Timed actions are function that will be executed the time specified in their cron
@@ -143,44 +402,228 @@ class XeoSmartHomeDevice {
 		* @param callback: callback function that is paired with action_name
 		*/
 		void addTimedActionHamdler(const char * action_name, XeoSmartHomeInternals::OnActionCallback callback);
+#endif
 
 		/*
 		* Send sensor value to cloud
+		* Without a connection the value is kept in the snapshot and sent with its timestamp after the next connect
 		* @param sensor: sensor uri
 		* @param value: sensor value
+		* @return true if the value was sent or batched
 		*/
 		bool sendSensorData(const char * sensor, float value);
 
 		/* 
 		* Send status update to server
+		* The value is kept in the device state shadow and only sent if it changed, all statuses are sent
+		* as a single retained message on device/<serial>/state when MQTT connects
 		* @param status: status uri
-		* @param 
+		* @param value: status value
+		* @return true if MQTT is connected, the value is sent later otherwise
 		*/
 		bool sendStatusUpdate(const char * status, int value);
 
+		/*
+		* Handle messages sent to a device topic, must be called before init()
+		* The device subscribes to device/<serial>/<topic> for every handler and routes topics with a trie, built-in
+		* topics (action, action/msgpack, schedule_update, get_state, config, ota, ota/chunk) can not be replaced.
+		* Patterns should not match topics the device publishes to, their messages would come back to it
+		* Example: addTopicHandler("relay/+/set", [](char * payload, size_t len, size_t index, size_t total){ ... });
+		* @param topic: topic after device/<serial>/, may use the MQTT wildcards '+' and '#'
+		* @param callback: called from the network context with each part of the message
+		* @return false if the topic already has a handler
+		*/
+		bool addTopicHandler(const char * topic, XeoSmartHomeInternals::OnTopicCallback callback);
+
+		/*
+		* Register a sensor that is sampled by the device
+		* Readings are aggregated in windows and only min, max, mean and last of each window are sent
+		* on device/<serial>/sensor/<sensor>/window, sensors are sampled at staggered phases
+		* Must be called before init()
+		* @param sensor: sensor uri
+		* @param read: callback that returns a sensor reading
+		* @param sample_period: miliseconds between readings
+		* @param window: aggregation window in miliseconds, at least one reading
+		*/
+		void addSensor(const char * sensor, XeoSmartHomeInternals::SensorReadCallback read, uint32_t sample_period, uint32_t window);
+
+		/*
+		* Set time zone and daylight saving rules, must be called before init()
+		* @param time_zone: POSIX TZ string, e.g. "EET-2EEST,M3.5.0/3,M10.5.0/4"
+		*/
+		void setTimeZone(const char * time_zone);
+
+		/*
+		* Set NTP server, must be called before init()
+		* @param ntp_server: NTP server host name
+		*/
+		void setNtpServer(const char * ntp_server);
+
+		/*
+		* Cached UTC time, cheap enough to be called from hot paths
+		* Time is restored after a warm reboot and corrected when NTP answers
+		* @return seconds since epoch
+		*/
+		time_t now();
+
+		/*
+		* @return TIME_NOT_SET, TIME_RESTORED or TIME_SYNCED
+		*/
+		XeoSmartHomeInternals::TimeSyncState getTimeSyncState();
+
+		/*
+		* Enable duty-cycle mode for battery powered devices, must be called before init()
+		* Every wake the device restores its snapshot, connects, sends queued and fresh sensor readings,
+		* executes actions queued by the broker and goes to deep sleep again
+		* Sensors are read once per wake instead of being sampled periodically
+		* Deep sleep needs GPIO16 (D0) connected to RST, keep the button pressed to stay awake in config mode
+		* @param sleep_seconds: deep sleep time, limited to ESP.deepSleepMax()
+		* @param awake_budget: max miliseconds awake per cycle
+		*/
+		void setDutyCycle(uint32_t sleep_seconds, uint32_t awake_budget = DUTY_CYCLE_AWAKE_BUDGET);
+
+		/*
+		* @return number of warm resets (software, exception, WDT) since last power on
+		*/
+		uint16_t getResetCount();
+
+		/*
+		* Enable/disable the periodic health report (uptime, free heap, RSSI)
+		* Presence is handled by MQTT keepalive and last will, the health report is optional
+		* @param seconds: report interval in seconds, 0 disables the report
+		*/
+		void setHealthReportInterval(uint32_t seconds);
+
+		/*
+		* Set telemetry wire format
+		* JSON sends one text message per value on device/<serial>/sensor/<sensor>
+		* MessagePack batches values and sends them on device/<serial>/sensors/msgpack: {sensor: [values...]} and
+		* {"<sensor>/window": [{min, max, mean, last, n}...]}, oldest first
+		* Actions are accepted in both formats, MessagePack actions are received on device/<serial>/action/msgpack
+		* @param format: WIRE_FORMAT_JSON or WIRE_FORMAT_MSGPACK
+		*/
+		void setWireFormat(XeoSmartHomeInternals::WireFormat format);
+
+		/*
+		* @return action queue depth, wait time and overflow counters
+		*/
+		const XeoSmartHomeInternals::ActionQueueStats & getActionQueueStats();
+
+		/*
+		* @return local UDP control counters: accepted, rejected, replayed and forged packets
+		*/
+		const XeoSmartHomeInternals::LocalControlStats & getLocalControlStats();
+
+#if XEO_FEATURE_CONFIG_PORTAL
+		/*
+		* @return connectivity probes, redirects and time until the portal was opened in the current or last config mode
+		*/
+		const XeoSmartHomeInternals::CaptivePortalStats & getCaptivePortalStats();
+#endif
+
+		/*
+		* Reboot from loop() once the answer to the request is sent, MQTT is disconnected and SPIFFS is unmounted
+		* Safe to call from network callbacks and action handlers, where ESP.restart() can end in a WDT reset
+		* @param reason: logged before the reboot, must outlive the request
+		*/
+		void requestReboot(const char * reason);
+
+		/*
+		* @return number of device activities (actions, sensors, tasks) or sketch loops that ran longer than WATCHDOG_STALL_THRESHOLD
+		*/
+		uint32_t getStallCount();
+
 	private:
 		char _name[WL_SSID_MAX_LENGTH];  // device name
 		char _serial[64]; // device serial code
-		bool _debug = false; // debug output enabled
 
 		std::vector<XeoSmartHomeInternals::Action> _ActionsVector; // list of device action callbacks
+#if XEO_FEATURE_CRON
 		std::vector<XeoSmartHomeInternals::Action> _TimedActionsVector; // list of device timed action callback
+#endif
 
 		/*
 		* Called when device receive an action request from cloud
-		* @param messge: message from server, json
+		* @param messge: message from server
+		* @param len: message length
+		* @param format: message encoding, json or MessagePack
+		* @param signed_message: message was verified by the authenticator, its exp and ctr claims are checked
+		* @return true if the action was queued or handled
+		*/
+		bool _onAction(const char * message, size_t len, XeoSmartHomeInternals::WireFormat format, bool signed_message = false);
+
+		// ACTION-AUTH
+		// actions from the cloud must be signed with the device key once it is set
+		XeoSmartHomeInternals::ActionAuthenticator _actionAuthenticator;
+
+		/*
+		* Verify a signed action from MQTT and pass it to _onAction
+		* @param message: JWT HS256 token or MessagePack with MAC, decoded in place
+		* @param len: message length
+		* @param format: WIRE_FORMAT_JSON for JWT, WIRE_FORMAT_MSGPACK for MessagePack with MAC
+		*/
+		void _onSignedAction(char * message, size_t len, XeoSmartHomeInternals::WireFormat format);
+
+		/*
+		* Check the exp and ctr claims of a verified message and remember its counter; the counter is persisted by
+		* _saveActionCounter() before the message is acted on
+		* @param doc: decoded message
+		* @return false if the message expired or was replayed
+		*/
+		bool _checkSignedClaims(JsonDocument & doc);
+
+		// ACTION-QUEUE
+		// written by the network callbacks, read by loop()
+		RingBuffer<XeoSmartHomeInternals::QueuedAction, ACTION_QUEUE_SIZE> _actionQueue;
+		XeoSmartHomeInternals::ActionQueueStats _actionQueueStats;
+		XeoSmartHomeInternals::CoalescedAction _coalescedActions[ACTION_COALESCE_SLOTS];
+
+		/*
+		* Queue an action for execution from loop()
+		* @param action_name: action uri
+		* @param parameters: action parameters
+		* @return true if the action was queued
+		*/
+		bool _enqueueAction(const char * action_name, JsonArray parameters);
+
+		/*
+		* Apply the action policy to an encoded action
+		* @param action_index: index of the action in the actions vector
+		* @param parameters: MessagePack encoded parameters
+		* @param parameters_len: encoded parameters length
+		* @param queue_full: no free slot in the action queue, an action that is not coalesced is dropped
+		* @return true if the action must be queued, false if it was dropped or merged into a coalesced action
 		*/
-		void _onAction(const char * message, size_t len);
+		bool _applyActionPolicy(size_t action_index, const uint8_t * parameters, size_t parameters_len, bool queue_full);
 
+		/*
+		* Execute all queued actions, called from loop()
+		*/
+		void _executeQueuedActions();
+
+		/*
+		* Execute coalesced actions whose window expired, called from loop()
+		*/
+		void _executeCoalescedActions();
+
+		/*
+		* Decode parameters and call all handlers of a queued action
+		*/
+		void _executeAction(XeoSmartHomeInternals::QueuedAction & queued_action);
+
+#if XEO_FEATURE_CRON
 		/*
 		* Called when device receive a schedule update request from server
 		* @param messge: message from server, json
+		* @param len: message length
 		*/
-		void _onSceduleUpdate(const char * message);
+		void _onSceduleUpdate(const char * message, size_t len);
+#endif
 
 		// TASK SCHEDULER
 		Scheduler _taskScheduler;
 
+#if XEO_FEATURE_LED
 		// LED
 		CRGB _leds[1];
 		Task _ledTask;
@@ -199,9 +642,16 @@ class XeoSmartHomeDevice {
 		// COLOR CODES
 		uint8 _colors_vector_index = 0;
 		uint8 _colors_vector_len;
-		CRGB _colors_vector[20];
-		void _setColorSignal(const CRGB * color_vector, uint16 size, uint16 miliseconds);
+		CRGB _colors_vector[LED_SIGNAL_MAX_COLORS]; // colors of the current signal, copied from the flash tables
+
+		/*
+		* Blink a color signal until the LED task is disabled
+		* @param signal: color table to show
+		*/
+		void _setColorSignal(XeoSmartHomeInternals::ColorSignal signal);
+#endif
 
+#if XEO_FEATURE_BUTTON
 		// BUTTON
 		std::function<void()> _onButtonPress;
 		unsigned int _button_pin = D4;
@@ -228,6 +678,7 @@ class XeoSmartHomeDevice {
 		* Called when button long pressed is detected
 		*/
 		void _onButtonLongPress();
+#endif
 
 		// SETTINGS
 		XeoSmartHomeInternals :: Settings _settings;
@@ -238,9 +689,26 @@ class XeoSmartHomeDevice {
 		void _loadSettings();
 
 		/*
-		* Save device settings in configuration file
+		* Read the configuration file
+		* @param settings: settings read, action_counter is not in the file
+		* @param name: device name, null terminated
+		* @param name_size: size of name
+		* @return false if the file can not be opened
+		*/
+		bool _readSettings(XeoSmartHomeInternals :: Settings & settings, char * name, size_t name_size);
+
+		/*
+		* Save device settings in configuration file and read it back
+		* @return false if the local key read back is not the one saved
+		*/
+		bool _saveSettings();
+
+		/*
+		* Reserve the next ACTION_COUNTER_RESERVE counters in ACTION_COUNTER_FILE once the last accepted one passes the
+		* reserved block: the file is written once per block instead of once per signed message, and counters up to
+		* the block end are rejected after a power on, accepted or not
 		*/
-		void _saveSettings();
+		void _saveActionCounter();
 
 		// WIFI
 		WiFiEventHandler _WiFiEventStationModeGotIP;
@@ -266,12 +734,61 @@ class XeoSmartHomeDevice {
 
 		// MQTT
 		AsyncMqttClient * _mqttClient; // pointer to MQTT client
-		Task _mqttPingTimer; // MQTT ping timer
+		char _mqttPresenceTopic[MQTT_TOPIC_MAX_LENGTH]; // last will topic, must outlive the MQTT client
+		uint32_t _healthReportInterval = 0; // health report interval in seconds, 0 if disabled
+		Task _mqttHealthTimer; // MQTT health report timer
+		uint16_t _mqttUnacked = 0; // QoS 1 and 2 publishes of this connection not acknowledged yet
+
+		// TELEMETRY
+		XeoSmartHomeInternals::WireFormat _wireFormat = XeoSmartHomeInternals::WIRE_FORMAT_JSON;
+		StaticJsonDocument<TELEMETRY_BATCH_SIZE> _telemetryBatch; // sensor values waiting to be sent as MessagePack
+		Task _telemetryTimer; // MessagePack telemetry batch timer
+
+		void _initTelemetry();
+
+		// SENSORS
+		std::vector<XeoSmartHomeInternals::Sensor *> _sensors; // registered sensors, allocated once, tasks keep their address
+
+		// CO-PROCESSOR
+		std::vector<UartBridge *> _bridges; // bridges polled from loop(), owned by the sketch
+
+		/*
+		* Add sensor tasks to the scheduler with staggered start delays
+		*/
+		void _initSensors();
+
+		/*
+		* Take one reading and send the window aggregate when the window is full
+		*/
+		void _sampleSensor(XeoSmartHomeInternals::Sensor & sensor);
+
+		/*
+		* Send min, max, mean and last of the readings in the sensor window
+		*/
+		void _sendSensorWindow(XeoSmartHomeInternals::Sensor & sensor);
+
+		/*
+		* Send batched sensor values as a single MessagePack message, the batch is kept until it is sent
+		* @return true if the batch is empty
+		*/
+		bool _flushTelemetry();
 
 		void _initMqttClient();
 		void _startMqttClient();
 		void _stopMqttClient();
 
+		/*
+		* Publish and count QoS 1 and 2 messages until the broker acknowledges them
+		* @param len: payload length, 0 for a null terminated payload
+		* @return packet id, 0 if the message was not queued
+		*/
+		uint16_t _publish(const char * topic, uint8_t qos, bool retain, const char * payload, size_t len = 0);
+
+		/*
+		* Publish uptime, free heap and RSSI on device/<serial>/health
+		*/
+		void _sendHealthReport();
+
 		/*
 		* MQTT connected callback
 		* @param sessionPresent
@@ -289,9 +806,29 @@ class XeoSmartHomeDevice {
 		*/
 		void _onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total);
 
+		/*
+		* Build a device topic without heap allocations: device/<serial>/<suffix>[<name><name_suffix>]
+		* @param buffer: topic buffer, MQTT_TOPIC_MAX_LENGTH bytes
+		* @param suffix: topic after the device prefix, PROGMEM
+		* @param name: sensor or status name appended after suffix, RAM, optional
+		* @param name_suffix: topic after name, PROGMEM, optional
+		* @return buffer
+		*/
+		const char * _topic(char * buffer, PGM_P suffix, const char * name = nullptr, PGM_P name_suffix = nullptr);
+
+		// TOPIC-ROUTER
+		XeoSmartHomeInternals::TopicRouter _topicRouter;
+		char _mqttTopicPrefix[80]; // device/<serial>/, stripped before routing
+
+		/*
+		* Register the built-in device topics
+		*/
+		void _initTopicRouter();
+
 		// CONFIG-MODE
 		bool _config_mode = false; // true if config mode in enabled, false if config mode in disabled
 
+#if XEO_FEATURE_CONFIG_PORTAL
 		/*
 		* Called when config mode is enabled
 		*/
@@ -311,7 +848,20 @@ class XeoSmartHomeDevice {
 
 		// WEB-SERVER
 		AsyncWebServer * _webServer;
+		XeoSmartHomeInternals::CaptivePortalStats _captivePortalStats;
+		uint32_t _configModeStartedAt = 0; // millis()
 		void _initWebServer();
+
+		/*
+		* Answer OS connectivity probes (generate_204, hotspot-detect.html, connecttest.txt, ...) with canned responses
+		* that open the captive portal sheet, without a redirect chain or a SPIFFS read
+		*/
+		void _initCaptiveProbes();
+
+		/*
+		* Redirect to the portal
+		*/
+		void _redirectToPortal(AsyncWebServerRequest * request);
 		void _startWebServer();
 		void _stopWebServer();
 
@@ -342,647 +892,229 @@ class XeoSmartHomeDevice {
 		*/
 		void _asyncWifiScan();
 
-		// NTP-CLIENT
-		void _initNtpClient();
-};
-
-
-// PUBLIC:
-
-XeoSmartHomeDevice :: XeoSmartHomeDevice() {
-	this->_mqttClient = new AsyncMqttClient();
-	this->_dnsServer = new AsyncDNSServer();
-	this->_webServer = new AsyncWebServer(XeoSmartHomeInternals::WEB_SERVER_PORT);
-	this->_webSocketServer = new AsyncWebSocket(XeoSmartHomeInternals::WEBSOCKET_SERVER_URL);
-}
-
-
-XeoSmartHomeDevice :: ~XeoSmartHomeDevice() {
-	delete(this->_mqttClient);
-	delete(this->_dnsServer);
-	delete(this->_webServer);
-	delete(this->_webSocketServer);
-
-}
-
-
-void XeoSmartHomeDevice :: setName(const char * name) {
-	strncpy(this->_name, name, sizeof(this->_name));
-}
-
-
-void XeoSmartHomeDevice :: setSerial(const char * serial) {
-	strncpy(this->_serial, serial, sizeof(this->_serial));
-}
-
-
-void XeoSmartHomeDevice :: setDebug(bool debug){
-	this->_debug = debug;
-}
-
-
-void XeoSmartHomeDevice :: init() {
-	this->_initButton();
-	this->_initLed();
-	SPIFFS.begin();
-	delay(500); // wait for file system to initialize
-	this->_loadSettings();
-	this->_initWiFi();
-	this->_initMqttClient();
-	this->_initDnsServer();
-	this->_initWebServer();
-	this->_initWebSocketServer();
-	this->_initNtpClient();
-}
-
-
-void XeoSmartHomeDevice :: loop() {
-	this->_checkForButtonStateChanges();
-	this->_taskScheduler.execute();
-	//this->_ntpClient->update();
-	Cron.delay();
-}
-
-
-void XeoSmartHomeDevice :: setOnButtonPressHandler(XeoSmartHomeInternals::OnButtonPressCallback callback) {
-	this->_onButtonPress = callback;
-}
-
-
-void XeoSmartHomeDevice :: addActionHandler(const char * action_name, XeoSmartHomeInternals::OnActionCallback callback) {
-	XeoSmartHomeInternals::Action action;
-	strncpy(action.name, action_name, ACTION_NAME_MAX_LENGTH);
-	action.callback = callback;
-	this->_ActionsVector.push_back(action);
-}
-
-void XeoSmartHomeDevice :: addTimedActionHamdler(const char * action_name, XeoSmartHomeInternals::OnActionCallback callback) {
-	XeoSmartHomeInternals::Action timed_action;
-	strncpy(timed_action.name, action_name, ACTION_NAME_MAX_LENGTH);
-	timed_action.callback = callback;
-	this->_TimedActionsVector.push_back(timed_action);
-}
-
-
-bool XeoSmartHomeDevice :: sendSensorData(const char * sensor, float value){
-	if(not this->_mqttClient->connected())
-		return false;
-	
-	String topic = "device/" + String(this->_serial) + "/sensor/" + String(sensor);
-
-	this->_mqttClient->publish(topic.c_str(), 2, false, String(value).c_str());
-
-	return true;
-}
-
-
-bool XeoSmartHomeDevice :: sendStatusUpdate(const char * status, int value){
-	if(not this->_mqttClient->connected())
-		return false;
-	
-	String topic = "device/" + String(this->_serial) + "/status/" + String(status);
-
-	this->_mqttClient->publish(topic.c_str(), 2, false, String(value).c_str());
-
-	return true;
-}
-// PRIVATE:
-
-void _decodeJwtMessage(){
-	// TODO: implement JWT decode
-}
-
-
-void XeoSmartHomeDevice :: _onAction(const char * message, size_t len){
-	if(this->_debug)
-		Serial.println("OnAction()");
-
-	DynamicJsonDocument doc(4096);
-	deserializeJson(doc, message, len);
-
-	const char * action_name = doc["name"];
-	JsonArray action_parameters = doc["parameters"];
-
-	for (XeoSmartHomeInternals::Action action : this->_ActionsVector){
-		if(strcmp(action.name, action_name) == 0){
-			action.callback(action_parameters);
-		}
-	}
-}
-
-
-void XeoSmartHomeDevice :: _onSceduleUpdate(const char * message){
-	if(this->_debug)
-		Serial.println("OnScheduleUpdate()");
-
-	DynamicJsonDocument doc(4096);
-	deserializeJson(doc, message);
-
-	const char * action_name = doc["name"];
-	JsonArray action_parameters = doc["parameters"];
-
-	for(XeoSmartHomeInternals::Action timed_action : this->_TimedActionsVector){
-		if(strcmp(timed_action.name, action_name) == 0){
-			Serial.print(action_name);
-			Serial.println(" - timed action");
-			//timed_action.callback(action_parameters);
-		}
-	}
-}
-
-//<BUTTON>
-
-void XeoSmartHomeDevice :: _initButton(){
-	pinMode(this->_button_pin, INPUT_PULLUP);
-}
-
-
-bool XeoSmartHomeDevice :: _buttonIsPressed() {
-	return not digitalRead(this->_button_pin);
-}
-
-
-void XeoSmartHomeDevice :: _checkForButtonStateChanges(){
-	bool current_state = this->_buttonIsPressed();
-	if(current_state){ // Button is pressed
-		if(this->_button_last_state){
-			if(millis() - this->_button_press_time > BUTTON_LONG_PRESS and not this->_long_detected){
-				this->_long_detected = true;
-				this->_onButtonLongPress();
-			}
-		} else {
-			this->_button_press_time = millis();
-		}
-	} else
-	if(this->_button_last_state){ // Button is not pressed
-		this->_long_detected = false;
-		unsigned long pressed_time = millis() - this->_button_press_time;
-		if(BUTTON_SHORT_PRESS_MIN < pressed_time and pressed_time < BUTTON_SHORT_PRESS_MAX){
-			if(not this->_config_mode)
-				this->_onButtonPress();
-		}
-	}
-	_button_last_state = current_state;
-}
-
-
-void XeoSmartHomeDevice :: _onButtonLongPress(){
-	if(this->_debug)
-		Serial.println("Long button pressed detected");
-
-	this->_config_mode = not this->_config_mode;
-
-	if(this->_config_mode){
-		this->_startConfigMode();
-	} else {
-		this->_stopConfigMode();
-	}
-	
-}
-
-//</BUTTON>
-//<LED>
-
-void XeoSmartHomeDevice :: _initLed(){
-	FastLED.addLeds<NEOPIXEL, D8>(this->_leds, 1);
-	
-	this->_taskScheduler.addTask(_ledTask);
-	this->_ledTask.setOnDisable([this](){
-		this->_setLedColor(CRGB::Black);
-	});
-}
-
-
-void XeoSmartHomeDevice :: _setLedColor(CRGB color){
-	this->_leds[0] = color;
-	FastLED.show();
-}
-
-
-void XeoSmartHomeDevice :: _setColorSignal(const CRGB * color_vector, uint16 size, uint16 miliseconds){
-	this->_colors_vector_index = 0;
-	this->_colors_vector_len = size / sizeof(CRGB);
-	this->_ledTask.setInterval(miliseconds);
-	this->_ledTask.setIterations(TASK_FOREVER);
-	
-	for(uint8 i = 0; i < this->_colors_vector_len; i++){
-		this->_colors_vector[i] = color_vector[i];
-	}
-	
-	this->_ledTask.setCallback([this](){
-		this->_setLedColor(this->_colors_vector[this->_colors_vector_index++]);
-		this->_colors_vector_index = this->_colors_vector_index % this->_colors_vector_len;
-	});
-
-	this->_ledTask.enable();
-}
-
-//</LED>
-//<SETTINGS>
-
-void XeoSmartHomeDevice :: _loadSettings() {
-	if ( ! SPIFFS.exists("settings.txt")) {
-		this->_saveSettings();
-	} 
-
-	File settings_file = SPIFFS.open("/settings.txt", "r");
-	settings_file.readBytesUntil('\n', this->_name, sizeof(this->_name));
-
-	this->_settings.dhcp = settings_file.readStringUntil('\n').toInt();
-	this->_settings.local_ip = stringToIpAdress(settings_file.readStringUntil('\n'));
-	this->_settings.gateway = stringToIpAdress(settings_file.readStringUntil('\n'));
-	this->_settings.subnet_mask = stringToIpAdress(settings_file.readStringUntil('\n'));
-}
-
-
-void XeoSmartHomeDevice :: _saveSettings() {
-	File settings_file = SPIFFS.open("/settings.txt", "w");
-	settings_file.println(this->_name);
-	settings_file.println(this->_settings.dhcp ? "1" : "0");
-	settings_file.println(this->_settings.local_ip);
-	settings_file.println(this->_settings.gateway);
-	settings_file.println(this->_settings.subnet_mask);
-	settings_file.close();
-}
+		// LIVE-FEED
+		// sensor values, statuses and executed actions mirrored to the WebSocket clients that asked for them
+		XeoSmartHomeInternals::LiveValue _liveValues[LIVE_FEED_VALUES];
+		XeoSmartHomeInternals::LiveSubscriber _liveSubscribers[LIVE_FEED_CLIENTS];
+		uint8_t _liveSubscriberCount = 0;
+		uint32_t _liveSequence = 0;
 
-//</SETTINGS>
-// <WIFI>
-
-void XeoSmartHomeDevice :: _initWiFi() {
-	//WiFi.mode(WIFI_STA);
-	WiFi.hostname(this->_name);
-	WiFi.softAP(this->_name);
-	WiFi.softAPConfig(IPAddress(8,8,8,8), IPAddress(8,8,8,8), IPAddress(255, 255, 255, 0));
-	delay(500);
-	//WiFi.softAPConfig(accesPointIp, accesPointIp, NET_MASK);
-
-	WiFi.mode(WIFI_STA);
-
-	// TODO: enable static ip configuration
-	/*if (!_settings.dhcp) {
-		WiFi.config(_settings.local_ip, _settings.gateway, _settings.subnet_mask, _settings.gateway);
-	}*/
-
-	this->_taskScheduler.addTask(this->_wifiTimer);
-
-	this->_WiFiEventStationModeGotIP = WiFi.onStationModeGotIP([this](const WiFiEventStationModeGotIP& event){
-		this->_onWifiConnected(event);
-	});
-
-	this->_WiFiEventStationModeDisconnected = WiFi.onStationModeDisconnected([this](const WiFiEventStationModeDisconnected& event){
-		this->_onWifiDisconnected(event);
-	});
-
-	WiFi.begin();
-}
-
-
-void XeoSmartHomeDevice :: _onWifiConnected(const WiFiEventStationModeGotIP& event) {
-	if(this->_debug){
-		Serial.println("WiFi connected");
-		Serial.print("IP: ");
-		Serial.println(event.ip);
-	}
-	this->_startMqttClient();
-	this->_wifiTimer.disable();
-	if(not this->_config_mode){
-		this->_ledTask.disable();
-	}
-}
-
-
-void XeoSmartHomeDevice ::_onWifiDisconnected(const WiFiEventStationModeDisconnected& event){
-	if(this->_debug){
-		Serial.println("WiFi disconnected");
-		Serial.println("Reason: ");
-		Serial.println(event.reason);
-	}
-
-	this->_stopMqttClient();
-
-	this->_wifiTimer.setInterval(20 * 1000);
-	this->_wifiTimer.setIterations(TASK_FOREVER);
-	this->_wifiTimer.setCallback([this](){
-		if(not WiFi.isConnected() and not this->_config_mode)
-			this->_setColorSignal(XeoSmartHomeColorCodes::WIFI_NOT_CONNECTED, sizeof(XeoSmartHomeColorCodes::WIFI_NOT_CONNECTED), XeoSmartHomeColorCodes::WITI_NOT_CONNECTED_INTERVAL);
-	});
-	this->_wifiTimer.enable();
-}
-
-// </WIFI>
-// <MQTT>
-
-void XeoSmartHomeDevice :: _initMqttClient() {
-	this->_mqttClient->setServer(XEOSMARTHOME_SERVER, 1883);
-	this->_mqttClient->setClientId(this->_serial);
-	this->_mqttClient->onMessage([this](char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
-		this->_onMqttMessage(topic, payload, properties, len, index, total);
-	});
-	this->_mqttClient->onConnect([this](bool sessionPresent){
-		this->_onMqttConnected(sessionPresent);
-	});
-
-	this->_taskScheduler.addTask(this->_mqttPingTimer);
-	this->_mqttPingTimer.setInterval(30 * 1000);
-	this->_mqttPingTimer.setIterations(TASK_FOREVER);
-	this->_mqttPingTimer.setCallback([this](){
-		if(this->_debug)
-			Serial.println("MQTT sending ping");
-		String topic = "device/" + String(this->_serial) + "/ping";
-		this->_mqttClient->publish(topic.c_str(), 2, false, "ping");
-		time_t now = time(nullptr);
-		Serial.print(ctime(&now));
-	});
-	this->_mqttPingTimer.enable();
-}
+		/*
+		* Keep the latest value of a key for the live feed, nothing is kept without subscribers
+		* @param type: sensor, status or action
+		* @param key: sensor, status or action name
+		* @param value: JSON text
+		*/
+		void _liveFeedUpdate(XeoSmartHomeInternals::LiveValueType type, const char * key, const char * value);
 
+		/*
+		* Send the values changed since the last message to each subscriber, at most every LIVE_FEED_INTERVAL, called from loop()
+		* Clients with a full send queue are skipped, they get the latest values once they catch up
+		*/
+		void _runLiveFeed();
 
-void XeoSmartHomeDevice :: _startMqttClient(){
-	this->_mqttClient->connect();
-}
+		/*
+		* @return false if LIVE_FEED_CLIENTS clients are already subscribed
+		*/
+		bool _liveFeedSubscribe(uint32_t client_id);
 
+		void _liveFeedUnsubscribe(uint32_t client_id);
+#endif
 
-void XeoSmartHomeDevice :: _stopMqttClient(){
-	this->_mqttClient->disconnect();
-}
+		// STATE-SHADOW
+		XeoSmartHomeInternals::StatusEntry _statusTable[STATUS_TABLE_SIZE];
+		uint8_t _statusCount = 0;
+		volatile bool _stateRequested = false; // MQTT connected or get_state action received, state is sent from loop()
+		volatile bool _logsRequested = false; // get_logs action received, logs are sent from loop()
 
+		/*
+		* Send the log ring buffer on device/<serial>/logs
+		*/
+		void _sendLogs();
 
-void XeoSmartHomeDevice :: _onMqttConnected(bool sessionPresent){
-	if(this->_debug)
-		Serial.println("MQTT connected");
+		/*
+		* @return status table entry for status, a new entry if status is not in the table, nullptr if table is full
+		*/
+		XeoSmartHomeInternals::StatusEntry * _getStatusEntry(const char * status);
 
-	this->_mqttClient->subscribe(("device/" + String(this->_serial) + "/action").c_str(), 2);
-	this->_mqttClient->subscribe(("device/" + String(this->_serial) + "/schedule_update").c_str(), 2);
-}
+		/*
+		* Send all statuses as a single retained message and clear the dirty flags
+		* Called from loop() through _stateRequested, the document and the payload are too large for the network stack
+		*/
+		void _sendState();
 
+		// SNAPSHOT
+		XeoSmartHomeInternals::Snapshot _snapshot;
+		bool _snapshotDirty = false; // snapshot changed and must be written to RTC memory
+		bool _wifiFastConnect = false; // WiFi was started with the BSSID and channel from the snapshot
 
-void XeoSmartHomeDevice :: _onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+		/*
+		* Restore snapshot from RTC memory, must be called before any network work
+		*/
+		void _restoreSnapshot();
 
-	if(this->_debug){
-		Serial.println("MQTT message received");
-		Serial.print("topic: ");
-		Serial.println(topic);
-		Serial.print("payload: ");
-		Serial.write(payload, len);
-		Serial.println();
-	}
+		/*
+		* Write snapshot to RTC memory if it changed
+		*/
+		void _saveSnapshot();
 
-	String _topic = String(topic);
+		/*
+		* Remember the last value reported for a status
+		*/
+		void _snapshotStatus(const char * status, int value);
 
-	if(_topic.endsWith("action")){		
-		this->_onAction(payload, len);
-	} else 
-	if (_topic.endsWith("schedule")){
-		//this->_onSceduleUpdate(payload);
-	}
+		/*
+		* Keep a sensor value that could not be sent until MQTT is connected, the oldest value is dropped if full
+		*/
+		void _snapshotPendingSensorValue(const char * sensor, float value);
 
-}
+		/*
+		* Send sensor values kept while MQTT was disconnected on device/<serial>/sensor/<sensor>/pending with the time
+		* they were read, values read before the clock was set are dropped
+		*/
+		void _sendPendingSensorValues();
 
-// </MQTT>
-// <CONFIG-MODE>
+		// DUTY-CYCLE
+		XeoSmartHomeInternals::DutyCycle _dutyCycle;
 
-void XeoSmartHomeDevice :: _startConfigMode() {
-	if(this->_debug)
-		Serial.println("Config mode started");
+		/*
+		* Advance the duty cycle, called from loop()
+		*/
+		void _runDutyCycle();
 
-	this->_setColorSignal(XeoSmartHomeColorCodes::SETTINGS_COLORS, sizeof(XeoSmartHomeColorCodes::SETTINGS_COLORS), XeoSmartHomeColorCodes::SETTINGS_INTERVAL);
+		/*
+		* Send last cycle report and read all sensors once
+		*/
+		void _sendDutyCycleReadings();
 
-	WiFi.mode(WIFI_AP_STA);
-	this->_startDnsServer();
-	this->_startWebServer();
-}
+		/*
+		* Save state and go to deep sleep, does not return
+		*/
+		void _sleep();
 
+		// NTP-CLIENT
+		XeoSmartHomeInternals::TimeService _timeService;
+		const char * _timeZone = XeoSmartHomeInternals::timeZone;
+		const char * _ntpServer = XeoSmartHomeInternals::ntpServer;
 
-void XeoSmartHomeDevice :: _stopConfigMode() {
-	if(this->_debug)
-		Serial.println("Config mode stopped");
+		void _initNtpClient();
 
-	WiFi.mode(WIFI_STA);
-	this->_stopDnsServer();
-	this->_stopWebServer();
+		// LOCAL-CONTROL
+		// actions from the app on the same network, authenticated with the key from settings
+		XeoSmartHomeInternals::LocalControl _localControl;
 
-	this->_ledTask.disable();
-	this->_setLedColor(CRGB::Black);
-}
+		void _initLocalControl();
 
-// </CONFIG-MODE>
-// <DNS-SERVER>
+		// OTA
+		// manifest on device/<serial>/ota, chunks on device/<serial>/ota/chunk, status on device/<serial>/ota/status
+		XeoSmartHomeInternals::OtaUpdater _otaUpdater;
+		XeoSmartHomeInternals::OtaState _otaReportedState = XeoSmartHomeInternals::OTA_IDLE;
+		uint32_t _otaReportedAt = 0; // millis() of the last status
+		uint32_t _otaChunkOffset = 0; // image offset of the MQTT chunk being received
 
-void XeoSmartHomeDevice :: _initDnsServer() {
-	this->_dnsServer->setErrorReplyCode(AsyncDNSReplyCode::NoError);
-	this->_dnsServer->setTTL(0);
-}
+		/*
+		* Verify images with the device key and resume an update interrupted by a reset
+		*/
+		void _initOta();
 
+		/*
+		* Start an update from a manifest: {"version", "size", "sha256", "sig", "url", "not_before", "not_after"}
+		* The manifest is a JWT HS256 token with exp and ctr claims, like signed actions; sig is the hex HMAC-SHA256
+		* of the image description, see OtaManifest, checked before the image is made bootable. Manifests are
+		* refused until the device key is set.
+		* @param message: manifest, decoded in place
+		* @param len: message length
+		*/
+		void _onOtaManifest(char * message, size_t len);
 
-void XeoSmartHomeDevice :: _startDnsServer() {
-	this->_dnsServer->start(DNS_PORT, "*", IPAddress(8,8,8,8));
-}
+		/*
+		* Write an image chunk: offset (4 bytes, big endian) followed by image bytes
+		* Chunks that do not start at the current offset are ignored, the status tells the sender where to resume
+		*/
+		void _onOtaChunk(char * payload, size_t len, size_t index, size_t total);
 
+		/*
+		* Send progress, report state changes and reboot into the new image, called from loop()
+		*/
+		void _runOta();
 
-void XeoSmartHomeDevice :: _stopDnsServer() {
-	this->_dnsServer->stop();
-}
+		void _sendOtaStatus();
 
-// </DNS-SERVER>
-// <WEB-SERVER>
+		// REMOTE-CONFIG
+		// partial settings patches on device/<serial>/config, result on device/<serial>/config/status
 
-void XeoSmartHomeDevice :: _initWebServer() {
-	this->_webServer->onNotFound([this](AsyncWebServerRequest* request) {
-		request->redirect("/");
-	});
-	this->_webServer->serveStatic("/", SPIFFS, "/").setDefaultFile("index.html").setCacheControl("max-age=600");
-}
+		bool _configTrial = false; // booted with patched settings, CONFIG_PREVIOUS_FILE is restored if MQTT does not connect
 
+		/*
+		* Validate a patch against the settings schema, apply it and save the settings once
+		* Fields: name, dhcp, local_ip, gateway, subnet; e.g. {"dhcp": false, "local_ip": "192.168.1.20", "gateway": "192.168.1.1", "subnet": "255.255.255.0"}
+		* A static address needs local_ip, gateway and subnet, with the gateway in the subnet of local_ip
+		* The patch is a JWT HS256 token with exp and ctr claims, like signed actions; patches are rejected until the
+		* device key is set. Changes applied at boot request one reboot, patches received before it starts share it.
+		* The settings from before the patch are kept in CONFIG_PREVIOUS_FILE, see _runConfigRollback()
+		* @param message: patch, decoded in place
+		* @param len: message length
+		*/
+		void _onConfigPatch(char * message, size_t len);
 
-void XeoSmartHomeDevice :: _startWebServer() {
-	this->_webServer->begin();
-}
+		/*
+		* Restore the previous settings and reboot when MQTT did not connect within CONFIG_ROLLBACK_TIMEOUT after a
+		* patch, or before a duty cycle sleep; called from loop()
+		* @param sleeping: the device is about to sleep
+		*/
+		void _runConfigRollback(bool sleeping = false);
 
+		/*
+		* MQTT connected with patched settings, they are kept
+		*/
+		void _confirmConfig();
 
-void XeoSmartHomeDevice :: _stopWebServer() {
-	this->_webServer->end();
-	SPIFFS.end();
-}
+		/*
+		* @param status: "applied" or "rejected"
+		* @param field: rejected schema field, or signature, decode, claims, key or unknown; nullptr if the patch was applied
+		* @param changed: number of settings changed
+		* @param reboot: a reboot was requested
+		*/
+		void _sendConfigStatus(const char * status, const char * field, uint8_t changed = 0, bool reboot = false);
 
-// </WEB-SERVER>
-// <WEB-SOCKET-SERVER>
+		// WATCHDOG
+		// stalls and the activity running at a watchdog reset are reported on device/<serial>/watchdog
+		XeoSmartHomeInternals::LoopWatchdog _watchdog;
+		XeoSmartHomeInternals::WatchdogBreadcrumb _outsideLoop = {XeoSmartHomeInternals::ACTIVITY_NONE, 0, 0}; // restored when loop() starts
+		bool _watchdogResetReported = false;
 
-void XeoSmartHomeDevice :: _initWebSocketServer() {
-	this->_webServer->addHandler(this->_webSocketServer);
-	this->_webSocketServer->onEvent([this](AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len){
-		this->_onWebSocketEvent(server, client, type, arg, data, len);
-	});
-}
+		/*
+		* Report new stalls, called from loop()
+		*/
+		void _runWatchdog();
 
+		/*
+		* @param reset: report the activity running at the last reset instead of the last stall
+		*/
+		void _sendWatchdogReport(bool reset);
 
-void XeoSmartHomeDevice :: _onWebSocketEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len){
-	switch (type) {
-	case WS_EVT_CONNECT:
-		if(this->_debug)
-			Serial.printf("ws[%s][%u] connect\n", server->url(), client->id());
-		client->ping();
-		break;
-
-	case WS_EVT_DISCONNECT:
-		if(this->_debug)
-			Serial.printf("ws[%s][%u] disconnect\n", server->url(), client->id());
-		break;
-
-	case WS_EVT_PONG:
-		if(this->_debug)
-			Serial.printf("ws[%s][%u] pong[%u]: %s\n", server->url(), client->id(), len, (len) ? (char*)data : "");
-		break;
-
-	case WS_EVT_ERROR:
-		if(this->_debug)
-			Serial.printf("ws[%s][%u] error(%u): %s\n", server->url(), client->id(), *((uint16_t*)arg), (char*)data);
-		break;
-
-	case WS_EVT_DATA:
-		AwsFrameInfo* info = (AwsFrameInfo*)arg;
-		String message = "";
-		//the whole message is in a single frame and we got all of it's data
-		if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
-			for (size_t i = 0; i < info->len; i++)
-				message += (char)data[i];
-				this->_onWebSocketMessage(server, client, message);
-		}
-		break;
-	}
-}
+		/*
+		* @param buffer: output, e.g. "action:set_valve" or "scheduler"
+		* @return buffer
+		*/
+		const char * _watchdogActivityName(XeoSmartHomeInternals::WatchdogActivity activity, uint16_t index, char * buffer, size_t size);
 
+		// REBOOT
+		XeoSmartHomeInternals::RebootPhase _rebootPhase = XeoSmartHomeInternals::REBOOT_NONE;
+		uint32_t _rebootPhaseStart = 0; // millis() when the current phase started
+		const char * _rebootReason = "";
 
-void XeoSmartHomeDevice :: _onWebSocketMessage(AsyncWebSocket* server, AsyncWebSocketClient* client, String message){
-	DynamicJsonDocument request_doc(2048);
-	DynamicJsonDocument response_doc(1024);
-	deserializeJson(request_doc, message);
-
-	String event = request_doc["event"];
-
-	response_doc["event"] = event;
-	String response;
-
-	if (event == "scan_wifi_networks") {
-		this->_asyncWifiScan();
-		response_doc["status"] = 2; // searching status
-	}
-	else
-	if (event == "set_wifi_credentials") {
-		const char *ssid = request_doc["ssid"];
-		const char *password = request_doc["password"];
-
-		if (ssid != NULL && password != NULL) {
-			this->_settings.dhcp = true;
-			this->_saveSettings();
-			response_doc["status"] = SUCCESS;
-			WiFi.begin(ssid, password);
-		} else {
-			response_doc["status"] = FAIL;
-		}
-	}
-	else
-	if (event == "set_device_name") {
-		const char* name = request_doc["name"];
-
-		if (name != NULL) {
-			strncpy(this->_name, name, sizeof(this->_name));
-			_saveSettings();
-			response_doc["status"] = SUCCESS;
-		}else
-			response_doc["status"] = FAIL;
-	}
-	else
-	if (event == "set_wifi_advanced") {
-		String s_local_ip = request_doc["local_ip"];
-		String s_gate_way = request_doc["gateway"];
-		String s_subnet = request_doc["subnet"];
-
-		if (s_local_ip != NULL && s_gate_way != NULL && s_subnet != NULL) {
-
-			IPAddress local_ip = stringToIpAdress(s_local_ip);
-			IPAddress gateway = stringToIpAdress(s_gate_way);
-			IPAddress subnet = stringToIpAdress(s_subnet);
-
-			this->_settings.dhcp = false;
-			this->_settings.local_ip = local_ip;
-			this->_settings.gateway = gateway;
-			this->_settings.subnet_mask = subnet;
-			_saveSettings();
-			WiFi.config(local_ip, gateway, subnet);
-
-			response_doc["status"] = SUCCESS;
-		} else {
-			response_doc["status"] = FAIL;
-		}
-	}
-	else
-	if (event == "reboot_device") {
-		ESP.restart();
-		// TODO: this sometimes causes a wdt reset and esp8266 crashs.
-	}
-
-	serializeJson(response_doc, response);
-	client->text(response);
+		/*
+		* Advance a requested reboot, called from loop()
+		*/
+		void _runReboot();
 };
 
 
-void XeoSmartHomeDevice :: _asyncWifiScan() {
-	/*
-	This function scan for available wifi networks and send response using websockets to the client
-	*/
-	if (WiFi.scanComplete() != WIFI_SCAN_RUNNING) {
-		WiFi.scanNetworksAsync([this](int networks) {
-			DynamicJsonDocument doc(2024);
-			doc["event"] = "scan_wifi_networks";
-			doc["status"] = SUCCESS;
-
-			String ssid;
-			uint8_t encryptionType;
-			int32_t rssi;
-			uint8_t* bssid;
-			int32_t channel;
-			bool isHidden;
-
-			JsonArray ssidArray = doc.createNestedArray("ssid");
-			JsonArray encryptionTypeArray = doc.createNestedArray("encryption_type");
-			JsonArray rssiArray = doc.createNestedArray("rssi");
-			JsonArray bssidArray = doc.createNestedArray("bssid");
-			JsonArray chanelArray = doc.createNestedArray("chanel");
-			JsonArray isHidenArray = doc.createNestedArray("is_hiden");
-
-			for (int this_network = 0; this_network < networks; this_network++) {
-				WiFi.getNetworkInfo(this_network, ssid, encryptionType, rssi, bssid, channel, isHidden);
-				ssidArray.add(ssid);
-				/*
-				Function returns a number that encodes encryption type as follows:
-				* 2 : ENC_TYPE_TKIP - WPA / PSK 
-				* 4 : ENC_TYPE_CCMP - WPA2 / PSK 
-				* 5 : ENC_TYPE_WEP - WEP 
-				* 7 : ENC_TYPE_NONE - open network 
-				* 8 : ENC_TYPE_AUTO - WPA / WPA2 / PSK 
-				*/
-				encryptionTypeArray.add(encryptionType);
-				rssiArray.add(rssi);
-				//bssidArray.add(bssid); // TODO: transform mac adress from pointer to string
-				chanelArray.add(channel);
-				isHidenArray.add(isHidden);
-			}
-
-			String response;
-			//serializeJson(doc, response);
-			serializeJson(doc, response);
-			//Serial.println(response);
-
-			this->_webSocketServer->textAll(response);
-		}, true);
-	}
+template<typename... Args, typename Callback, typename>
+void XeoSmartHomeDevice :: addActionHandler(const char * action_name, Callback callback, XeoSmartHomeInternals::ActionPolicy policy) {
+	this->addActionHandler(action_name, [callback](JsonArray& parameters) mutable {
+		XeoSmartHomeInternals::ActionBinding<Args...>::call(callback, parameters);
+	}, policy);
+	this->_ActionsVector.back().validator = XeoSmartHomeInternals::ActionBinding<Args...>::validate;
 }
-
-// </WEB-SOCKET-SERVER>
-// <NTP-CLIENT>
-
-void XeoSmartHomeDevice :: _initNtpClient(){
-	configTime(2*60*60, 0, "pool.ntp.org");
-}
-
-// </NTP-CLIENT>
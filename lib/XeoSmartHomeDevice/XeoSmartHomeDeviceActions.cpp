@@ -0,0 +1,266 @@
+#include "XeoSmartHomeDevice.h"
+
+
+bool XeoSmartHomeDevice :: _onAction(const char * message, size_t len, XeoSmartHomeInternals::WireFormat format, bool signed_message){
+	XEO_LOG_DEBUG("OnAction()");
+
+	DynamicJsonDocument doc(4096);
+	DeserializationError error;
+	if(format == XeoSmartHomeInternals::WIRE_FORMAT_MSGPACK)
+		error = deserializeMsgPack(doc, message, len);
+	else
+		error = deserializeJson(doc, message, len);
+
+	if(error){
+		XEO_LOG_WARNING("Action decode failed: %s", error.c_str());
+		return false;
+	}
+
+	const char * action_name = doc["name"];
+	JsonArray action_parameters = doc["parameters"];
+
+	if(signed_message and not this->_checkSignedClaims(doc))
+		return false;
+
+	if(action_name != nullptr and strcmp_P(action_name, PSTR(GET_STATE_ACTION)) == 0){
+		this->_stateRequested = true; // requests received before loop() runs are answered once
+		return true;
+	}
+
+	if(action_name != nullptr and strcmp_P(action_name, PSTR(GET_LOGS_ACTION)) == 0){
+		this->_logsRequested = true;
+		return true;
+	}
+
+	return this->_enqueueAction(action_name, action_parameters);
+}
+
+// <ACTION-AUTH>
+
+void XeoSmartHomeDevice :: _onSignedAction(char * message, size_t len, XeoSmartHomeInternals::WireFormat format){
+	if(not this->_actionAuthenticator.hasKey()){
+		// not set up by the app yet, nothing to verify with
+		this->_onAction(message, len, format);
+		return;
+	}
+
+	size_t action_len;
+	if(format == XeoSmartHomeInternals::WIRE_FORMAT_MSGPACK)
+		action_len = this->_actionAuthenticator.verifyEnvelope(message, len);
+	else
+		action_len = this->_actionAuthenticator.verifyJwt(message, len);
+
+	if(action_len == 0){
+		XEO_LOG_WARNING("Action signature is not valid");
+		this->_actionQueueStats.unauthenticated++;
+		return;
+	}
+
+	this->_onAction(message, action_len, format, true);
+}
+
+bool XeoSmartHomeDevice :: _checkSignedClaims(JsonDocument & doc){
+	// exp can only be checked once the clock is set, the counter protects against replays until then; after a power on
+	// it starts from the block reserved in ACTION_COUNTER_FILE
+	bool expired = not doc["exp"].is<uint32_t>() or (this->_timeService.getSyncState() != XeoSmartHomeInternals::TIME_NOT_SET and (uint32_t) this->now() > doc["exp"].as<uint32_t>());
+	if(expired or not doc["ctr"].is<uint32_t>() or doc["ctr"].as<uint32_t>() <= this->_snapshot.action_counter){
+		XEO_LOG_WARNING("Signed message rejected: %s", expired ? "expired" : "replayed");
+		this->_actionQueueStats.unauthenticated++;
+		return false;
+	}
+
+	this->_snapshot.action_counter = doc["ctr"];
+	this->_snapshotDirty = true;
+	// no flash write here: loop() reserves the counter before actions run, a message lost to a power cut before that
+	// was never acted on
+	return true;
+}
+
+// </ACTION-AUTH>
+// <ACTION-QUEUE>
+
+bool XeoSmartHomeDevice :: _enqueueAction(const char * action_name, JsonArray parameters){
+	if(action_name == nullptr){
+		this->_actionQueueStats.rejected++;
+		return false;
+	}
+
+	size_t action_index = 0;
+	while(action_index < this->_ActionsVector.size() and strcmp(this->_ActionsVector[action_index].name, action_name) != 0)
+		action_index++;
+
+	if(action_index == this->_ActionsVector.size() or measureMsgPack(parameters) > ACTION_PARAMETERS_MAX_SIZE){
+		this->_actionQueueStats.rejected++;
+		return false;
+	}
+
+	// every handler of the action runs with these parameters, so every typed handler must accept them
+	for(size_t i = action_index; i < this->_ActionsVector.size(); i++){
+		XeoSmartHomeInternals::Action & handler = this->_ActionsVector[i];
+		if(handler.validator and strcmp(handler.name, action_name) == 0 and not handler.validator(parameters)){
+			this->_ActionsVector[action_index].counters.invalid++;
+			return false;
+		}
+	}
+
+	uint8_t encoded_parameters[ACTION_PARAMETERS_MAX_SIZE];
+	size_t encoded_len = serializeMsgPack(parameters, encoded_parameters, sizeof(encoded_parameters));
+
+	// the slot is only committed when the policy lets the action through
+	XeoSmartHomeInternals::QueuedAction * queued_action = this->_actionQueue.reserve();
+	if(not this->_applyActionPolicy(action_index, encoded_parameters, encoded_len, queued_action == nullptr))
+		return false;
+
+	queued_action->action_index = action_index;
+	queued_action->enqueued_at = millis();
+	queued_action->parameters_len = encoded_len;
+	memcpy(queued_action->parameters, encoded_parameters, encoded_len);
+	this->_actionQueue.commit();
+
+	uint16_t depth = this->_actionQueue.size();
+	if(depth > this->_actionQueueStats.max_depth)
+		this->_actionQueueStats.max_depth = depth;
+	return true;
+}
+
+
+bool XeoSmartHomeDevice :: _applyActionPolicy(size_t action_index, const uint8_t * parameters, size_t parameters_len, bool queue_full){
+	XeoSmartHomeInternals::Action & action = this->_ActionsVector[action_index];
+	uint32_t now = millis();
+
+	// FNV-1a hash of the encoded parameters
+	uint32_t hash = 2166136261UL;
+	for(size_t i = 0; i < parameters_len; i++)
+		hash = (hash ^ parameters[i]) * 16777619UL;
+
+	if(action.policy.duplicate_window > 0 and action.counters.accepted > 0 and hash == action.last_hash and now - action.last_accepted_at < action.policy.duplicate_window){
+		action.counters.duplicates++;
+		return false;
+	}
+
+	// runs in network callbacks, which only interrupt loop() where it yields; _executeCoalescedActions() releases a
+	// slot before its handlers run, so a handler that yields can not have its parameters overwritten here
+	XeoSmartHomeInternals::CoalescedAction * free_slot = nullptr;
+	if(action.policy.coalesce_window > 0){
+		for(XeoSmartHomeInternals::CoalescedAction & slot : this->_coalescedActions){
+			if(slot.pending and slot.action.action_index == action_index){
+				// latest wins, the pending action keeps its deadline
+				memcpy(slot.action.parameters, parameters, parameters_len);
+				slot.action.parameters_len = parameters_len;
+				action.counters.coalesced++;
+				action.last_hash = hash;
+				action.last_accepted_at = now;
+				return false;
+			}
+			if(not slot.pending and free_slot == nullptr)
+				free_slot = &slot;
+		}
+	}
+
+	if(action.policy.rate > 0){
+		action.tokens += (now - action.last_refill) * action.policy.rate / 1000.0f;
+		if(action.tokens > action.policy.burst)
+			action.tokens = action.policy.burst;
+		action.last_refill = now;
+
+		if(action.tokens < 1){
+			action.counters.rate_limited++;
+			return false;
+		}
+	}
+
+	// no coalescing or all coalesce slots are busy, the action needs a queue slot
+	if(free_slot == nullptr and queue_full){
+		this->_actionQueueStats.overflows++;
+		return false;
+	}
+
+	// only actions that are held or queued count for the rate limit and the duplicate window
+	if(action.policy.rate > 0)
+		action.tokens -= 1;
+	action.counters.accepted++;
+	action.last_hash = hash;
+	action.last_accepted_at = now;
+
+	if(free_slot != nullptr){
+		free_slot->action.action_index = action_index;
+		free_slot->action.enqueued_at = now;
+		free_slot->action.parameters_len = parameters_len;
+		memcpy(free_slot->action.parameters, parameters, parameters_len);
+		free_slot->deadline = now + action.policy.coalesce_window;
+		free_slot->pending = true;
+		return false;
+	}
+
+	return true;
+}
+
+
+void XeoSmartHomeDevice :: _executeQueuedActions(){
+	// only actions queued before this call are executed, handlers that queue new actions can not starve loop()
+	for(size_t pending = this->_actionQueue.size(); pending > 0; pending--){
+		this->_executeAction(*this->_actionQueue.front());
+		this->_actionQueue.pop();
+	}
+}
+
+
+void XeoSmartHomeDevice :: _executeCoalescedActions(){
+	uint32_t now = millis();
+	for(XeoSmartHomeInternals::CoalescedAction & slot : this->_coalescedActions){
+		if(slot.pending and (int32_t)(now - slot.deadline) >= 0){
+			// copied out and released first: handlers may yield, an action coalesced meanwhile takes a free slot
+			XeoSmartHomeInternals::QueuedAction action = slot.action;
+			slot.pending = false;
+			this->_executeAction(action);
+		}
+	}
+}
+
+
+void XeoSmartHomeDevice :: _executeAction(XeoSmartHomeInternals::QueuedAction & queued_action){
+	// the counter of a signed action is persisted before it acts, see _checkSignedClaims()
+	this->_saveActionCounter();
+
+	uint32_t wait = millis() - queued_action.enqueued_at;
+	this->_actionQueueStats.last_wait = wait;
+	if(wait > this->_actionQueueStats.max_wait)
+		this->_actionQueueStats.max_wait = wait;
+
+	// zero-copy: strings in parameters point into the action slot, which is released after the handlers return
+	StaticJsonDocument<ACTION_PARAMETERS_MAX_SIZE * 4> doc;
+	deserializeMsgPack(doc, (char *) queued_action.parameters, queued_action.parameters_len);
+	JsonArray action_parameters = doc.as<JsonArray>();
+
+	const char * action_name = this->_ActionsVector[queued_action.action_index].name;
+#if XEO_FEATURE_CONFIG_PORTAL
+	if(this->_liveSubscriberCount > 0){
+		char live_value[LIVE_VALUE_MAX_LENGTH];
+		if(measureJson(action_parameters) >= sizeof(live_value))
+			strcpy_P(live_value, PSTR("null"));
+		else
+			serializeJson(action_parameters, live_value, sizeof(live_value));
+		this->_liveFeedUpdate(XeoSmartHomeInternals::LIVE_ACTION, action_name, live_value);
+	}
+#endif
+	for(size_t i = queued_action.action_index; i < this->_ActionsVector.size(); i++){
+		if(strcmp(this->_ActionsVector[i].name, action_name) == 0){
+			XeoSmartHomeInternals::WatchdogScope watchdog_scope(this->_watchdog, XeoSmartHomeInternals::ACTIVITY_ACTION, i);
+			this->_ActionsVector[i].callback(action_parameters);
+		}
+	}
+
+	this->_actionQueueStats.executed++;
+}
+
+// </ACTION-QUEUE>
+// <LOCAL-CONTROL>
+
+void XeoSmartHomeDevice :: _initLocalControl(){
+	// runs in the network context like the MQTT callbacks, actions are queued for loop()
+	this->_localControl.onAction([this](const char * payload, size_t len, bool msgpack){
+		return this->_onAction(payload, len, msgpack ? XeoSmartHomeInternals::WIRE_FORMAT_MSGPACK : XeoSmartHomeInternals::WIRE_FORMAT_JSON);
+	});
+}
+
+// </LOCAL-CONTROL>
@@ -0,0 +1,64 @@
+#include "XeoSmartHomeDevice.h"
+
+
+#if XEO_FEATURE_BUTTON
+
+void XeoSmartHomeDevice :: setOnButtonPressHandler(XeoSmartHomeInternals::OnButtonPressCallback callback) {
+	this->_onButtonPress = callback;
+}
+
+//<BUTTON>
+
+void XeoSmartHomeDevice :: _initButton(){
+	pinMode(this->_button_pin, INPUT_PULLUP);
+}
+
+
+bool XeoSmartHomeDevice :: _buttonIsPressed() {
+	return not digitalRead(this->_button_pin);
+}
+
+
+void XeoSmartHomeDevice :: _checkForButtonStateChanges(){
+	bool current_state = this->_buttonIsPressed();
+	if(current_state){ // Button is pressed
+		if(this->_button_last_state){
+			if(millis() - this->_button_press_time > BUTTON_LONG_PRESS and not this->_long_detected){
+				this->_long_detected = true;
+				this->_onButtonLongPress();
+			}
+		} else {
+			this->_button_press_time = millis();
+		}
+	} else
+	if(this->_button_last_state){ // Button is not pressed
+		this->_long_detected = false;
+		unsigned long pressed_time = millis() - this->_button_press_time;
+		if(BUTTON_SHORT_PRESS_MIN < pressed_time and pressed_time < BUTTON_SHORT_PRESS_MAX){
+			if(not this->_config_mode and this->_onButtonPress){
+				XeoSmartHomeInternals::WatchdogScope watchdog_scope(this->_watchdog, XeoSmartHomeInternals::ACTIVITY_BUTTON);
+				this->_onButtonPress();
+			}
+		}
+	}
+	_button_last_state = current_state;
+}
+
+
+void XeoSmartHomeDevice :: _onButtonLongPress(){
+	XEO_LOG_INFO("Long button pressed detected");
+
+#if XEO_FEATURE_CONFIG_PORTAL
+	this->_config_mode = not this->_config_mode;
+
+	if(this->_config_mode){
+		this->_startConfigMode();
+	} else {
+		this->_stopConfigMode();
+	}
+#endif
+}
+
+//</BUTTON>
+
+#endif
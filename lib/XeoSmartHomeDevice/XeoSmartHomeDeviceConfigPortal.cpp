@@ -0,0 +1,473 @@
+#include "XeoSmartHomeDevice.h"
+
+
+#if XEO_FEATURE_CONFIG_PORTAL
+
+namespace XeoSmartHomeCaptiveProbes {
+	enum ProbeResponse : uint8_t {
+		PROBE_REDIRECT, // 302 to the portal, anything but the expected answer opens the sign-in sheet
+		PROBE_PAGE // 200 with a tiny page, Apple's captive network assistant shows the body and follows the refresh
+	};
+
+	struct Probe {
+		char path[28];
+		ProbeResponse response;
+	};
+
+	// copied to RAM one entry at a time when the web server is initialized
+	const Probe PROBES[] PROGMEM = {
+		{"/generate_204", PROBE_REDIRECT}, // Android
+		{"/gen_204", PROBE_REDIRECT}, // Android, older releases
+		{"/hotspot-detect.html", PROBE_PAGE}, // iOS, macOS
+		{"/library/test/success.html", PROBE_PAGE}, // iOS, older releases
+		{"/connecttest.txt", PROBE_REDIRECT}, // Windows 10 and later
+		{"/ncsi.txt", PROBE_REDIRECT}, // Windows, older releases
+		{"/redirect", PROBE_REDIRECT}, // Windows, after a failed connecttest
+		{"/canonical.html", PROBE_REDIRECT}, // Firefox
+		{"/success.txt", PROBE_REDIRECT}, // Firefox
+		{"/check_network_status.txt", PROBE_REDIRECT} // NetworkManager
+	};
+
+	const char PROBE_PAGE_BODY[] PROGMEM = "<html><head><meta http-equiv=\"refresh\" content=\"0;url=http://8.8.8.8/\"></head><body><a href=\"http://8.8.8.8/\">Setup</a></body></html>";
+};
+
+
+// <CONFIG-MODE>
+
+void XeoSmartHomeDevice :: _startConfigMode() {
+	XEO_LOG_INFO("Config mode started");
+	this->_captivePortalStats = XeoSmartHomeInternals::CaptivePortalStats();
+	this->_configModeStartedAt = millis();
+
+#if XEO_FEATURE_LED
+	this->_setColorSignal(XeoSmartHomeInternals::COLOR_SIGNAL_SETTINGS);
+#endif
+
+	WiFi.mode(WIFI_AP_STA);
+	if(this->_dutyCycle.isEnabled()){
+		// duty-cycle devices skip the access point setup in _initWiFi()
+		WiFi.softAP(this->_name);
+		WiFi.softAPConfig(IPAddress(8,8,8,8), IPAddress(8,8,8,8), IPAddress(255, 255, 255, 0));
+	}
+	this->_startDnsServer();
+	this->_startWebServer();
+}
+
+
+void XeoSmartHomeDevice :: _stopConfigMode() {
+	XEO_LOG_INFO("Config mode stopped");
+
+	WiFi.mode(WIFI_STA);
+	this->_stopDnsServer();
+	this->_stopWebServer();
+
+#if XEO_FEATURE_LED
+	this->_ledTask.disable();
+	this->_setLedColor(CRGB::Black);
+#endif
+}
+
+// </CONFIG-MODE>
+// <DNS-SERVER>
+
+void XeoSmartHomeDevice :: _initDnsServer() {
+	this->_dnsServer->setErrorReplyCode(AsyncDNSReplyCode::NoError);
+	this->_dnsServer->setTTL(CAPTIVE_PORTAL_DNS_TTL);
+}
+
+
+void XeoSmartHomeDevice :: _startDnsServer() {
+	this->_dnsServer->start(DNS_PORT, "*", IPAddress(8,8,8,8));
+}
+
+
+void XeoSmartHomeDevice :: _stopDnsServer() {
+	this->_dnsServer->stop();
+}
+
+// </DNS-SERVER>
+// <WEB-SERVER>
+
+void XeoSmartHomeDevice :: _initWebServer() {
+	// probe handlers are checked before the static files, so probes never touch SPIFFS
+	this->_initCaptiveProbes();
+	this->_webServer->onNotFound([this](AsyncWebServerRequest* request) {
+		this->_captivePortalStats.redirects++;
+		this->_redirectToPortal(request);
+	});
+	this->_webServer->serveStatic("/", SPIFFS, "/").setDefaultFile("index.html").setCacheControl("max-age=600");
+}
+
+
+void XeoSmartHomeDevice :: _initCaptiveProbes() {
+	for(const XeoSmartHomeCaptiveProbes::Probe & probe_P : XeoSmartHomeCaptiveProbes::PROBES){
+		XeoSmartHomeCaptiveProbes::Probe probe;
+		memcpy_P(&probe, &probe_P, sizeof(probe));
+
+		XeoSmartHomeCaptiveProbes::ProbeResponse response = probe.response;
+		this->_webServer->on(probe.path, HTTP_GET, [this, response](AsyncWebServerRequest* request) {
+			if(this->_captivePortalStats.probes++ == 0)
+				this->_captivePortalStats.first_probe_after = millis() - this->_configModeStartedAt;
+
+			if(response == XeoSmartHomeCaptiveProbes::PROBE_PAGE){
+				AsyncWebServerResponse * page = request->beginResponse_P(200, F("text/html"), XeoSmartHomeCaptiveProbes::PROBE_PAGE_BODY);
+				page->addHeader(F("Cache-Control"), F("no-store"));
+				request->send(page);
+			} else {
+				this->_redirectToPortal(request);
+			}
+		});
+	}
+}
+
+
+void XeoSmartHomeDevice :: _redirectToPortal(AsyncWebServerRequest * request) {
+	AsyncWebServerResponse * response = request->beginResponse(302);
+	response->addHeader(F("Location"), FPSTR(XeoSmartHomeInternals::CAPTIVE_PORTAL_URL));
+	response->addHeader(F("Cache-Control"), F("no-store"));
+	request->send(response);
+}
+
+
+void XeoSmartHomeDevice :: _startWebServer() {
+	this->_webServer->begin();
+}
+
+
+void XeoSmartHomeDevice :: _stopWebServer() {
+	this->_webServer->end();
+	SPIFFS.end();
+}
+
+// </WEB-SERVER>
+// <WEB-SOCKET-SERVER>
+
+void XeoSmartHomeDevice :: _initWebSocketServer() {
+	this->_webServer->addHandler(this->_webSocketServer);
+	this->_webSocketServer->onEvent([this](AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len){
+		this->_onWebSocketEvent(server, client, type, arg, data, len);
+	});
+}
+
+
+void XeoSmartHomeDevice :: _onWebSocketEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len){
+	switch (type) {
+	case WS_EVT_CONNECT:
+		XEO_LOG_DEBUG("ws[%s][%u] connect", server->url(), client->id());
+		client->ping();
+		if(this->_captivePortalStats.opened_after == 0){
+			// the portal page opens the WebSocket as soon as it is loaded
+			this->_captivePortalStats.opened_after = max(millis() - this->_configModeStartedAt, 1UL);
+			XEO_LOG_INFO("Portal opened after %u ms, %u probes, %u redirects", this->_captivePortalStats.opened_after, this->_captivePortalStats.probes, this->_captivePortalStats.redirects);
+		}
+		break;
+
+	case WS_EVT_DISCONNECT:
+		XEO_LOG_DEBUG("ws[%s][%u] disconnect", server->url(), client->id());
+		this->_liveFeedUnsubscribe(client->id());
+		break;
+
+	case WS_EVT_PONG:
+		XEO_LOG_DEBUG("ws[%s][%u] pong[%u]", server->url(), client->id(), len);
+		break;
+
+	case WS_EVT_ERROR:
+		XEO_LOG_WARNING("ws[%s][%u] error(%u)", server->url(), client->id(), *((uint16_t*)arg));
+		break;
+
+	case WS_EVT_DATA:
+		AwsFrameInfo* info = (AwsFrameInfo*)arg;
+		String message = "";
+		//the whole message is in a single frame and we got all of it's data
+		if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
+			for (size_t i = 0; i < info->len; i++)
+				message += (char)data[i];
+				this->_onWebSocketMessage(server, client, message);
+		}
+		break;
+	}
+}
+
+
+void XeoSmartHomeDevice :: _onWebSocketMessage(AsyncWebSocket* server, AsyncWebSocketClient* client, String message){
+	DynamicJsonDocument request_doc(2048);
+	DynamicJsonDocument response_doc(1024);
+	deserializeJson(request_doc, message);
+
+	// event names are compared in flash, a String per message is not needed
+	const char * event = request_doc["event"] | "";
+
+	response_doc["event"] = event;
+	String response;
+	std::unique_ptr<char[]> logs;
+
+	if (strcmp_P(event, PSTR("scan_wifi_networks")) == 0) {
+		this->_asyncWifiScan();
+		response_doc["status"] = 2; // searching status
+	}
+	else
+	if (strcmp_P(event, PSTR("set_wifi_credentials")) == 0) {
+		const char *ssid = request_doc["ssid"];
+		const char *password = request_doc["password"];
+
+		if (ssid != NULL && password != NULL) {
+			this->_settings.dhcp = true;
+			this->_saveSettings();
+			response_doc["status"] = SUCCESS;
+			WiFi.begin(ssid, password);
+		} else {
+			response_doc["status"] = FAIL;
+		}
+	}
+	else
+	if (strcmp_P(event, PSTR("set_device_name")) == 0) {
+		const char* name = request_doc["name"];
+
+		if (name != NULL) {
+			strncpy(this->_name, name, sizeof(this->_name));
+			_saveSettings();
+			response_doc["status"] = SUCCESS;
+		}else
+			response_doc["status"] = FAIL;
+	}
+	else
+	if (strcmp_P(event, PSTR("set_wifi_advanced")) == 0) {
+		String s_local_ip = request_doc["local_ip"];
+		String s_gate_way = request_doc["gateway"];
+		String s_subnet = request_doc["subnet"];
+
+		if (s_local_ip != NULL && s_gate_way != NULL && s_subnet != NULL) {
+
+			IPAddress local_ip = stringToIpAdress(s_local_ip);
+			IPAddress gateway = stringToIpAdress(s_gate_way);
+			IPAddress subnet = stringToIpAdress(s_subnet);
+
+			this->_settings.dhcp = false;
+			this->_settings.local_ip = local_ip;
+			this->_settings.gateway = gateway;
+			this->_settings.subnet_mask = subnet;
+			_saveSettings();
+			WiFi.config(local_ip, gateway, subnet);
+
+			response_doc["status"] = SUCCESS;
+		} else {
+			response_doc["status"] = FAIL;
+		}
+	}
+	else
+	if (strcmp_P(event, PSTR("set_local_key")) == 0) {
+		const char* key = request_doc["key"];
+		uint8_t key_bytes[LOCAL_KEY_MAX_LENGTH];
+		size_t key_len = key != NULL ? hexToBytes(key, key_bytes, sizeof(key_bytes)) : 0;
+
+		if (key_len >= 16) {
+			// a short or malformed key leaves the current one in place
+			memcpy(this->_settings.local_key, key_bytes, key_len);
+			this->_settings.local_key_len = key_len;
+			this->_localControl.setKey(this->_settings.local_key, key_len);
+			this->_actionAuthenticator.setKey(this->_settings.local_key, key_len);
+			bool saved = _saveSettings();
+
+			// _onWifiConnected() only starts local control when a key was already set
+			if(WiFi.isConnected() and not this->_dutyCycle.isEnabled())
+				this->_localControl.begin(this->_serial, this->_name);
+			response_doc["status"] = saved ? SUCCESS : FAIL; // the app sets the key again, it would not survive a reboot
+		} else
+			response_doc["status"] = FAIL;
+	}
+	else
+	if (strcmp_P(event, PSTR("start_live_feed")) == 0) {
+		response_doc["status"] = this->_liveFeedSubscribe(client->id()) ? SUCCESS : FAIL;
+	}
+	else
+	if (strcmp_P(event, PSTR("stop_live_feed")) == 0) {
+		this->_liveFeedUnsubscribe(client->id());
+		response_doc["status"] = SUCCESS;
+	}
+	else
+	if (strcmp_P(event, PSTR("get_logs")) == 0) {
+		logs.reset(new char[LOG_BUFFER_SIZE + 1]);
+		XeoSmartHomeInternals::logger.copyTo(logs.get(), LOG_BUFFER_SIZE + 1);
+		response_doc["logs"] = (const char *) logs.get(); // not copied, logs lives until the response is serialized
+		response_doc["status"] = SUCCESS;
+	}
+	else
+	if (strcmp_P(event, PSTR("reboot_device")) == 0) {
+		// restarting inside the WebSocket callback could end in a WDT reset, loop() reboots after this answer is sent
+		this->requestReboot("reboot_device");
+		response_doc["status"] = SUCCESS;
+	}
+
+	serializeJson(response_doc, response);
+	client->text(response);
+};
+
+
+void XeoSmartHomeDevice :: _asyncWifiScan() {
+	/*
+	This function scan for available wifi networks and send response using websockets to the client
+	*/
+	if (WiFi.scanComplete() != WIFI_SCAN_RUNNING) {
+		WiFi.scanNetworksAsync([this](int networks) {
+			DynamicJsonDocument doc(2024);
+			doc["event"] = F("scan_wifi_networks");
+			doc["status"] = SUCCESS;
+
+			String ssid;
+			uint8_t encryptionType;
+			int32_t rssi;
+			uint8_t* bssid;
+			int32_t channel;
+			bool isHidden;
+
+			JsonArray ssidArray = doc.createNestedArray("ssid");
+			JsonArray encryptionTypeArray = doc.createNestedArray("encryption_type");
+			JsonArray rssiArray = doc.createNestedArray("rssi");
+			JsonArray bssidArray = doc.createNestedArray("bssid");
+			JsonArray chanelArray = doc.createNestedArray("chanel");
+			JsonArray isHidenArray = doc.createNestedArray("is_hiden");
+
+			for (int this_network = 0; this_network < networks; this_network++) {
+				WiFi.getNetworkInfo(this_network, ssid, encryptionType, rssi, bssid, channel, isHidden);
+				ssidArray.add(ssid);
+				/*
+				Function returns a number that encodes encryption type as follows:
+				* 2 : ENC_TYPE_TKIP - WPA / PSK 
+				* 4 : ENC_TYPE_CCMP - WPA2 / PSK 
+				* 5 : ENC_TYPE_WEP - WEP 
+				* 7 : ENC_TYPE_NONE - open network 
+				* 8 : ENC_TYPE_AUTO - WPA / WPA2 / PSK 
+				*/
+				encryptionTypeArray.add(encryptionType);
+				rssiArray.add(rssi);
+				//bssidArray.add(bssid); // TODO: transform mac adress from pointer to string
+				chanelArray.add(channel);
+				isHidenArray.add(isHidden);
+			}
+
+			String response;
+			//serializeJson(doc, response);
+			serializeJson(doc, response);
+			//Serial.println(response);
+
+			this->_webSocketServer->textAll(response);
+		}, true);
+	}
+}
+
+// </WEB-SOCKET-SERVER>
+// <LIVE-FEED>
+
+void XeoSmartHomeDevice :: _liveFeedUpdate(XeoSmartHomeInternals::LiveValueType type, const char * key, const char * value){
+	if(this->_liveSubscriberCount == 0)
+		return;
+
+	// latest value per key; a new key takes the free or least recently updated slot
+	XeoSmartHomeInternals::LiveValue * slot = nullptr;
+	XeoSmartHomeInternals::LiveValue * oldest = &this->_liveValues[0];
+	for(XeoSmartHomeInternals::LiveValue & live_value : this->_liveValues){
+		if(live_value.sequence != 0 and live_value.type == type and strncmp(live_value.key, key, sizeof(live_value.key) - 1) == 0){
+			slot = &live_value;
+			break;
+		}
+		if(live_value.sequence < oldest->sequence)
+			oldest = &live_value;
+	}
+
+	if(slot == nullptr){
+		slot = oldest;
+		slot->type = type;
+		strlcpy(slot->key, key, sizeof(slot->key));
+	}
+	strlcpy(slot->value, value, sizeof(slot->value));
+	slot->sequence = ++this->_liveSequence;
+}
+
+
+namespace XeoSmartHomeLiveFeed {
+	// entry types, indexed by LiveValueType
+	const char TYPES[][8] PROGMEM = {"sensor", "status", "action"};
+};
+
+
+void XeoSmartHomeDevice :: _runLiveFeed(){
+	if(this->_liveSubscriberCount == 0)
+		return;
+
+	uint32_t now = millis();
+	for(XeoSmartHomeInternals::LiveSubscriber & subscriber : this->_liveSubscribers){
+		if(not subscriber.active or subscriber.sequence == this->_liveSequence or now - subscriber.sent_at < LIVE_FEED_INTERVAL)
+			continue;
+
+		AsyncWebSocketClient * client = this->_webSocketServer->client(subscriber.client_id);
+		if(client == nullptr or client->status() != WS_CONNECTED){
+			this->_liveFeedUnsubscribe(subscriber.client_id);
+			continue;
+		}
+
+		subscriber.sent_at = now;
+		if(client->queueIsFull()){
+			// values are not queued for the client, the next message has the latest ones
+			subscriber.dropped++;
+			continue;
+		}
+
+		// keys and values are not copied, the document is serialized before they can change
+		DynamicJsonDocument doc(LIVE_DOCUMENT_SIZE);
+		doc["event"] = "live";
+		doc["dropped"] = subscriber.dropped;
+		JsonArray values = doc.createNestedArray("values");
+		for(XeoSmartHomeInternals::LiveValue & live_value : this->_liveValues){
+			if(live_value.sequence <= subscriber.sequence)
+				continue;
+			JsonObject entry = values.createNestedObject();
+			entry["type"] = FPSTR(XeoSmartHomeLiveFeed::TYPES[live_value.type]); // copied from flash into the document
+			entry["key"] = (const char *) live_value.key;
+			entry["value"] = serialized((const char *) live_value.value); // sensor values are null when not finite, see formatReading()
+		}
+		subscriber.sequence = this->_liveSequence;
+
+		String message;
+		serializeJson(doc, message);
+		client->text(message);
+	}
+}
+
+
+bool XeoSmartHomeDevice :: _liveFeedSubscribe(uint32_t client_id){
+	XeoSmartHomeInternals::LiveSubscriber * free_subscriber = nullptr;
+	for(XeoSmartHomeInternals::LiveSubscriber & subscriber : this->_liveSubscribers){
+		if(subscriber.active and subscriber.client_id == client_id)
+			return true;
+		if(not subscriber.active and free_subscriber == nullptr)
+			free_subscriber = &subscriber;
+	}
+
+	if(free_subscriber == nullptr)
+		return false;
+
+	// the first message has every value still kept
+	free_subscriber->active = true;
+	free_subscriber->client_id = client_id;
+	free_subscriber->sequence = 0;
+	free_subscriber->sent_at = millis() - LIVE_FEED_INTERVAL;
+	free_subscriber->dropped = 0;
+	this->_liveSubscriberCount++;
+	return true;
+}
+
+
+void XeoSmartHomeDevice :: _liveFeedUnsubscribe(uint32_t client_id){
+	for(XeoSmartHomeInternals::LiveSubscriber & subscriber : this->_liveSubscribers){
+		if(subscriber.active and subscriber.client_id == client_id){
+			subscriber.active = false;
+			this->_liveSubscriberCount--;
+			if(subscriber.dropped > 0)
+				XEO_LOG_INFO("Live feed client %u dropped %u messages", client_id, subscriber.dropped);
+		}
+	}
+}
+
+// </LIVE-FEED>
+
+#endif
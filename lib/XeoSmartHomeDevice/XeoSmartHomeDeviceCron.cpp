@@ -0,0 +1,33 @@
+#include "XeoSmartHomeDevice.h"
+
+
+#if XEO_FEATURE_CRON
+
+void XeoSmartHomeDevice :: addTimedActionHamdler(const char * action_name, XeoSmartHomeInternals::OnActionCallback callback) {
+	XeoSmartHomeInternals::Action timed_action;
+	strncpy(timed_action.name, action_name, ACTION_NAME_MAX_LENGTH);
+	timed_action.callback = callback;
+	this->_TimedActionsVector.push_back(timed_action);
+}
+
+
+void XeoSmartHomeDevice :: _onSceduleUpdate(const char * message, size_t len){
+	XEO_LOG_DEBUG("OnScheduleUpdate()");
+
+	DynamicJsonDocument doc(4096);
+	deserializeJson(doc, message, len);
+
+	const char * action_name = doc["name"];
+	JsonArray action_parameters = doc["parameters"];
+	if(action_name == nullptr)
+		return;
+
+	for(XeoSmartHomeInternals::Action timed_action : this->_TimedActionsVector){
+		if(strcmp(timed_action.name, action_name) == 0){
+			XEO_LOG_DEBUG("%s - timed action", action_name);
+			//timed_action.callback(action_parameters);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "XeoSmartHomeDevice.h"
+
+
+#if XEO_FEATURE_LED
+
+namespace XeoSmartHomeColorCodes {
+	// 0xRRGGBB codes, copied to RAM when a signal starts
+	const uint32_t SETTINGS_COLORS[] PROGMEM = {CRGB::Blue, CRGB::Black};
+	const uint16 SETTINGS_INTERVAL = 500;
+
+	const uint32_t WIFI_NOT_CONNECTED[] PROGMEM = {CRGB::Red, CRGB::Black, CRGB::Red, CRGB::Black, CRGB::Red, CRGB::Black, CRGB::Black, CRGB::Black};
+	const uint16 WITI_NOT_CONNECTED_INTERVAL = 250;
+
+	static_assert(sizeof(SETTINGS_COLORS) / sizeof(uint32_t) <= LED_SIGNAL_MAX_COLORS and sizeof(WIFI_NOT_CONNECTED) / sizeof(uint32_t) <= LED_SIGNAL_MAX_COLORS, "color signal longer than LED_SIGNAL_MAX_COLORS");
+};
+
+
+//<LED>
+
+void XeoSmartHomeDevice :: _initLed(){
+	FastLED.addLeds<NEOPIXEL, D8>(this->_leds, 1);
+	
+	this->_taskScheduler.addTask(_ledTask);
+	this->_ledTask.setOnDisable([this](){
+		this->_setLedColor(CRGB::Black);
+	});
+}
+
+
+void XeoSmartHomeDevice :: _setLedColor(CRGB color){
+	this->_leds[0] = color;
+	FastLED.show();
+}
+
+
+void XeoSmartHomeDevice :: _setColorSignal(XeoSmartHomeInternals::ColorSignal signal){
+	const uint32_t * color_vector;
+	uint16 size;
+	uint16 miliseconds;
+	switch(signal){
+	case XeoSmartHomeInternals::COLOR_SIGNAL_SETTINGS:
+		color_vector = XeoSmartHomeColorCodes::SETTINGS_COLORS;
+		size = sizeof(XeoSmartHomeColorCodes::SETTINGS_COLORS);
+		miliseconds = XeoSmartHomeColorCodes::SETTINGS_INTERVAL;
+		break;
+	default:
+		color_vector = XeoSmartHomeColorCodes::WIFI_NOT_CONNECTED;
+		size = sizeof(XeoSmartHomeColorCodes::WIFI_NOT_CONNECTED);
+		miliseconds = XeoSmartHomeColorCodes::WITI_NOT_CONNECTED_INTERVAL;
+		break;
+	}
+
+	this->_colors_vector_index = 0;
+	this->_colors_vector_len = size / sizeof(uint32_t);
+	this->_ledTask.setInterval(miliseconds);
+	this->_ledTask.setIterations(TASK_FOREVER);
+	
+	for(uint8 i = 0; i < this->_colors_vector_len; i++){
+		this->_colors_vector[i] = CRGB(pgm_read_dword(&color_vector[i]));
+	}
+	
+	this->_ledTask.setCallback([this](){
+		this->_setLedColor(this->_colors_vector[this->_colors_vector_index++]);
+		this->_colors_vector_index = this->_colors_vector_index % this->_colors_vector_len;
+	});
+
+	this->_ledTask.enable();
+}
+
+//</LED>
+
+#endif
@@ -0,0 +1,346 @@
+#include "XeoSmartHomeDevice.h"
+
+
+// <MQTT>
+
+void XeoSmartHomeDevice :: _initMqttClient() {
+	snprintf_P(this->_mqttTopicPrefix, sizeof(this->_mqttTopicPrefix), PSTR("device/%s/"), this->_serial);
+	this->_topic(this->_mqttPresenceTopic, PSTR("presence"));
+
+	this->_mqttClient->setServer(XEOSMARTHOME_SERVER, MQTT_PORT);
+	this->_mqttClient->setClientId(this->_serial);
+	this->_mqttClient->setKeepAlive(MQTT_KEEP_ALIVE);
+	this->_mqttClient->setWill(this->_mqttPresenceTopic, 1, true, MQTT_PRESENCE_OFFLINE);
+	if(this->_dutyCycle.isEnabled())
+		this->_mqttClient->setCleanSession(false); // broker keeps actions sent while the device sleeps
+	this->_mqttClient->onMessage([this](char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+		this->_dutyCycle.onActivity(millis());
+		this->_onMqttMessage(topic, payload, properties, len, index, total);
+	});
+	this->_mqttClient->onPublish([this](uint16_t packetId){
+		// PUBACK for QoS 1, PUBCOMP for QoS 2
+		if(this->_mqttUnacked > 0)
+			this->_mqttUnacked--;
+		this->_dutyCycle.onActivity(millis());
+	});
+	this->_mqttClient->onConnect([this](bool sessionPresent){
+		this->_mqttUnacked = 0;
+		this->_onMqttConnected(sessionPresent);
+	});
+	this->_mqttClient->onDisconnect([this](AsyncMqttClientDisconnectReason reason){
+		this->_mqttUnacked = 0; // acknowledgements of this connection will not come
+		this->_mqttHealthTimer.disable();
+	});
+
+	this->_taskScheduler.addTask(this->_mqttHealthTimer);
+	this->_mqttHealthTimer.setCallback([this](){
+		this->_sendHealthReport();
+	});
+}
+
+
+void XeoSmartHomeDevice :: _startMqttClient(){
+	this->_mqttClient->connect();
+}
+
+
+void XeoSmartHomeDevice :: _stopMqttClient(){
+	this->_mqttClient->disconnect();
+}
+
+
+uint16_t XeoSmartHomeDevice :: _publish(const char * topic, uint8_t qos, bool retain, const char * payload, size_t len){
+	uint16_t packet_id = this->_mqttClient->publish(topic, qos, retain, payload, len);
+	if(qos > 0 and packet_id != 0)
+		this->_mqttUnacked++;
+	return packet_id;
+}
+
+
+void XeoSmartHomeDevice :: _sendHealthReport(){
+	if(not this->_mqttClient->connected())
+		return;
+
+	XEO_LOG_DEBUG("MQTT sending health report");
+
+	char payload[128];
+	snprintf(payload, sizeof(payload), "{\"uptime\":%lu,\"heap\":%u,\"rssi\":%d,\"resets\":%u,\"stalls\":%u}", millis() / 1000, ESP.getFreeHeap(), WiFi.RSSI(), this->_snapshot.reset_count, this->_watchdog.getStallCount());
+
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	this->_publish(this->_topic(topic, PSTR("health")), 0, false, payload);
+}
+
+
+void XeoSmartHomeDevice :: _onMqttConnected(bool sessionPresent){
+	XEO_LOG_INFO("MQTT connected");
+	this->_confirmConfig();
+
+	// only the topics with a handler, a device/<serial>/# subscription would echo every publication of the device
+	this->_topicRouter.forEachPattern([this](const char * pattern){
+		char topic[MQTT_TOPIC_MAX_LENGTH];
+		strlcpy(topic, this->_mqttTopicPrefix, sizeof(topic));
+		strncat(topic, pattern, sizeof(topic) - strlen(topic) - 1);
+		this->_mqttClient->subscribe(topic, 2);
+	});
+
+	// retained, overwritten by the last will when the broker loses the connection
+	this->_publish(this->_mqttPresenceTopic, 1, true, MQTT_PRESENCE_ONLINE);
+
+	this->_stateRequested = true; // sent from loop()
+	this->_sendPendingSensorValues();
+	this->_flushTelemetry(); // windows batched while disconnected
+
+	if(not this->_watchdogResetReported and this->_watchdog.getResetRecord().activity != XeoSmartHomeInternals::ACTIVITY_NONE){
+		this->_sendWatchdogReport(true);
+		this->_watchdogResetReported = true;
+	}
+
+	if(this->_healthReportInterval > 0)
+		this->_mqttHealthTimer.enableIfNot();
+}
+
+
+void XeoSmartHomeDevice :: _onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+
+	XEO_LOG_DEBUG("MQTT message received, topic: %s, payload: %.*s", topic, (int) std::min<size_t>(len, 64), payload);
+
+	size_t prefix_len = strlen(this->_mqttTopicPrefix);
+	if(strncmp(topic, this->_mqttTopicPrefix, prefix_len) != 0)
+		return;
+
+	// only the router's patterns are subscribed, see _onMqttConnected()
+	this->_topicRouter.route(topic + prefix_len, payload, len, index, total);
+}
+
+
+const char * XeoSmartHomeDevice :: _topic(char * buffer, PGM_P suffix, const char * name, PGM_P name_suffix){
+	// topic fragments stay in flash, only the device prefix is in RAM
+	strlcpy(buffer, this->_mqttTopicPrefix, MQTT_TOPIC_MAX_LENGTH);
+	strncat_P(buffer, suffix, MQTT_TOPIC_MAX_LENGTH - strlen(buffer) - 1);
+	if(name != nullptr)
+		strncat(buffer, name, MQTT_TOPIC_MAX_LENGTH - strlen(buffer) - 1);
+	if(name_suffix != nullptr)
+		strncat_P(buffer, name_suffix, MQTT_TOPIC_MAX_LENGTH - strlen(buffer) - 1);
+	return buffer;
+}
+
+// </MQTT>
+// <TOPIC-ROUTER>
+
+void XeoSmartHomeDevice :: _initTopicRouter(){
+	this->_topicRouter.add("action", [this](char * payload, size_t len, size_t index, size_t total){
+		if(index == 0 and len == total)
+			this->_onSignedAction(payload, len, XeoSmartHomeInternals::WIRE_FORMAT_JSON);
+	});
+	this->_topicRouter.add("action/msgpack", [this](char * payload, size_t len, size_t index, size_t total){
+		if(index == 0 and len == total)
+			this->_onSignedAction(payload, len, XeoSmartHomeInternals::WIRE_FORMAT_MSGPACK);
+	});
+#if XEO_FEATURE_CRON
+	this->_topicRouter.add("schedule_update", [this](char * payload, size_t len, size_t index, size_t total){
+		if(index == 0 and len == total)
+			this->_onSceduleUpdate(payload, len);
+	});
+#endif
+	this->_topicRouter.add("get_state", [this](char * payload, size_t len, size_t index, size_t total){
+		this->_stateRequested = true;
+	});
+	this->_topicRouter.add("config", [this](char * payload, size_t len, size_t index, size_t total){
+		if(index == 0 and len == total)
+			this->_onConfigPatch(payload, len);
+	});
+	this->_topicRouter.add("ota", [this](char * payload, size_t len, size_t index, size_t total){
+		if(index == 0 and len == total)
+			this->_onOtaManifest(payload, len);
+	});
+	this->_topicRouter.add("ota/chunk", [this](char * payload, size_t len, size_t index, size_t total){
+		this->_onOtaChunk(payload, len, index, total);
+	});
+}
+
+// </TOPIC-ROUTER>
+// <TELEMETRY>
+
+void XeoSmartHomeDevice :: _initTelemetry(){
+	this->_taskScheduler.addTask(this->_telemetryTimer);
+	this->_telemetryTimer.setInterval(TELEMETRY_BATCH_INTERVAL);
+	this->_telemetryTimer.setIterations(TASK_FOREVER);
+	this->_telemetryTimer.setCallback([this](){
+		this->_flushTelemetry();
+	});
+	this->_telemetryTimer.enable();
+}
+
+
+bool XeoSmartHomeDevice :: _flushTelemetry(){
+	if(this->_telemetryBatch.size() == 0)
+		return true;
+
+	// without a connection the batch waits for the next flush, new values are dropped once it is full
+	if(not this->_mqttClient->connected())
+		return false;
+
+	uint8_t buffer[TELEMETRY_BATCH_SIZE];
+	size_t len = serializeMsgPack(this->_telemetryBatch, buffer, sizeof(buffer));
+
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	if(this->_publish(this->_topic(topic, PSTR("sensors/msgpack")), 1, false, (const char *) buffer, len) == 0)
+		return false; // client send buffer is full
+
+	this->_telemetryBatch.clear();
+	return true;
+}
+
+// </TELEMETRY>
+// <SENSORS>
+
+void XeoSmartHomeDevice :: _initSensors(){
+	if(this->_dutyCycle.isEnabled())
+		return; // sensors are read once per wake by _sendDutyCycleReadings()
+
+	size_t sensors_count = this->_sensors.size();
+	for(size_t i = 0; i < sensors_count; i++){
+		XeoSmartHomeInternals::Sensor * sensor = this->_sensors[i];
+
+		this->_taskScheduler.addTask(sensor->task);
+		sensor->task.setInterval(sensor->sample_period);
+		sensor->task.setIterations(TASK_FOREVER);
+		sensor->task.setCallback([this, sensor, i](){
+			XeoSmartHomeInternals::WatchdogScope watchdog_scope(this->_watchdog, XeoSmartHomeInternals::ACTIVITY_SENSOR, i);
+			this->_sampleSensor(*sensor);
+		});
+		// spread first readings over the sample period so sensors do not wake up in the same tick
+		sensor->task.enableDelayed(sensor->sample_period * i / sensors_count);
+	}
+}
+
+
+void XeoSmartHomeDevice :: _sampleSensor(XeoSmartHomeInternals::Sensor & sensor){
+	float reading = sensor.read();
+	if(sensor.count == 0){
+		sensor.min = sensor.max = reading;
+		sensor.sum = 0;
+	}
+	sensor.min = std::min(sensor.min, reading);
+	sensor.max = std::max(sensor.max, reading);
+	sensor.sum += reading;
+	sensor.last = reading;
+	sensor.count++;
+
+	if(sensor.count >= sensor.window_samples){
+		this->_sendSensorWindow(sensor);
+		sensor.count = 0;
+	}
+}
+
+
+void XeoSmartHomeDevice :: _sendSensorWindow(XeoSmartHomeInternals::Sensor & sensor){
+	float mean = sensor.sum / sensor.count;
+
+	if(this->_wireFormat == XeoSmartHomeInternals::WIRE_FORMAT_MSGPACK){
+		// keep room for a new key, its array, the window object and the key copy
+		if(this->_telemetryBatch.memoryUsage() + JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(5) + strlen(sensor.name) + 8 > this->_telemetryBatch.capacity() and not this->_flushTelemetry()){
+			XEO_LOG_DEBUG("Telemetry batch full, %s window dropped", sensor.name);
+			return;
+		}
+
+		// windows of a sensor are appended to one array, several are batched while disconnected; the char array
+		// key is copied into the document once
+		char key[SENSOR_NAME_MAX_LENGTH + 8];
+		snprintf_P(key, sizeof(key), PSTR("%s/window"), sensor.name);
+		JsonArray windows = this->_telemetryBatch[key].as<JsonArray>();
+		if(windows.isNull())
+			windows = this->_telemetryBatch.createNestedArray(key);
+
+		JsonObject window = windows.createNestedObject();
+		window["min"] = sensor.min;
+		window["max"] = sensor.max;
+		window["mean"] = mean;
+		window["last"] = sensor.last;
+		window["n"] = sensor.count;
+		return;
+	}
+
+	if(not this->_mqttClient->connected())
+		return;
+
+	char payload[128];
+	char min[16], max[16], mean_text[16], last[16];
+	snprintf(payload, sizeof(payload), "{\"min\":%s,\"max\":%s,\"mean\":%s,\"last\":%s,\"n\":%u}",
+		formatReading(min, sizeof(min), sensor.min), formatReading(max, sizeof(max), sensor.max), formatReading(mean_text, sizeof(mean_text), mean),
+		formatReading(last, sizeof(last), sensor.last), sensor.count);
+
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	this->_publish(this->_topic(topic, PSTR("sensor/"), sensor.name, PSTR("/window")), 1, false, payload);
+}
+
+// </SENSORS>
+// <STATE-SHADOW>
+
+XeoSmartHomeInternals::StatusEntry * XeoSmartHomeDevice :: _getStatusEntry(const char * status){
+	for(uint8_t i = 0; i < this->_statusCount; i++){
+		if(strcmp(this->_statusTable[i].key, status) == 0)
+			return &this->_statusTable[i];
+	}
+
+	if(this->_statusCount == STATUS_TABLE_SIZE or strlen(status) >= STATUS_KEY_MAX_LENGTH)
+		return nullptr;
+
+	XeoSmartHomeInternals::StatusEntry * entry = &this->_statusTable[this->_statusCount++];
+	strcpy(entry->key, status);
+	entry->value = 0;
+	entry->dirty = false;
+	entry->updated_at = 0;
+	return entry;
+}
+
+
+void XeoSmartHomeDevice :: _sendState(){
+	if(not this->_mqttClient->connected())
+		return;
+
+	// keys point into the status table, nothing is copied
+	StaticJsonDocument<STATE_DOCUMENT_SIZE> doc;
+	doc["ts"] = this->_timeService.now();
+	JsonObject statuses = doc.createNestedObject("status");
+	for(uint8_t i = 0; i < this->_statusCount; i++)
+		statuses[(const char *) this->_statusTable[i].key] = this->_statusTable[i].value;
+
+	// a truncated snapshot would stay retained, it is not sent
+	bool msgpack = this->_wireFormat == XeoSmartHomeInternals::WIRE_FORMAT_MSGPACK;
+	char payload[STATE_PAYLOAD_SIZE];
+	size_t needed = msgpack ? measureMsgPack(doc) : measureJson(doc) + 1;
+	if(doc.overflowed() or needed > sizeof(payload)){
+		XEO_LOG_ERROR("State does not fit: %u bytes", (unsigned) needed);
+		return;
+	}
+
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	size_t len;
+	if(msgpack){
+		len = serializeMsgPack(doc, payload, sizeof(payload));
+		this->_topic(topic, PSTR("state/msgpack"));
+	} else {
+		len = serializeJson(doc, payload, sizeof(payload));
+		this->_topic(topic, PSTR("state"));
+	}
+
+	this->_publish(topic, 1, true, payload, len);
+	for(uint8_t i = 0; i < this->_statusCount; i++)
+		this->_statusTable[i].dirty = false;
+}
+
+
+
+void XeoSmartHomeDevice :: _sendLogs(){
+	if(not this->_mqttClient->connected())
+		return;
+
+	std::unique_ptr<char[]> logs(new char[LOG_BUFFER_SIZE + 1]);
+	size_t len = XeoSmartHomeInternals::logger.copyTo(logs.get(), LOG_BUFFER_SIZE + 1);
+
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	this->_publish(this->_topic(topic, PSTR("logs")), 0, false, logs.get(), len);
+}
+
+// </STATE-SHADOW>
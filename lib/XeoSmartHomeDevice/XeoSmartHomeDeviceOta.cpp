@@ -0,0 +1,116 @@
+#include "XeoSmartHomeDevice.h"
+
+
+// <OTA>
+
+void XeoSmartHomeDevice :: _initOta(){
+	// the image signature uses the device key, like the manifest
+	this->_otaUpdater.onVerify([this](const uint8_t * data, size_t len, const uint8_t * mac){
+		return this->_actionAuthenticator.verify(data, len, mac);
+	});
+	this->_otaUpdater.restore();
+}
+
+
+void XeoSmartHomeDevice :: _onOtaManifest(char * message, size_t len){
+	// without the device key anyone on the broker could flash the device
+	if(not this->_actionAuthenticator.hasKey()){
+		XEO_LOG_WARNING("OTA refused, the device key is not set");
+		return;
+	}
+
+	len = this->_actionAuthenticator.verifyJwt(message, len);
+	if(len == 0){
+		XEO_LOG_WARNING("OTA manifest signature is not valid");
+		return;
+	}
+
+	StaticJsonDocument<JSON_OBJECT_SIZE(10)> doc;
+	if(deserializeJson(doc, message, len)){
+		XEO_LOG_WARNING("OTA manifest decode failed");
+		return;
+	}
+	if(not this->_checkSignedClaims(doc))
+		return; // an old manifest could downgrade the firmware
+
+	XeoSmartHomeInternals::OtaManifest manifest;
+	strlcpy(manifest.version, doc["version"] | "", sizeof(manifest.version));
+	strlcpy(manifest.url, doc["url"] | "", sizeof(manifest.url));
+	manifest.size = doc["size"].as<uint32_t>();
+	manifest.not_before = doc["not_before"].as<uint32_t>();
+	manifest.not_after = doc["not_after"].as<uint32_t>();
+
+	const char * sha256 = doc["sha256"] | "";
+	const char * signature = doc["sig"] | "";
+	if(hexToBytes(sha256, manifest.sha256, sizeof(manifest.sha256)) != sizeof(manifest.sha256) or hexToBytes(signature, manifest.signature, sizeof(manifest.signature)) != sizeof(manifest.signature) or (manifest.url[0] != '\0' and strncmp(manifest.url, "http://", 7) != 0)){
+		XEO_LOG_WARNING("OTA manifest is not valid");
+		return;
+	}
+
+	XEO_LOG_INFO("OTA %s: %u bytes", manifest.version, manifest.size);
+	this->_otaUpdater.begin(manifest);
+	this->_sendOtaStatus();
+}
+
+
+void XeoSmartHomeDevice :: _onOtaChunk(char * payload, size_t len, size_t index, size_t total){
+	if(index == 0){
+		if(len < 4)
+			return;
+		this->_otaChunkOffset = XeoSmartHomeInternals::readUint32((const uint8_t *) payload);
+		this->_otaUpdater.write(this->_otaChunkOffset, (const uint8_t *) payload + 4, len - 4);
+	} else {
+		this->_otaUpdater.write(this->_otaChunkOffset + index - 4, (const uint8_t *) payload, len);
+	}
+
+	// the status acknowledges the chunk, the sender waits for it before sending the next one
+	if(index + len == total)
+		this->_sendOtaStatus();
+}
+
+
+void XeoSmartHomeDevice :: _runOta(){
+	XeoSmartHomeInternals::WatchdogScope watchdog_scope(this->_watchdog, XeoSmartHomeInternals::ACTIVITY_OTA);
+	this->_saveActionCounter(); // before an accepted manifest is installed
+	this->_otaUpdater.loop(this->now(), this->_timeService.getSyncState() != XeoSmartHomeInternals::TIME_NOT_SET);
+
+	XeoSmartHomeInternals::OtaState state = this->_otaUpdater.getState();
+	bool downloading = state == XeoSmartHomeInternals::OTA_RECEIVING and this->_otaUpdater.getManifest().url[0] != '\0';
+	if(state != this->_otaReportedState or (downloading and millis() - this->_otaReportedAt >= OTA_STATUS_INTERVAL))
+		this->_sendOtaStatus();
+
+	if(state != XeoSmartHomeInternals::OTA_DONE or this->_rebootPhase != XeoSmartHomeInternals::REBOOT_NONE)
+		return;
+
+	// the final status was sent above, it leaves before the reboot
+	XEO_LOG_INFO("OTA %s verified, rebooting", this->_otaUpdater.getManifest().version);
+	this->requestReboot("ota");
+}
+
+
+namespace XeoSmartHomeOta {
+	// indexed by OtaState
+	const char STATES[][10] PROGMEM = {"idle", "scheduled", "receiving", "done", "failed"};
+	static_assert(sizeof(STATES) / sizeof(STATES[0]) == XeoSmartHomeInternals::OTA_FAILED + 1, "an OTA state has no name");
+};
+
+
+void XeoSmartHomeDevice :: _sendOtaStatus(){
+	XeoSmartHomeInternals::OtaState state = this->_otaUpdater.getState();
+	this->_otaReportedState = state;
+	this->_otaReportedAt = millis();
+
+	if(not this->_mqttClient->connected())
+		return;
+
+	char state_name[sizeof(XeoSmartHomeOta::STATES[0])];
+	strlcpy_P(state_name, XeoSmartHomeOta::STATES[state], sizeof(state_name));
+
+	char payload[160];
+	snprintf_P(payload, sizeof(payload), PSTR("{\"state\":\"%s\",\"version\":\"%s\",\"offset\":%u,\"error\":\"%s\"}"), state_name, this->_otaUpdater.getManifest().version, this->_otaUpdater.getOffset(), this->_otaUpdater.getError());
+
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	this->_publish(this->_topic(topic, PSTR("ota/status")), 1, false, payload);
+}
+
+// </OTA>
@@ -0,0 +1,208 @@
+#include "XeoSmartHomeDevice.h"
+
+
+namespace XeoSmartHomeConfigSchema {
+	enum FieldType : uint8_t {
+		FIELD_STRING,
+		FIELD_BOOL,
+		FIELD_IPV4 // dotted quad string
+	};
+
+	// order of FIELDS
+	enum FieldId : uint8_t {
+		FIELD_NAME,
+		FIELD_DHCP,
+		FIELD_LOCAL_IP,
+		FIELD_GATEWAY,
+		FIELD_SUBNET
+	};
+
+	struct Field {
+		char key[12];
+		FieldType type;
+		uint8_t max_length; // string fields, terminator included
+		bool restart; // applied at boot, a change needs a reboot
+	};
+
+	// copied to RAM one entry at a time; the device key is not listed, it is only set from the config portal
+	const Field FIELDS[] PROGMEM = {
+		{"name", FIELD_STRING, WL_SSID_MAX_LENGTH, true}, // host name and access point name
+		{"dhcp", FIELD_BOOL, 0, true},
+		{"local_ip", FIELD_IPV4, 0, true},
+		{"gateway", FIELD_IPV4, 0, true},
+		{"subnet", FIELD_IPV4, 0, true}
+	};
+
+	/*
+	* @param key: patch key
+	* @param field: output, schema entry of key
+	* @return index of key in FIELDS, -1 if key is not in the schema
+	*/
+	int findField(const char * key, Field & field){
+		for(size_t i = 0; i < sizeof(FIELDS) / sizeof(Field); i++){
+			if(strcmp_P(key, FIELDS[i].key) == 0){
+				memcpy_P(&field, &FIELDS[i], sizeof(field));
+				return i;
+			}
+		}
+		return -1;
+	}
+};
+
+
+// <REMOTE-CONFIG>
+
+void XeoSmartHomeDevice :: _onConfigPatch(char * message, size_t len){
+	// network settings can cut the device off, only the app that holds the key may change them
+	if(not this->_actionAuthenticator.hasKey()){
+		XEO_LOG_WARNING("Config patch rejected, the device key is not set");
+		this->_sendConfigStatus("rejected", "key");
+		return;
+	}
+
+	len = this->_actionAuthenticator.verifyJwt(message, len);
+	if(len == 0){
+		XEO_LOG_WARNING("Config patch signature is not valid");
+		this->_sendConfigStatus("rejected", "signature");
+		return;
+	}
+
+	// larger patches do not fit and are rejected as a whole
+	StaticJsonDocument<JSON_OBJECT_SIZE(CONFIG_PATCH_MAX_FIELDS)> doc;
+	if(deserializeJson(doc, message, len) or not doc.is<JsonObject>()){
+		XEO_LOG_WARNING("Config patch decode failed");
+		this->_sendConfigStatus("rejected", "decode");
+		return;
+	}
+	if(not this->_checkSignedClaims(doc)){
+		this->_sendConfigStatus("rejected", "claims");
+		return;
+	}
+	this->_saveActionCounter(); // patches are applied here, not from loop()
+
+	// every field is checked against the schema into a copy, a rejected patch changes nothing
+	XeoSmartHomeInternals::Settings settings = this->_settings;
+	char name[sizeof(this->_name)];
+	strlcpy(name, this->_name, sizeof(name));
+	uint8_t changed = 0;
+	bool restart = false;
+
+	for(JsonPair pair : doc.as<JsonObject>()){
+		const char * key = pair.key().c_str();
+		if(strcmp_P(key, PSTR("exp")) == 0 or strcmp_P(key, PSTR("ctr")) == 0)
+			continue;
+
+		XeoSmartHomeConfigSchema::Field field;
+		int id = XeoSmartHomeConfigSchema::findField(key, field);
+		JsonVariant value = pair.value();
+		bool valid = id >= 0;
+		bool field_changed = false;
+
+		if(valid and field.type == XeoSmartHomeConfigSchema::FIELD_STRING){
+			const char * string = value.as<const char *>();
+			valid = value.is<const char *>() and string[0] != '\0' and strlen(string) < field.max_length;
+			if(valid){
+				field_changed = strcmp(name, string) != 0;
+				strlcpy(name, string, sizeof(name));
+			}
+		} else if(valid and field.type == XeoSmartHomeConfigSchema::FIELD_BOOL){
+			valid = value.is<bool>();
+			if(valid){
+				field_changed = settings.dhcp != value.as<bool>();
+				settings.dhcp = value.as<bool>();
+			}
+		} else if(valid){
+			IPAddress address;
+			valid = value.is<const char *>() and address.fromString(value.as<const char *>());
+			IPAddress & target = id == XeoSmartHomeConfigSchema::FIELD_LOCAL_IP ? settings.local_ip : id == XeoSmartHomeConfigSchema::FIELD_GATEWAY ? settings.gateway : settings.subnet_mask;
+			if(valid){
+				field_changed = (uint32_t) target != (uint32_t) address;
+				target = address;
+			}
+		}
+
+		if(not valid){
+			XEO_LOG_WARNING("Config patch rejected: %s", key);
+			this->_sendConfigStatus("rejected", id >= 0 ? key : "unknown");
+			return;
+		}
+		if(field_changed){
+			changed++;
+			restart = restart or field.restart;
+		}
+	}
+
+	// a static address is only usable when the patch leaves it complete, with a reachable gateway
+	if(not settings.dhcp){
+		const char * invalid = nullptr;
+		uint32_t mask = settings.subnet_mask;
+		if(not settings.local_ip.isSet())
+			invalid = "local_ip";
+		else if(not settings.subnet_mask.isSet())
+			invalid = "subnet";
+		else if(not settings.gateway.isSet() or settings.gateway == settings.local_ip or ((uint32_t) settings.gateway & mask) != ((uint32_t) settings.local_ip & mask))
+			invalid = "gateway";
+		if(invalid != nullptr){
+			XEO_LOG_WARNING("Config patch rejected: static address, %s", invalid);
+			this->_sendConfigStatus("rejected", invalid);
+			return;
+		}
+	}
+
+	if(changed > 0){
+		// the first patch before a reboot keeps the settings that are known to work
+		if(restart and not SPIFFS.exists(CONFIG_PREVIOUS_FILE))
+			SPIFFS.rename(SETTINGS_FILE, CONFIG_PREVIOUS_FILE);
+		this->_settings = settings;
+		strlcpy(this->_name, name, sizeof(this->_name));
+		this->_saveSettings();
+		XEO_LOG_INFO("Config patch applied: %u changes", changed);
+	}
+	this->_sendConfigStatus("applied", nullptr, changed, restart);
+
+	// patches received until the reboot starts share it
+	if(restart)
+		this->requestReboot("config");
+}
+
+
+void XeoSmartHomeDevice :: _runConfigRollback(bool sleeping){
+	// in config mode the user is fixing the settings on the portal
+	if(not this->_configTrial or this->_config_mode or (not sleeping and millis() < CONFIG_ROLLBACK_TIMEOUT))
+		return;
+
+	// patched settings did not bring MQTT up, e.g. a wrong static address; the previous ones did
+	XEO_LOG_WARNING("MQTT did not connect with the patched settings, restoring the previous ones");
+	this->_configTrial = false;
+	SPIFFS.remove(SETTINGS_FILE);
+	SPIFFS.rename(CONFIG_PREVIOUS_FILE, SETTINGS_FILE);
+	if(not sleeping)
+		this->requestReboot("config rollback"); // the next wake loads them otherwise
+}
+
+
+void XeoSmartHomeDevice :: _confirmConfig(){
+	if(not this->_configTrial)
+		return;
+
+	this->_configTrial = false;
+	SPIFFS.remove(CONFIG_PREVIOUS_FILE);
+	XEO_LOG_INFO("Patched settings confirmed");
+}
+
+
+void XeoSmartHomeDevice :: _sendConfigStatus(const char * status, const char * field, uint8_t changed, bool reboot){
+	if(not this->_mqttClient->connected())
+		return;
+
+	char payload[96];
+	if(field != nullptr)
+		snprintf_P(payload, sizeof(payload), PSTR("{\"status\":\"%s\",\"field\":\"%.24s\"}"), status, field);
+	else
+		snprintf_P(payload, sizeof(payload), PSTR("{\"status\":\"%s\",\"changed\":%u,\"reboot\":%s}"), status, changed, reboot ? "true" : "false");
+
+	char topic[MQTT_TOPIC_MAX_LENGTH];
+	this->_publish(this->_topic(topic, PSTR("config/status")), 1, false, payload);
+}
+
+// </REMOTE-CONFIG>
@@ -6,12 +6,12 @@
 XeoSmartHomeDevice MyDevice;
 
 //SoftwareSerial ArduinoMega(D6, D7);
+//UartBridge ArduinoBridge(ArduinoMega, 9600);
 
 
 int c = 0;
 void buttonPressed(){
-	Serial.print("button pressed: ");
-	Serial.println(c++);
+	XEO_LOG_INFO("button pressed: %d", c++);
 
 	//MyDevice.sendSensorData("temperature", 5.6);
 
@@ -22,59 +22,11 @@ void buttonPressed(){
 }
 
 void openWindow1(JsonArray parametes){
-	Serial.println("a");
+	XEO_LOG_INFO("open window 1");
 }
-/*
-
-
-void openWindow2(JsonArray parametes){
-	ArduinoMega.write("b");
-}
-
-void openWindow3(JsonArray parametes){
-	ArduinoMega.write("c");
-}
-
-void openWindow4(JsonArray parametes){
-	ArduinoMega.write("d");
-}
-
-void openWindow5(JsonArray parametes){
-	ArduinoMega.write("e");
-}
-
-void openWindow6(JsonArray parametes){
-	ArduinoMega.write("f");
-}
-
-
-void closeWindow1(JsonArray parametes){
-	ArduinoMega.write("g");
-}
-
-void closeWindow2(JsonArray parametes){
-	ArduinoMega.write("h");
-}
-
-void closeWindow3(JsonArray parametes){
-	ArduinoMega.write("i");
-}
-
-void closeWindow4(JsonArray parametes){
-	ArduinoMega.write("j");
-}
-
-void closeWindow5(JsonArray parametes){
-	ArduinoMega.write("k");
-}
-
-void closeWindow6(JsonArray parametes){
-	ArduinoMega.write("l");
-}
-*/
 
 void onStopAll(JsonArray paremeters){
-	Serial.println("Stop all triggered");
+	XEO_LOG_INFO("Stop all triggered");
 
 	digitalWrite(D2, !digitalRead(D2));
 
@@ -84,6 +36,14 @@ void onStopAll(JsonArray paremeters){
 	MyDevice.sendStatusUpdate("valve_4", random8(0, 2));
 }
 
+void setValve(int valve, bool open){
+	digitalWrite(D2, open);
+
+	char status[16];
+	snprintf(status, sizeof(status), "valve_%d", valve);
+	MyDevice.sendStatusUpdate(status, open);
+}
+
 
 void setup() {
 	Serial.begin(115200);
@@ -93,32 +53,38 @@ void setup() {
 	MyDevice.setOnButtonPressHandler(buttonPressed);
 
 	MyDevice.addActionHandler("open_window_1", openWindow1);
-	MyDevice.addActionHandler("stop_all", onStopAll);
-	/*MyDevice.addActionHandler("open_window_1", openWindow1);
-	MyDevice.addActionHandler("open_window_2", openWindow2);
-	MyDevice.addActionHandler("open_window_3", openWindow3);
-	MyDevice.addActionHandler("open_window_4", openWindow4);
-	MyDevice.addActionHandler("open_window_5", openWindow5);
-	MyDevice.addActionHandler("open_window_6", openWindow6);
-
-	MyDevice.addActionHandler("close_window_1", closeWindow1);
-	MyDevice.addActionHandler("close_window_2", closeWindow2);
-	MyDevice.addActionHandler("close_window_3", closeWindow3);
-	MyDevice.addActionHandler("close_window_4", closeWindow4);
-	MyDevice.addActionHandler("close_window_5", closeWindow5);
-	MyDevice.addActionHandler("close_window_6", closeWindow6);*/
+	XeoSmartHomeInternals::ActionPolicy stop_all_policy;
+	stop_all_policy.rate = 1; // at most one stop per second
+	stop_all_policy.burst = 2;
+	stop_all_policy.duplicate_window = 1000;
+	MyDevice.addActionHandler("stop_all", onStopAll, stop_all_policy);
+	MyDevice.addActionHandler<int, bool>("set_valve", setValve);
+	// window motors are driven by the Arduino Mega, commands are forwarded over the UART bridge
+	/*MyDevice.addBridgeActionHandler("open_window_1", ArduinoBridge, 'a');
+	MyDevice.addBridgeActionHandler("open_window_2", ArduinoBridge, 'b');
+	MyDevice.addBridgeActionHandler("open_window_3", ArduinoBridge, 'c');
+	MyDevice.addBridgeActionHandler("open_window_4", ArduinoBridge, 'd');
+	MyDevice.addBridgeActionHandler("open_window_5", ArduinoBridge, 'e');
+	MyDevice.addBridgeActionHandler("open_window_6", ArduinoBridge, 'f');
+
+	MyDevice.addBridgeActionHandler("close_window_1", ArduinoBridge, 'g');
+	MyDevice.addBridgeActionHandler("close_window_2", ArduinoBridge, 'h');
+	MyDevice.addBridgeActionHandler("close_window_3", ArduinoBridge, 'i');
+	MyDevice.addBridgeActionHandler("close_window_4", ArduinoBridge, 'j');
+	MyDevice.addBridgeActionHandler("close_window_5", ArduinoBridge, 'k');
+	MyDevice.addBridgeActionHandler("close_window_6", ArduinoBridge, 'l');*/
+
+	// sample every 5 seconds, send min/max/mean/last once a minute
+	MyDevice.addSensor("temperature", [](){
+		return (float) random16(0, 30);
+	}, 5 * 1000, 60 * 1000);
 
 	MyDevice.setDebug(true);
+	MyDevice.setHealthReportInterval(15 * 60);
 
 	MyDevice.init();
 	
 	//ArduinoMega.begin(9600);
-	Cron.create("0 * * * * *", [](){
-		//Cron.getTriggeredCronId();
-		//time_t now = time(nullptr);
- 		Serial.println("Send sensor data");
-		MyDevice.sendSensorData("temperature", random16(0, 30));
-	}, false);
 
 }
 
@@ -0,0 +1,89 @@
+#pragma once
+
+// Stream over one end of a pseudo terminal, paced like a UART
+// A pty moves bytes as fast as the kernel copies them, so bytes leave this stream at the configured baud rate,
+// 10 bits per byte, and write() blocks while more than UART_FIFO_SIZE bytes wait, like HardwareSerial on the ESP8266.
+
+#include <Arduino.h>
+#include <chrono>
+#include <deque>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+#define UART_FIFO_SIZE 128 // bytes, ESP8266 hardware transmit FIFO
+
+
+class PtyStream : public Stream {
+	public:
+		PtyStream(int fd, uint32_t baud) : _fd(fd), _byteTime(10000000 / baud) {
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		}
+
+		int available() override {
+			this->pump();
+			uint8_t buffer[256];
+			ssize_t len = ::read(this->_fd, buffer, sizeof(buffer));
+			for(ssize_t i = 0; i < len; i++)
+				this->_rx.push_back(buffer[i]);
+			return this->_rx.size();
+		}
+
+		int read() override {
+			if(this->_rx.empty() and this->available() == 0)
+				return -1;
+			uint8_t byte = this->_rx.front();
+			this->_rx.pop_front();
+			return byte;
+		}
+
+		int peek() override {
+			if(this->_rx.empty() and this->available() == 0)
+				return -1;
+			return this->_rx.front();
+		}
+
+		size_t write(uint8_t byte) override {
+			return this->write(&byte, 1);
+		}
+
+		size_t write(const uint8_t * buffer, size_t size) override {
+			for(size_t i = 0; i < size; i++){
+				while(this->_tx.size() >= UART_FIFO_SIZE){
+					this->pump();
+					std::this_thread::sleep_for(std::chrono::microseconds(this->_byteTime / 4));
+				}
+				if(this->_tx.empty())
+					this->_nextByteAt = std::max<uint64_t>(this->_nextByteAt, micros()); // line was idle
+				this->_tx.push_back(buffer[i]);
+			}
+			this->pump();
+			return size;
+		}
+
+		int availableForWrite() override {
+			this->pump();
+			return UART_FIFO_SIZE - this->_tx.size();
+		}
+
+		/*
+		* Hand the bytes whose last bit was sent to the other end
+		*/
+		void pump() {
+			uint64_t now = micros();
+			while(not this->_tx.empty() and this->_nextByteAt + this->_byteTime <= now){
+				uint8_t byte = this->_tx.front();
+				if(::write(this->_fd, &byte, 1) != 1)
+					break;
+				this->_tx.pop_front();
+				this->_nextByteAt += this->_byteTime;
+			}
+		}
+
+	private:
+		int _fd;
+		uint32_t _byteTime; // microseconds
+		uint64_t _nextByteAt = 0; // micros() when the next byte starts
+		std::deque<uint8_t> _tx;
+		std::deque<uint8_t> _rx;
+};
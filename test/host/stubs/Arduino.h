@@ -0,0 +1,120 @@
+#pragma once
+
+// Host stand-in for the ESP8266 Arduino core, only what the library modules built in test/host use.
+// PROGMEM is ordinary memory on the host, so the _P functions are the plain C functions.
+// Time, RTC user memory and the reset reason are controlled by the tests through HostStubs.
+// ESP.getFreeHeap() is HOST_FREE_HEAP less the bytes allocated with new and not deleted yet.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <strings.h>
+#include "user_interface.h"
+
+#define HOST_FREE_HEAP 40000 // bytes, free heap of the device after setup()
+#define HOST_SKETCH_SIZE 0x70000 // bytes, flash used by the running firmware
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define FPSTR(p) (p)
+typedef const char * PGM_P;
+
+#define pgm_read_byte(address) (*(const uint8_t *) (address))
+#define pgm_read_word(address) (*(const uint16_t *) (address))
+#define pgm_read_dword(address) (*(const uint32_t *) (address))
+#define pgm_read_ptr(address) (*(const void * const *) (address))
+
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+void configTime(const char * time_zone, const char * ntp_server);
+
+
+class Print {
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t byte) = 0;
+		virtual size_t write(const uint8_t * buffer, size_t size) {
+			size_t written = 0;
+			while(written < size and this->write(buffer[written]) == 1)
+				written++;
+			return written;
+		}
+		virtual int availableForWrite() {
+			return 0;
+		}
+		virtual void flush() {}
+
+		size_t print(const char * text) {
+			return this->write((const uint8_t *) text, strlen(text));
+		}
+};
+
+
+class Stream : public Print {
+	public:
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+};
+
+
+class EspClass {
+	public:
+		uint32_t random();
+		bool rtcUserMemoryRead(uint32_t offset, uint32_t * data, size_t size);
+		bool rtcUserMemoryWrite(uint32_t offset, uint32_t * data, size_t size);
+		rst_info * getResetInfoPtr();
+		uint32_t getFreeHeap();
+		void restart();
+
+		// flash, in HostOta.cpp
+		bool flashRead(uint32_t address, uint32_t * data, size_t size);
+		uint32_t getFreeSketchSpace();
+};
+
+extern EspClass ESP;
+
+
+// controls for the tests, not part of the Arduino core
+namespace HostStubs {
+	/*
+	* Use simulated time, millis() and micros() only change with advance()
+	* Real time (steady clock since start) is the default
+	*/
+	void useSimulatedTime();
+
+	/*
+	* Advance simulated time, delay() does the same while simulated time is used
+	* @param us: microseconds
+	*/
+	void advance(uint64_t us);
+
+	/*
+	* Simulate a reset, RTC user memory is kept unless reason is REASON_DEFAULT_RST (power on)
+	*/
+	void reset(uint32_t reason);
+
+	uint32_t getRestarts(); // ESP.restart() calls
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+// Host stand-in for ESP8266HTTPClient and WiFiClient over a TCP socket
+// Only plain http://host:port/path urls with a numeric IPv4 host, and GET. The status line and the headers are read
+// by GET(), the body is left in the socket for getStreamPtr(). Nothing is allocated on the heap, so the heap used by
+// the updater is what ESP.getFreeHeap() reports.
+
+#include <Arduino.h>
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_PARTIAL_CONTENT 206
+#define HTTPC_ERROR_CONNECTION_FAILED (-1)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+#define HTTP_CLIENT_TIMEOUT 5000 // miliseconds for the status line and headers
+
+class WiFiClient : public Stream {
+	public:
+		~WiFiClient();
+
+		bool connect(uint32_t address, uint16_t port);
+		void stop();
+
+		/*
+		* @return bytes in the socket, waits up to 1 ms when there are none, like a loop() iteration on the device
+		*/
+		int available() override;
+		int read() override;
+		int peek() override;
+		size_t readBytes(uint8_t * buffer, size_t size);
+		size_t write(uint8_t byte) override;
+		size_t write(const uint8_t * buffer, size_t size) override;
+		uint8_t connected();
+
+	private:
+		int _fd = -1;
+};
+
+
+class HTTPClient {
+	public:
+		bool begin(WiFiClient & client, const char * url);
+		void addHeader(const char * name, const char * value);
+
+		/*
+		* @return status code, a negative HTTPC_ERROR code if there is none
+		*/
+		int GET();
+		WiFiClient * getStreamPtr();
+		void end();
+
+	private:
+		WiFiClient * _client = nullptr;
+		char _host[16] = "";
+		uint32_t _address = 0;
+		uint16_t _port = 80;
+		char _path[128] = "";
+		char _headers[256] = "";
+
+		/*
+		* @return line length without "\r\n", -1 on timeout
+		*/
+		int _readLine(char * line, size_t size);
+};
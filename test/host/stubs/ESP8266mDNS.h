@@ -0,0 +1,21 @@
+#pragma once
+
+// Host stand-in for ESP8266mDNS, nothing is announced
+
+#include <Arduino.h>
+
+class MDNSResponder {
+	public:
+		bool begin(const char * hostname) {
+			return true;
+		}
+		void addService(const char * service, const char * protocol, uint16_t port) {}
+		bool addServiceTxt(const char * service, const char * protocol, const char * key, const char * value) {
+			return true;
+		}
+		bool update() {
+			return true;
+		}
+};
+
+extern MDNSResponder MDNS;
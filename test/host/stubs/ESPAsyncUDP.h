@@ -0,0 +1,66 @@
+#pragma once
+
+// Host stand-in for ESPAsyncUDP over a loopback UDP socket
+// There is no network task on the host: the test calls poll() and packets are handled on its thread. Sockets owned
+// by library classes are found with listening().
+
+#include <Arduino.h>
+#include <functional>
+#include <netinet/in.h>
+
+#define ASYNC_UDP_MAX_PACKET 1472 // bytes, one Ethernet MTU of UDP payload
+
+class AsyncUDPPacket {
+	public:
+		AsyncUDPPacket(int fd, const sockaddr_in & remote, uint8_t * data, size_t len);
+
+		uint8_t * data();
+		size_t length();
+		uint16_t remotePort();
+
+		/*
+		* Answer to the sender
+		*/
+		size_t write(const uint8_t * data, size_t len);
+
+	private:
+		int _fd;
+		sockaddr_in _remote;
+		uint8_t * _data;
+		size_t _len;
+};
+
+
+class AsyncUDP {
+	public:
+		~AsyncUDP();
+
+		/*
+		* Bind to 127.0.0.1
+		* @param port: UDP port, 0 picks a free port, see localPort()
+		*/
+		bool listen(uint16_t port);
+		void onPacket(std::function<void(AsyncUDPPacket & packet)> callback);
+		void close();
+
+		// host only
+		uint16_t localPort();
+
+		/*
+		* @param port: UDP port given to listen()
+		* @return the socket listening on port, nullptr if there is none
+		*/
+		static AsyncUDP * listening(uint16_t port);
+
+		/*
+		* Wait for one packet and give it to the callback
+		* @param timeout: miliseconds
+		* @return false on timeout
+		*/
+		bool poll(int timeout);
+
+	private:
+		int _fd = -1;
+		uint16_t _port = 0;
+		std::function<void(AsyncUDPPacket & packet)> _onPacket;
+};
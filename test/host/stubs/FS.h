@@ -0,0 +1,40 @@
+#pragma once
+
+// Host stand-in for the ESP8266 SPIFFS file system, files are kept in memory and survive simulated resets
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class File {
+	public:
+		File() {}
+		File(std::vector<uint8_t> * data);
+
+		size_t read(uint8_t * buffer, size_t size);
+		size_t write(const uint8_t * buffer, size_t size);
+		void close();
+		operator bool() const;
+
+	private:
+		std::vector<uint8_t> * _data = nullptr;
+		size_t _position = 0;
+};
+
+
+class FS {
+	public:
+		bool exists(const char * path);
+
+		/*
+		* @param mode: "r" or "w", "w" truncates
+		*/
+		File open(const char * path, const char * mode);
+		bool remove(const char * path);
+
+	private:
+		std::map<std::string, std::vector<uint8_t>> _files;
+};
+
+extern FS SPIFFS;
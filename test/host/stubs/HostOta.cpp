@@ -0,0 +1,314 @@
+#include <Arduino.h>
+#include <ESP8266HTTPClient.h>
+#include <FS.h>
+#include <Updater.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+UpdaterClass Update;
+FS SPIFFS;
+
+
+namespace {
+	uint8_t flash[FS_PHYS_ADDR]; // everything below the file system, erased
+	bool flashErased = false;
+
+
+	uint8_t * flashAt(uint32_t address) {
+		if(not flashErased){
+			memset(flash, 0xFF, sizeof(flash));
+			flashErased = true;
+		}
+		return &flash[address];
+	}
+};
+
+
+bool EspClass :: flashRead(uint32_t address, uint32_t * data, size_t size) {
+	if(address + size > FS_PHYS_ADDR)
+		return false;
+	memcpy(data, flashAt(address), size);
+	return true;
+}
+
+
+uint32_t EspClass :: getFreeSketchSpace() {
+	// same as the core: what is left below the file system after the running firmware, sector aligned
+	return (FS_PHYS_ADDR - ((HOST_SKETCH_SIZE + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1))) & ~(FLASH_SECTOR_SIZE - 1);
+}
+
+
+UpdaterClass & UpdaterClass :: runAsync(bool async) {
+	return *this;
+}
+
+
+bool UpdaterClass :: begin(size_t size) {
+	uint32_t rounded_size = (size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+	if(size == 0 or rounded_size > ESP.getFreeSketchSpace())
+		return false;
+
+	delete[] this->_buffer;
+	this->_buffer = new uint8_t[FLASH_SECTOR_SIZE];
+	this->_bufferLen = 0;
+	this->_address = FS_PHYS_ADDR - rounded_size;
+	this->_size = size;
+	this->_written = 0;
+	return true;
+}
+
+
+size_t UpdaterClass :: write(uint8_t * data, size_t len) {
+	if(this->_buffer == nullptr or len > this->_size - this->_written)
+		return 0;
+
+	for(size_t copied = 0; copied < len; ){
+		size_t part = std::min<size_t>(len - copied, FLASH_SECTOR_SIZE - this->_bufferLen);
+		memcpy(&this->_buffer[this->_bufferLen], &data[copied], part);
+		this->_bufferLen += part;
+		copied += part;
+		if(this->_bufferLen == FLASH_SECTOR_SIZE)
+			this->_flush();
+	}
+	this->_written += len;
+	return len;
+}
+
+
+bool UpdaterClass :: end() {
+	if(this->_buffer == nullptr)
+		return false;
+
+	bool complete = this->_written == this->_size;
+	if(complete and this->_bufferLen > 0)
+		this->_flush();
+	delete[] this->_buffer;
+	this->_buffer = nullptr;
+	return complete;
+}
+
+
+void UpdaterClass :: _flush() {
+	// the sector is erased only now, a reset before leaves it as it was
+	memset(flashAt(this->_address), 0xFF, FLASH_SECTOR_SIZE);
+	memcpy(flashAt(this->_address), this->_buffer, this->_bufferLen);
+	this->_address += FLASH_SECTOR_SIZE;
+	this->_bufferLen = 0;
+}
+
+
+File :: File(std::vector<uint8_t> * data) : _data(data) {}
+
+
+size_t File :: read(uint8_t * buffer, size_t size) {
+	if(this->_data == nullptr)
+		return 0;
+	size = std::min(size, this->_data->size() - this->_position);
+	memcpy(buffer, this->_data->data() + this->_position, size);
+	this->_position += size;
+	return size;
+}
+
+
+size_t File :: write(const uint8_t * buffer, size_t size) {
+	if(this->_data == nullptr)
+		return 0;
+	this->_data->insert(this->_data->end(), buffer, buffer + size);
+	return size;
+}
+
+
+void File :: close() {
+	this->_data = nullptr;
+}
+
+
+File :: operator bool() const {
+	return this->_data != nullptr;
+}
+
+
+bool FS :: exists(const char * path) {
+	return this->_files.count(path) > 0;
+}
+
+
+File FS :: open(const char * path, const char * mode) {
+	if(mode[0] == 'w'){
+		std::vector<uint8_t> & data = this->_files[path];
+		data.clear();
+		return File(&data);
+	}
+	auto file = this->_files.find(path);
+	return file == this->_files.end() ? File() : File(&file->second);
+}
+
+
+bool FS :: remove(const char * path) {
+	return this->_files.erase(path) > 0;
+}
+
+
+WiFiClient :: ~WiFiClient() {
+	this->stop();
+}
+
+
+bool WiFiClient :: connect(uint32_t address, uint16_t port) {
+	this->stop();
+	this->_fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in remote = {};
+	remote.sin_family = AF_INET;
+	remote.sin_port = htons(port);
+	remote.sin_addr.s_addr = address;
+	if(this->_fd < 0 or ::connect(this->_fd, (const sockaddr *) &remote, sizeof(remote)) != 0){
+		this->stop();
+		return false;
+	}
+	return true;
+}
+
+
+void WiFiClient :: stop() {
+	if(this->_fd >= 0)
+		close(this->_fd);
+	this->_fd = -1;
+}
+
+
+int WiFiClient :: available() {
+	int len = 0;
+	if(this->_fd < 0 or ioctl(this->_fd, FIONREAD, &len) != 0)
+		return 0;
+	if(len == 0){
+		pollfd descriptor = {this->_fd, POLLIN, 0};
+		if(poll(&descriptor, 1, 1) > 0)
+			ioctl(this->_fd, FIONREAD, &len);
+	}
+	return len;
+}
+
+
+int WiFiClient :: read() {
+	uint8_t byte;
+	return this->readBytes(&byte, 1) == 1 ? byte : -1;
+}
+
+
+int WiFiClient :: peek() {
+	uint8_t byte;
+	return this->_fd >= 0 and recv(this->_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 1 ? byte : -1;
+}
+
+
+size_t WiFiClient :: readBytes(uint8_t * buffer, size_t size) {
+	// like Stream::readBytes(), waits for the bytes up to the timeout
+	size_t len = 0;
+	while(len < size and this->_fd >= 0){
+		pollfd descriptor = {this->_fd, POLLIN, 0};
+		if(poll(&descriptor, 1, HTTP_CLIENT_TIMEOUT) <= 0)
+			break;
+		ssize_t received = recv(this->_fd, &buffer[len], size - len, 0);
+		if(received <= 0)
+			break;
+		len += received;
+	}
+	return len;
+}
+
+
+size_t WiFiClient :: write(uint8_t byte) {
+	return this->write(&byte, 1);
+}
+
+
+size_t WiFiClient :: write(const uint8_t * buffer, size_t size) {
+	ssize_t sent = this->_fd < 0 ? -1 : send(this->_fd, buffer, size, MSG_NOSIGNAL);
+	return sent < 0 ? 0 : sent;
+}
+
+
+uint8_t WiFiClient :: connected() {
+	if(this->_fd < 0)
+		return 0;
+	uint8_t byte;
+	ssize_t received = recv(this->_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	return received > 0 or (received < 0 and (errno == EAGAIN or errno == EWOULDBLOCK));
+}
+
+
+bool HTTPClient :: begin(WiFiClient & client, const char * url) {
+	unsigned a, b, c, d, port = 80;
+	int host_len = 0;
+	if(sscanf(url, "http://%u.%u.%u.%u%n", &a, &b, &c, &d, &host_len) != 4)
+		return false;
+
+	const char * rest = url + host_len;
+	if(*rest == ':')
+		port = strtoul(rest + 1, (char **) &rest, 10);
+	snprintf(this->_path, sizeof(this->_path), "%s", *rest == '/' ? rest : "/");
+	snprintf(this->_host, sizeof(this->_host), "%u.%u.%u.%u", a, b, c, d);
+	this->_address = htonl(a << 24 | b << 16 | c << 8 | d);
+	this->_port = port;
+	this->_headers[0] = '\0';
+	this->_client = &client;
+	return true;
+}
+
+
+void HTTPClient :: addHeader(const char * name, const char * value) {
+	size_t len = strlen(this->_headers);
+	snprintf(&this->_headers[len], sizeof(this->_headers) - len, "%s: %s\r\n", name, value);
+}
+
+
+int HTTPClient :: GET() {
+	if(this->_client == nullptr or not this->_client->connect(this->_address, this->_port))
+		return HTTPC_ERROR_CONNECTION_FAILED;
+
+	char request[512];
+	int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n%sConnection: close\r\n\r\n", this->_path, this->_host, this->_headers);
+	this->_client->write((const uint8_t *) request, len);
+
+	char line[256];
+	int code;
+	if(this->_readLine(line, sizeof(line)) < 0 or sscanf(line, "HTTP/1.%*c %d", &code) != 1)
+		return HTTPC_ERROR_READ_TIMEOUT;
+	while((len = this->_readLine(line, sizeof(line))) > 0);
+	return len < 0 ? HTTPC_ERROR_READ_TIMEOUT : code;
+}
+
+
+WiFiClient * HTTPClient :: getStreamPtr() {
+	return this->_client;
+}
+
+
+void HTTPClient :: end() {
+	if(this->_client != nullptr)
+		this->_client->stop();
+	this->_client = nullptr;
+}
+
+
+int HTTPClient :: _readLine(char * line, size_t size) {
+	size_t len = 0;
+	uint8_t byte;
+	while(this->_client->readBytes(&byte, 1) == 1){
+		if(byte == '\n'){
+			if(len > 0 and line[len - 1] == '\r')
+				len--;
+			line[len] = '\0';
+			return len;
+		}
+		if(len < size - 1)
+			line[len++] = byte;
+	}
+	return -1;
+}
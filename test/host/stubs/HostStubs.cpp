@@ -0,0 +1,279 @@
+#include <Arduino.h>
+#include <coredecls.h>
+#include <ESP8266mDNS.h>
+#include <ESPAsyncUDP.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <poll.h>
+#include <random>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+EspClass ESP;
+MDNSResponder MDNS;
+
+
+namespace {
+	const auto START = std::chrono::steady_clock::now();
+	bool simulated = false;
+	uint64_t simulatedMicros = 0;
+
+	uint32_t rtcMemory[128]; // 512 bytes of RTC user memory
+	rst_info resetInfo = {}; // REASON_DEFAULT_RST
+	uint32_t restarts = 0;
+	std::mt19937 randomGenerator(1);
+	std::vector<AsyncUDP *> listeningSockets;
+	std::atomic<size_t> heapUsed{0}; // bytes allocated with new and not deleted yet
+
+
+	uint64_t nowMicros() {
+		if(simulated)
+			return simulatedMicros;
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START).count();
+	}
+};
+
+
+unsigned long millis() {
+	return nowMicros() / 1000;
+}
+
+
+unsigned long micros() {
+	return nowMicros();
+}
+
+
+void delay(unsigned long ms) {
+	if(simulated)
+		simulatedMicros += (uint64_t) ms * 1000;
+	else
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+
+void yield() {}
+
+
+void configTime(const char * time_zone, const char * ntp_server) {}
+
+
+void settimeofday_cb(const std::function<void(bool from_sntp)> & callback) {}
+
+
+void settimeofday_cb(const std::function<void()> & callback) {}
+
+
+uint32_t system_get_rtc_time() {
+	// 32 bit counter of about 5.75 us ticks, it wraps like the SDK counter
+	return nowMicros() * 4 / 23;
+}
+
+
+uint32_t system_rtc_clock_cali_proc() {
+	return 5.75 * 4096;
+}
+
+
+uint32_t EspClass :: random() {
+	return randomGenerator();
+}
+
+
+bool EspClass :: rtcUserMemoryRead(uint32_t offset, uint32_t * data, size_t size) {
+	if(offset * 4 + size > sizeof(rtcMemory))
+		return false;
+	memcpy(data, &rtcMemory[offset], size);
+	return true;
+}
+
+
+bool EspClass :: rtcUserMemoryWrite(uint32_t offset, uint32_t * data, size_t size) {
+	if(offset * 4 + size > sizeof(rtcMemory))
+		return false;
+	memcpy(&rtcMemory[offset], data, size);
+	return true;
+}
+
+
+rst_info * EspClass :: getResetInfoPtr() {
+	return &resetInfo;
+}
+
+
+uint32_t EspClass :: getFreeHeap() {
+	size_t used = heapUsed;
+	return used < HOST_FREE_HEAP ? HOST_FREE_HEAP - used : 0;
+}
+
+
+void EspClass :: restart() {
+	restarts++;
+}
+
+
+void HostStubs :: useSimulatedTime() {
+	simulatedMicros = nowMicros();
+	simulated = true;
+}
+
+
+void HostStubs :: advance(uint64_t us) {
+	simulatedMicros += us;
+}
+
+
+void HostStubs :: reset(uint32_t reason) {
+	resetInfo.reason = reason;
+	if(reason == REASON_DEFAULT_RST)
+		for(uint32_t & block : rtcMemory)
+			block = randomGenerator(); // RTC memory is random after power on
+}
+
+
+uint32_t HostStubs :: getRestarts() {
+	return restarts;
+}
+
+
+AsyncUDPPacket :: AsyncUDPPacket(int fd, const sockaddr_in & remote, uint8_t * data, size_t len) : _fd(fd), _remote(remote), _data(data), _len(len) {}
+
+
+uint8_t * AsyncUDPPacket :: data() {
+	return this->_data;
+}
+
+
+size_t AsyncUDPPacket :: length() {
+	return this->_len;
+}
+
+
+uint16_t AsyncUDPPacket :: remotePort() {
+	return ntohs(this->_remote.sin_port);
+}
+
+
+size_t AsyncUDPPacket :: write(const uint8_t * data, size_t len) {
+	ssize_t sent = sendto(this->_fd, data, len, 0, (const sockaddr *) &this->_remote, sizeof(this->_remote));
+	return sent < 0 ? 0 : sent;
+}
+
+
+AsyncUDP :: ~AsyncUDP() {
+	this->close();
+}
+
+
+bool AsyncUDP :: listen(uint16_t port) {
+	this->close();
+	this->_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(this->_fd < 0)
+		return false;
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(this->_fd, (const sockaddr *) &address, sizeof(address)) != 0){
+		this->close();
+		return false;
+	}
+	this->_port = this->localPort();
+	listeningSockets.push_back(this);
+	return true;
+}
+
+
+void AsyncUDP :: onPacket(std::function<void(AsyncUDPPacket & packet)> callback) {
+	this->_onPacket = callback;
+}
+
+
+void AsyncUDP :: close() {
+	if(this->_fd >= 0)
+		::close(this->_fd);
+	this->_fd = -1;
+	listeningSockets.erase(std::remove(listeningSockets.begin(), listeningSockets.end(), this), listeningSockets.end());
+}
+
+
+AsyncUDP * AsyncUDP :: listening(uint16_t port) {
+	for(AsyncUDP * udp : listeningSockets)
+		if(udp->_port == port)
+			return udp;
+	return nullptr;
+}
+
+
+uint16_t AsyncUDP :: localPort() {
+	sockaddr_in address = {};
+	socklen_t len = sizeof(address);
+	if(this->_fd < 0 or getsockname(this->_fd, (sockaddr *) &address, &len) != 0)
+		return 0;
+	return ntohs(address.sin_port);
+}
+
+
+bool AsyncUDP :: poll(int timeout) {
+	pollfd descriptor = {this->_fd, POLLIN, 0};
+	if(this->_fd < 0 or ::poll(&descriptor, 1, timeout) <= 0)
+		return false;
+
+	uint8_t buffer[ASYNC_UDP_MAX_PACKET];
+	sockaddr_in remote = {};
+	socklen_t remote_len = sizeof(remote);
+	ssize_t len = recvfrom(this->_fd, buffer, sizeof(buffer), 0, (sockaddr *) &remote, &remote_len);
+	if(len < 0)
+		return false;
+
+	AsyncUDPPacket packet(this->_fd, remote, buffer, len);
+	if(this->_onPacket)
+		this->_onPacket(packet);
+	return true;
+}
+
+
+// every allocation keeps its size in front of the block, for ESP.getFreeHeap()
+void * operator new(size_t size) {
+	void * block = malloc(size + alignof(max_align_t));
+	if(block == nullptr)
+		throw std::bad_alloc();
+	*(size_t *) block = size;
+	heapUsed += size;
+	return (uint8_t *) block + alignof(max_align_t);
+}
+
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept {
+	try {
+		return operator new(size);
+	} catch(const std::bad_alloc &) {
+		return nullptr;
+	}
+}
+
+
+void operator delete(void * pointer) noexcept {
+	if(pointer == nullptr)
+		return;
+	void * block = (uint8_t *) pointer - alignof(max_align_t);
+	heapUsed -= *(size_t *) block;
+	free(block);
+}
+
+
+void operator delete(void * pointer, const std::nothrow_t &) noexcept {
+	operator delete(pointer);
+}
+
+
+void operator delete(void * pointer, size_t size) noexcept {
+	operator delete(pointer);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Host stand-in for the ESP8266 core Updater
+// Same placement and buffering as UpdaterClass: the image ends at FS_PHYS_ADDR, bytes are collected in a
+// FLASH_SECTOR_SIZE buffer allocated by begin() and a sector is only erased and written when the buffer is full or
+// the image complete. end() before the last byte drops the buffer and leaves the flash as it is, like a reset.
+
+#include <Arduino.h>
+#include <flash_hal.h>
+
+class UpdaterClass {
+	public:
+		UpdaterClass & runAsync(bool async);
+		bool begin(size_t size);
+		size_t write(uint8_t * data, size_t len);
+
+		/*
+		* @return true if the image is complete, it is then flushed
+		*/
+		bool end();
+
+	private:
+		uint8_t * _buffer = nullptr;
+		size_t _bufferLen = 0;
+		uint32_t _address = 0; // flash address of the next sector
+		uint32_t _size = 0;
+		uint32_t _written = 0; // bytes given to write()
+
+		void _flush();
+};
+
+extern UpdaterClass Update;
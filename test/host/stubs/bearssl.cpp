@@ -0,0 +1,147 @@
+#include <bearssl/bearssl.h>
+#include <algorithm>
+#include <cstring>
+
+
+const br_hash_class br_sha256_vtable = {64, br_sha256_SIZE};
+
+
+namespace {
+	const uint32_t K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+
+	uint32_t rotate(uint32_t value, uint8_t bits) {
+		return value >> bits | value << (32 - bits);
+	}
+
+
+	void compress(uint32_t * state, const uint8_t * block) {
+		uint32_t w[64];
+		for(int i = 0; i < 16; i++)
+			w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16 | (uint32_t) block[i * 4 + 2] << 8 | block[i * 4 + 3];
+		for(int i = 16; i < 64; i++){
+			uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+		for(int i = 0; i < 64; i++){
+			uint32_t t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+			uint32_t t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+};
+
+
+void br_sha256_init(br_sha256_context * context) {
+	static const uint32_t INITIAL[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	memcpy(context->state, INITIAL, sizeof(INITIAL));
+	context->count = 0;
+}
+
+
+void br_sha256_update(br_sha256_context * context, const void * data, size_t len) {
+	const uint8_t * bytes = (const uint8_t *) data;
+	while(len > 0){
+		size_t offset = context->count % 64;
+		size_t chunk = std::min<size_t>(64 - offset, len);
+		memcpy(&context->buffer[offset], bytes, chunk);
+		context->count += chunk;
+		bytes += chunk;
+		len -= chunk;
+		if(offset + chunk == 64)
+			compress(context->state, context->buffer);
+	}
+}
+
+
+void br_sha256_out(const br_sha256_context * context, void * out) {
+	br_sha256_context copy = *context;
+	uint64_t bits = copy.count * 8;
+	uint8_t padding[72] = {0x80};
+	size_t padding_len = (copy.count % 64 < 56 ? 56 : 120) - copy.count % 64;
+	for(int i = 0; i < 8; i++)
+		padding[padding_len + i] = bits >> (56 - i * 8);
+	br_sha256_update(&copy, padding, padding_len + 8);
+
+	uint8_t * digest = (uint8_t *) out;
+	for(int i = 0; i < 8; i++){
+		digest[i * 4] = copy.state[i] >> 24;
+		digest[i * 4 + 1] = copy.state[i] >> 16;
+		digest[i * 4 + 2] = copy.state[i] >> 8;
+		digest[i * 4 + 3] = copy.state[i];
+	}
+}
+
+
+void br_hmac_key_init(br_hmac_key_context * key_context, const br_hash_class * digest, const void * key, size_t key_len) {
+	uint8_t block[64] = {0};
+	if(key_len > sizeof(block)){
+		br_sha256_context hash;
+		br_sha256_init(&hash);
+		br_sha256_update(&hash, key, key_len);
+		br_sha256_out(&hash, block);
+	}
+	else if(key_len > 0)
+		memcpy(block, key, key_len);
+
+	uint8_t pad[64];
+	key_context->digest = digest;
+	for(int i = 0; i < 64; i++)
+		pad[i] = block[i] ^ 0x36;
+	br_sha256_init(&key_context->inner);
+	br_sha256_update(&key_context->inner, pad, sizeof(pad));
+	for(int i = 0; i < 64; i++)
+		pad[i] = block[i] ^ 0x5C;
+	br_sha256_init(&key_context->outer);
+	br_sha256_update(&key_context->outer, pad, sizeof(pad));
+}
+
+
+void br_hmac_init(br_hmac_context * context, const br_hmac_key_context * key_context, size_t out_len) {
+	context->inner = key_context->inner;
+	context->outer = key_context->outer;
+	context->out_len = out_len == 0 or out_len > br_sha256_SIZE ? br_sha256_SIZE : out_len;
+}
+
+
+void br_hmac_update(br_hmac_context * context, const void * data, size_t len) {
+	br_sha256_update(&context->inner, data, len);
+}
+
+
+size_t br_hmac_out(const br_hmac_context * context, void * out) {
+	uint8_t digest[br_sha256_SIZE];
+	br_sha256_out(&context->inner, digest);
+	br_sha256_context outer = context->outer;
+	br_sha256_update(&outer, digest, sizeof(digest));
+	br_sha256_out(&outer, digest);
+	memcpy(out, digest, context->out_len);
+	return context->out_len;
+}
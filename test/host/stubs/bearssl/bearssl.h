@@ -0,0 +1,43 @@
+#pragma once
+
+// Host stand-in for the BearSSL calls used by the library: SHA-256 and HMAC-SHA256, same names and signatures
+// The digest is a plain portable implementation, see bearssl.cpp
+
+#include <cstddef>
+#include <cstdint>
+
+#define br_sha256_SIZE 32
+
+struct br_hash_class {
+	size_t block_size;
+	size_t output_size;
+};
+
+extern const br_hash_class br_sha256_vtable;
+
+struct br_sha256_context {
+	uint32_t state[8];
+	uint64_t count; // bytes hashed
+	uint8_t buffer[64];
+};
+
+void br_sha256_init(br_sha256_context * context);
+void br_sha256_update(br_sha256_context * context, const void * data, size_t len);
+void br_sha256_out(const br_sha256_context * context, void * out);
+
+struct br_hmac_key_context {
+	const br_hash_class * digest;
+	br_sha256_context inner; // state after the key xor ipad block
+	br_sha256_context outer; // state after the key xor opad block
+};
+
+struct br_hmac_context {
+	br_sha256_context inner;
+	br_sha256_context outer;
+	size_t out_len;
+};
+
+void br_hmac_key_init(br_hmac_key_context * key_context, const br_hash_class * digest, const void * key, size_t key_len);
+void br_hmac_init(br_hmac_context * context, const br_hmac_key_context * key_context, size_t out_len);
+void br_hmac_update(br_hmac_context * context, const void * data, size_t len);
+size_t br_hmac_out(const br_hmac_context * context, void * out);
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand-in for the ESP8266 core coredecls.h, the callbacks are stored and never called
+
+#include <functional>
+
+void settimeofday_cb(const std::function<void(bool from_sntp)> & callback);
+void settimeofday_cb(const std::function<void()> & callback);
@@ -0,0 +1,9 @@
+#pragma once
+
+// Host stand-in for the ESP8266 core flash_hal.h, the d1_mini layout: 4 MB flash, 1 MB file system (eagle.flash.4m1m.ld)
+// The flash below the file system is simulated in memory by HostOta.cpp, see Updater.h
+
+#include <cstdint>
+
+#define FLASH_SECTOR_SIZE 0x1000
+#define FS_PHYS_ADDR 0x300000 // file system start, the update partition ends there
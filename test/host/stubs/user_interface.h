@@ -0,0 +1,28 @@
+#pragma once
+
+// Host stand-in for the ESP8266 SDK user_interface.h, see Arduino.h
+
+#include <cstdint>
+
+enum rst_reason {
+	REASON_DEFAULT_RST = 0, // power on
+	REASON_WDT_RST = 1,
+	REASON_EXCEPTION_RST = 2,
+	REASON_SOFT_WDT_RST = 3,
+	REASON_SOFT_RESTART = 4,
+	REASON_DEEP_SLEEP_AWAKE = 5,
+	REASON_EXT_SYS_RST = 6
+};
+
+struct rst_info {
+	uint32_t reason;
+	uint32_t exccause;
+	uint32_t epc1;
+	uint32_t epc2;
+	uint32_t epc3;
+	uint32_t excvaddr;
+	uint32_t depc;
+};
+
+uint32_t system_get_rtc_time(); // RTC ticks, 32 bit like the SDK
+uint32_t system_rtc_clock_cali_proc(); // RTC tick period in microseconds, Q12 fixed point
@@ -0,0 +1,159 @@
+// Wake cycle harness for duty-cycle mode
+// Drives the firmware's DutyCycle state machine through simulated wake cycles: WiFi and MQTT connect times, QoS 1
+// and 2 acknowledgements with random round trips and losses, and actions the broker kept while the device slept.
+// Checks that every cycle ends within the awake budget and that no cycle disconnects with an unacknowledged publish.
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "DutyCycle.hpp"
+
+using namespace XeoSmartHomeInternals;
+
+#define CYCLES 20000
+#define SLEEP_SECONDS 300
+#define SENSORS 3
+#define LOOP_TICK 1 // miliseconds between two loop() calls
+
+
+namespace {
+	struct CycleResult {
+		uint32_t awake; // miliseconds
+		bool budget_exceeded;
+		bool unacked_at_disconnect; // the cycle disconnected with publishes not acknowledged
+		bool early_drain; // without waiting for acknowledgements the cycle would have disconnected here with publishes in flight
+	};
+
+
+	struct Simulation {
+		std::mt19937 random;
+		std::vector<uint32_t> acks; // times when acknowledgements arrive, UINT32_MAX for a lost one
+		std::vector<uint32_t> actions; // times when actions kept by the broker arrive
+		uint32_t queued_actions = 0;
+
+		explicit Simulation(uint32_t seed) : random(seed) {}
+
+		uint32_t uniform(uint32_t min, uint32_t max) {
+			return std::uniform_int_distribution<uint32_t>(min, max)(this->random);
+		}
+
+		bool chance(double probability) {
+			return std::uniform_real_distribution<double>(0, 1)(this->random) < probability;
+		}
+
+		// QoS 1 is acknowledged after one round trip (PUBACK), QoS 2 after two (PUBREC, PUBREL, PUBCOMP)
+		void publish(uint32_t now, uint8_t qos) {
+			uint32_t rtt = this->uniform(20, 300);
+			this->acks.push_back(this->chance(0.005) ? UINT32_MAX : now + rtt * qos);
+		}
+	};
+
+
+	CycleResult runCycle(Simulation & simulation) {
+		DutyCycle cycle;
+		cycle.begin(SLEEP_SECONDS);
+		simulation.acks.clear();
+		simulation.actions.clear();
+		simulation.queued_actions = 0;
+
+		// WiFi association and DHCP, sometimes the access point does not answer
+		uint32_t connect_at = simulation.chance(0.01) ? UINT32_MAX : simulation.uniform(800, 3000) + simulation.uniform(50, 400);
+		uint32_t disconnected_at = UINT32_MAX;
+		CycleResult result = {0, false, false, false};
+		uint32_t last_activity = 0;
+
+		for(uint32_t now = 0; ; now += LOOP_TICK){
+			bool connected = now >= connect_at and now < disconnected_at;
+
+			// network callbacks run between two loop() calls
+			for(uint32_t & ack : simulation.acks){
+				if(connected and ack <= now){
+					ack = UINT32_MAX - 1; // acknowledged, never counted again
+					cycle.onActivity(now);
+					last_activity = now;
+				}
+			}
+			for(uint32_t & action : simulation.actions){
+				if(connected and action <= now){
+					action = UINT32_MAX;
+					simulation.queued_actions++;
+					cycle.onActivity(now);
+					last_activity = now;
+				}
+			}
+
+			// loop(): queued actions run and publish their status
+			for(; simulation.queued_actions > 0; simulation.queued_actions--)
+				simulation.publish(now, 2);
+
+			uint32_t unacked = std::count_if(simulation.acks.begin(), simulation.acks.end(), [](uint32_t ack){ return ack != UINT32_MAX - 1; });
+			if(cycle.getPhase() == DUTY_CYCLE_DRAINING and unacked > 0 and now - last_activity >= DUTY_CYCLE_QUIET_TIME)
+				result.early_drain = true;
+
+			switch(cycle.run(now, connected, unacked > 0 or simulation.queued_actions > 0)){
+			case DUTY_CYCLE_STEP_SEND_READINGS:
+				last_activity = now;
+				// _onMqttConnected(): presence and state, then _sendDutyCycleReadings(): cycle report, sensors, batch
+				simulation.publish(now, 1);
+				simulation.publish(now, 1);
+				simulation.publish(now, 1);
+				for(int i = 0; i < SENSORS; i++)
+					simulation.publish(now, 2);
+				for(uint32_t i = simulation.uniform(0, 2); i > 0; i--)
+					simulation.actions.push_back(now + simulation.uniform(10, 400));
+				break;
+
+			case DUTY_CYCLE_STEP_DISCONNECT:
+				result.unacked_at_disconnect = unacked > 0;
+				disconnected_at = now + simulation.uniform(5, 50);
+				break;
+
+			case DUTY_CYCLE_STEP_SLEEP:
+				result.awake = now;
+				result.budget_exceeded = cycle.isBudgetExceeded();
+				return result;
+
+			default:
+				break;
+			}
+		}
+	}
+};
+
+
+int main() {
+	Simulation simulation(42);
+	std::vector<uint32_t> awake;
+	uint32_t budget_exceeded = 0;
+	uint32_t unacked_at_disconnect = 0;
+	uint32_t early_drain = 0;
+	uint32_t over_budget = 0;
+	uint64_t energy = 0;
+
+	for(int i = 0; i < CYCLES; i++){
+		CycleResult result = runCycle(simulation);
+		awake.push_back(result.awake);
+		budget_exceeded += result.budget_exceeded;
+		unacked_at_disconnect += result.unacked_at_disconnect;
+		early_drain += result.early_drain;
+		over_budget += result.awake > DUTY_CYCLE_AWAKE_BUDGET + LOOP_TICK;
+		energy += dutyCycleEnergy(result.awake, (uint64_t) SLEEP_SECONDS * 1000000);
+	}
+
+	std::sort(awake.begin(), awake.end());
+	printf("cycles %d, awake ms: median %u, p95 %u, p99 %u, max %u\n", CYCLES, awake[CYCLES / 2], awake[CYCLES * 95 / 100], awake[CYCLES * 99 / 100], awake.back());
+	printf("awake budget exceeded %u (%.2f%%), mean energy %.1f mJ per cycle\n", budget_exceeded, 100.0 * budget_exceeded / CYCLES, energy / 1000.0 / CYCLES);
+	printf("cycles that would have disconnected with publishes in flight without waiting for acknowledgements: %u (%.2f%%)\n", early_drain, 100.0 * early_drain / CYCLES);
+
+	bool ok = true;
+	if(over_budget > 0){
+		printf("FAIL: %u cycles stayed awake longer than the budget\n", over_budget);
+		ok = false;
+	}
+	if(unacked_at_disconnect > 0){
+		printf("FAIL: %u cycles disconnected with unacknowledged publishes\n", unacked_at_disconnect);
+		ok = false;
+	}
+	return ok ? 0 : 1;
+}
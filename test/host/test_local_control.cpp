@@ -0,0 +1,193 @@
+// LocalControl round trip over loopback UDP
+// The device side runs LocalControl in its own thread, like the network task of the ESP8266. The client discovers
+// the device, then sends signed actions one at a time and measures the time until the signed ack is back. A
+// replayed packet must be answered with LOCAL_ACK_REPLAYED and a packet with a wrong mac must not be answered.
+
+#include <Arduino.h>
+#include <LocalControl.hpp>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace XeoSmartHomeInternals;
+
+#define ACTIONS 2000
+#define ANSWER_TIMEOUT 200 // miliseconds
+#define ACTION_PAYLOAD "{\"action\":\"set_status\",\"parameters\":[1,255]}"
+
+
+namespace {
+	const uint8_t KEY[LOCAL_KEY_MAX_LENGTH] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+	};
+
+
+	struct Client {
+		int fd;
+		sockaddr_in device = {};
+		br_hmac_key_context key;
+		uint32_t nonce = 0;
+		uint32_t counter = 0;
+
+		Client() {
+			this->fd = socket(AF_INET, SOCK_DGRAM, 0);
+			this->device.sin_family = AF_INET;
+			this->device.sin_port = htons(LOCAL_CONTROL_PORT);
+			this->device.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			br_hmac_key_init(&this->key, &br_sha256_vtable, KEY, sizeof(KEY));
+		}
+
+		~Client() {
+			close(this->fd);
+		}
+
+		void mac(const uint8_t * data, size_t len, uint8_t * mac) {
+			br_hmac_context context;
+			br_hmac_init(&context, &this->key, LOCAL_MAC_SIZE);
+			br_hmac_update(&context, data, len);
+			br_hmac_out(&context, mac);
+		}
+
+		void send(const uint8_t * data, size_t len) {
+			sendto(this->fd, data, len, 0, (const sockaddr *) &this->device, sizeof(this->device));
+		}
+
+		/*
+		* @return answer length, 0 on timeout
+		*/
+		size_t receive(uint8_t * buffer, size_t size) {
+			pollfd descriptor = {this->fd, POLLIN, 0};
+			if(poll(&descriptor, 1, ANSWER_TIMEOUT) <= 0)
+				return 0;
+			ssize_t len = recv(this->fd, buffer, size, 0);
+			return len < 0 ? 0 : len;
+		}
+
+		bool discover() {
+			uint8_t packet = LOCAL_PACKET_DISCOVER;
+			this->send(&packet, 1);
+			uint8_t buffer[LOCAL_ANNOUNCE_MAX_SIZE];
+			size_t len = this->receive(buffer, sizeof(buffer));
+			if(len < 9 or buffer[0] != LOCAL_PACKET_ANNOUNCE)
+				return false;
+			this->nonce = readUint32(&buffer[1]);
+			this->counter = readUint32(&buffer[5]);
+			return true;
+		}
+
+		/*
+		* @param counter: counter of the packet
+		* @param valid_mac: false to send a wrong mac
+		* @return ack status, -1 if there was no valid ack
+		*/
+		int action(uint32_t counter, bool valid_mac = true) {
+			uint8_t packet[LOCAL_HEADER_SIZE + sizeof(ACTION_PAYLOAD) + LOCAL_MAC_SIZE];
+			size_t len = LOCAL_HEADER_SIZE + strlen(ACTION_PAYLOAD);
+			packet[0] = LOCAL_PACKET_ACTION;
+			packet[1] = 0; // JSON
+			writeUint32(&packet[2], this->nonce);
+			writeUint32(&packet[6], counter);
+			memcpy(&packet[LOCAL_HEADER_SIZE], ACTION_PAYLOAD, strlen(ACTION_PAYLOAD));
+			this->mac(packet, len, &packet[len]);
+			if(not valid_mac)
+				packet[len] ^= 1;
+			this->send(packet, len + LOCAL_MAC_SIZE);
+
+			uint8_t ack[LOCAL_HEADER_SIZE + LOCAL_MAC_SIZE];
+			uint8_t expected_mac[LOCAL_MAC_SIZE];
+			if(this->receive(ack, sizeof(ack)) != sizeof(ack) or ack[0] != LOCAL_PACKET_ACK)
+				return -1;
+			this->mac(ack, LOCAL_HEADER_SIZE, expected_mac);
+			if(memcmp(expected_mac, &ack[LOCAL_HEADER_SIZE], LOCAL_MAC_SIZE) != 0)
+				return -1;
+			return ack[1];
+		}
+	};
+
+
+	uint32_t percentile(std::vector<uint32_t> values, int percent) {
+		if(values.empty())
+			return 0;
+		std::sort(values.begin(), values.end());
+		return values[(values.size() - 1) * percent / 100];
+	}
+};
+
+
+int main() {
+	LocalControl local_control;
+	local_control.setKey(KEY, sizeof(KEY));
+	local_control.onAction([](const char * payload, size_t len, bool msgpack){
+		return len == strlen(ACTION_PAYLOAD) and not msgpack;
+	});
+	local_control.begin("SIM0000001", "Test device");
+
+	AsyncUDP * udp = AsyncUDP::listening(LOCAL_CONTROL_PORT);
+	if(udp == nullptr){
+		printf("FAIL: could not listen on port %d\n", LOCAL_CONTROL_PORT);
+		return 1;
+	}
+
+	std::atomic<bool> running{true};
+	std::thread device_thread([&](){
+		while(running){
+			udp->poll(10);
+			local_control.loop();
+		}
+	});
+
+	Client client;
+	bool ok = client.discover();
+	if(not ok)
+		printf("FAIL: no announce\n");
+
+	std::vector<uint32_t> round_trips;
+	uint32_t failed = 0;
+	for(uint32_t i = 0; ok and i < ACTIONS; i++){
+		uint32_t start = micros();
+		if(client.action(++client.counter) == LOCAL_ACK_ACCEPTED)
+			round_trips.push_back(micros() - start);
+		else
+			failed++;
+	}
+
+	int replayed = client.action(client.counter);
+	int bad_mac = client.action(client.counter + 1, false);
+
+	// HMAC-SHA256 of one action packet, done once by each side per action
+	uint8_t packet[LOCAL_HEADER_SIZE + sizeof(ACTION_PAYLOAD)] = {};
+	uint8_t mac[LOCAL_MAC_SIZE];
+	uint32_t start = micros();
+	for(uint32_t i = 0; i < ACTIONS; i++)
+		client.mac(packet, sizeof(packet), mac);
+	double mac_time = (double) (micros() - start) / ACTIONS;
+
+	running = false;
+	device_thread.join();
+
+	const LocalControlStats & stats = local_control.getStats();
+	printf("actions %u: round trip p50 %u us, p99 %u us, max %u us; HMAC %.2f us per packet\n",
+		(unsigned) round_trips.size(), percentile(round_trips, 50), percentile(round_trips, 99), percentile(round_trips, 100), mac_time);
+	printf("stats: accepted %u, rejected %u, replayed %u, bad mac %u, discoveries %u\n",
+		stats.accepted, stats.rejected, stats.replayed, stats.bad_mac, stats.discoveries);
+
+	if(failed > 0 or stats.accepted != ACTIONS){
+		printf("FAIL: %u actions were not accepted\n", failed);
+		ok = false;
+	}
+	if(replayed != LOCAL_ACK_REPLAYED or stats.replayed != 1){
+		printf("FAIL: replayed packet answered with %d\n", replayed);
+		ok = false;
+	}
+	if(bad_mac != -1 or stats.bad_mac != 1){
+		printf("FAIL: packet with a wrong mac answered with %d\n", bad_mac);
+		ok = false;
+	}
+	return ok ? 0 : 1;
+}
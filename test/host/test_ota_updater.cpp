@@ -0,0 +1,274 @@
+// OtaUpdater HTTP download of a signed image from a loopback server
+// The server runs in a child process, so ESP.getFreeHeap() only sees the allocations of the device side: the updater,
+// the Updater sector buffer and the stubs. The image is downloaded once without interruption, once with the
+// connection dropped half way (resumed with a Range request) and once with a reset half way (resumed from the
+// checkpoint after the flash is read back). An image signed with another key must fail before it becomes bootable.
+// Throughput is loopback throughput, it shows the cost of the updater on the host, not the WiFi throughput of the
+// device; lwIP and ESP8266HTTPClient buffers are not part of the heap figures.
+
+#include <Arduino.h>
+#include <OtaUpdater.hpp>
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <netinet/in.h>
+#include <random>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace XeoSmartHomeInternals;
+
+#define IMAGE_SIZE (400 * 1024 + 123) // bytes, not a multiple of FLASH_SECTOR_SIZE
+#define DROP_AT (150 * 1024 + 17) // bytes sent by /drop before the first connection is closed
+#define RESET_AT (200 * 1024) // offset of the simulated reset
+#define MAX_ITERATIONS 2000000 // loop() calls before an update is given up
+
+
+namespace {
+	const uint8_t KEY[32] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+	};
+
+	uint8_t image[IMAGE_SIZE]; // not on the heap, ESP.getFreeHeap() would count it
+	alignas(4) uint8_t flash[IMAGE_SIZE];
+
+
+	void hmac(const uint8_t * key, const uint8_t * data, size_t len, uint8_t * mac) {
+		br_hmac_key_context key_context;
+		br_hmac_context context;
+		br_hmac_key_init(&key_context, &br_sha256_vtable, key, sizeof(KEY));
+		br_hmac_init(&context, &key_context, OTA_SIGNATURE_SIZE);
+		br_hmac_update(&context, data, len);
+		br_hmac_out(&context, mac);
+	}
+
+
+	/*
+	* @param key: signing key, KEY for a valid signature
+	*/
+	OtaManifest manifest(uint16_t port, const char * path, const uint8_t * key) {
+		OtaManifest manifest = {};
+		snprintf(manifest.version, sizeof(manifest.version), "1.2.3");
+		snprintf(manifest.url, sizeof(manifest.url), "http://127.0.0.1:%u%s", port, path);
+		manifest.size = sizeof(image);
+
+		br_sha256_context sha256;
+		br_sha256_init(&sha256);
+		br_sha256_update(&sha256, image, sizeof(image));
+		br_sha256_out(&sha256, manifest.sha256);
+
+		// what OtaUpdater::_checkSignature() verifies
+		uint8_t data[OTA_VERSION_MAX_LENGTH + 4 + sizeof(manifest.sha256)];
+		size_t len = strlen(manifest.version) + 1;
+		memcpy(data, manifest.version, len);
+		data[len++] = manifest.size >> 24;
+		data[len++] = manifest.size >> 16;
+		data[len++] = manifest.size >> 8;
+		data[len++] = manifest.size;
+		memcpy(&data[len], manifest.sha256, sizeof(manifest.sha256));
+		hmac(key, data, len + sizeof(manifest.sha256), manifest.signature);
+		return manifest;
+	}
+
+
+	void verifyWith(OtaUpdater & updater) {
+		updater.onVerify([](const uint8_t * data, size_t len, const uint8_t * mac){
+			uint8_t expected[OTA_SIGNATURE_SIZE];
+			hmac(KEY, data, len, expected);
+			return memcmp(expected, mac, sizeof(expected)) == 0;
+		});
+	}
+
+
+	/*
+	* Serve the image until killed: /image in full, /drop closes its first connection after DROP_AT bytes
+	*/
+	void serve(int listener) {
+		bool dropped = false;
+		while(true){
+			int fd = accept(listener, nullptr, nullptr);
+			if(fd < 0)
+				continue;
+
+			char request[1024];
+			size_t len = 0;
+			while(len < sizeof(request) - 1 and (len < 4 or memcmp(&request[len - 4], "\r\n\r\n", 4) != 0)){
+				ssize_t received = recv(fd, &request[len], 1, 0);
+				if(received <= 0)
+					break;
+				len += received;
+			}
+			request[len] = '\0';
+
+			unsigned long from = 0;
+			const char * range = strstr(request, "Range: bytes=");
+			if(range != nullptr)
+				from = strtoul(range + strlen("Range: bytes="), nullptr, 10);
+			size_t to = sizeof(image);
+			if(strncmp(request, "GET /drop ", 10) == 0 and not dropped){
+				to = DROP_AT;
+				dropped = true;
+			}
+
+			char headers[256];
+			int headers_len;
+			if(from > 0)
+				headers_len = snprintf(headers, sizeof(headers), "HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\nContent-Range: bytes %lu-%zu/%zu\r\n\r\n", sizeof(image) - from, from, sizeof(image) - 1, sizeof(image));
+			else
+				headers_len = snprintf(headers, sizeof(headers), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", sizeof(image));
+			send(fd, headers, headers_len, MSG_NOSIGNAL);
+			if(from < to)
+				send(fd, &image[from], to - from, MSG_NOSIGNAL);
+			close(fd);
+		}
+	}
+
+
+	struct Run {
+		OtaState state;
+		uint32_t iterations = 0;
+		double seconds = 0;
+		uint32_t heap_low = HOST_FREE_HEAP; // lowest ESP.getFreeHeap()
+	};
+
+
+	/*
+	* Call loop() until the update is done or failed
+	* @param stop_at: offset to return at, in OTA_RECEIVING, 0 to run to the end
+	*/
+	Run run(OtaUpdater & updater, uint32_t stop_at = 0) {
+		Run run;
+		auto start = std::chrono::steady_clock::now();
+		for(; run.iterations < MAX_ITERATIONS; run.iterations++){
+			updater.loop(0, false);
+			run.heap_low = std::min(run.heap_low, ESP.getFreeHeap());
+			run.state = updater.getState();
+			if(run.state == OTA_DONE or run.state == OTA_FAILED or (stop_at > 0 and updater.getOffset() >= stop_at))
+				break;
+			HostStubs::advance(1000); // retry delays pass in simulated time
+		}
+		run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return run;
+	}
+
+
+	/*
+	* @return true if the update partition holds the image
+	*/
+	bool flashHoldsImage() {
+		uint32_t rounded_size = (sizeof(image) + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+		ESP.flashRead(FS_PHYS_ADDR - rounded_size, (uint32_t *) flash, sizeof(flash));
+		return memcmp(flash, image, sizeof(image)) == 0;
+	}
+
+
+	void eraseUpdatePartition() {
+		// a new image over the old one would pass the flash check without being written
+		memset(flash, 0xFF, sizeof(flash));
+		Update.begin(sizeof(flash));
+		Update.write(flash, sizeof(flash));
+		Update.end();
+	}
+};
+
+
+int main() {
+	std::mt19937 random(1);
+	for(uint8_t & byte : image)
+		byte = random();
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t address_len = sizeof(address);
+	if(bind(listener, (const sockaddr *) &address, sizeof(address)) != 0 or listen(listener, 4) != 0 or getsockname(listener, (sockaddr *) &address, &address_len) != 0){
+		printf("FAIL: could not listen\n");
+		return 1;
+	}
+	uint16_t port = ntohs(address.sin_port);
+
+	pid_t server = fork();
+	if(server == 0){
+		serve(listener);
+		return 0;
+	}
+	close(listener);
+	HostStubs::useSimulatedTime();
+	bool ok = true;
+
+	// uninterrupted download
+	{
+		OtaUpdater updater;
+		verifyWith(updater);
+		uint32_t heap_before = ESP.getFreeHeap();
+		updater.begin(manifest(port, "/image", KEY));
+		Run result = run(updater);
+		if(result.state != OTA_DONE or not flashHoldsImage()){
+			printf("FAIL: download: state %d, error \"%s\"\n", result.state, updater.getError());
+			ok = false;
+		}
+		printf("download %u bytes: %.0f kB/s, %u loop() calls; heap low-water %u of %u bytes free, %u bytes used by the update; updater %zu bytes\n",
+			IMAGE_SIZE, IMAGE_SIZE / result.seconds / 1024, result.iterations, result.heap_low, heap_before, heap_before - result.heap_low, sizeof(OtaUpdater));
+	}
+
+	// connection dropped, continued with a Range request
+	{
+		eraseUpdatePartition();
+		OtaUpdater updater;
+		verifyWith(updater);
+		updater.begin(manifest(port, "/drop", KEY));
+		Run result = run(updater);
+		if(result.state != OTA_DONE or not flashHoldsImage()){
+			printf("FAIL: dropped connection: state %d, error \"%s\"\n", result.state, updater.getError());
+			ok = false;
+		}
+		printf("dropped connection at %u: resumed, %.0f kB/s, heap low-water %u bytes\n", DROP_AT, IMAGE_SIZE / result.seconds / 1024, result.heap_low);
+	}
+
+	// reset, continued from the checkpoint
+	{
+		eraseUpdatePartition();
+		OtaUpdater * updater = new OtaUpdater();
+		verifyWith(*updater);
+		updater->begin(manifest(port, "/image", KEY));
+		Run before = run(*updater, RESET_AT);
+		uint32_t reset_offset = updater->getOffset();
+		delete updater;
+		Update.end(); // RAM is lost, the sectors written stay
+
+		OtaUpdater resumed;
+		verifyWith(resumed);
+		resumed.restore();
+		uint32_t heap_before = ESP.getFreeHeap();
+		Run after = run(resumed);
+		if(before.state != OTA_RECEIVING or after.state != OTA_DONE or not flashHoldsImage()){
+			printf("FAIL: reset: state %d, error \"%s\"\n", after.state, resumed.getError());
+			ok = false;
+		}
+		printf("reset at %u: resumed from the checkpoint, %.0f kB/s, heap low-water %u of %u bytes free\n", reset_offset, (IMAGE_SIZE - reset_offset) / after.seconds / 1024, after.heap_low, heap_before);
+	}
+
+	// signed with another key
+	{
+		eraseUpdatePartition();
+		uint8_t other_key[sizeof(KEY)];
+		memcpy(other_key, KEY, sizeof(KEY));
+		other_key[0] ^= 1;
+
+		OtaUpdater updater;
+		verifyWith(updater);
+		updater.begin(manifest(port, "/image", other_key));
+		Run result = run(updater);
+		if(result.state != OTA_FAILED or strcmp(updater.getError(), "signature not valid") != 0 or flashHoldsImage()){
+			printf("FAIL: bad signature: state %d, error \"%s\"\n", result.state, updater.getError());
+			ok = false;
+		}
+	}
+
+	kill(server, SIGTERM);
+	waitpid(server, nullptr, 0);
+	return ok ? 0 : 1;
+}
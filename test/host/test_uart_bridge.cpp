@@ -0,0 +1,177 @@
+// UartBridge throughput and latency over a pseudo terminal at 9600 and 115200 baud
+// The device and the co-processor each run a UartBridge in their own thread, on the two ends of a pty paced like a
+// UART by PtyStream. A saturated run measures command throughput against the line rate; a ping run sends one
+// command at a time and measures one way latency. Every command must arrive once, in order, without CRC errors.
+
+#include <Arduino.h>
+#include <UartBridge.hpp>
+#include <algorithm>
+#include <atomic>
+#include <pty.h>
+#include <thread>
+#include <termios.h>
+#include <vector>
+#include "PtyStream.hpp"
+
+#define RUN_TIME 2000 // miliseconds per throughput run
+#define PING_COUNT 50
+#define COMMAND_DATA 16 // bytes: sequence (4), micros() when queued (4), padding
+#define COMMAND_TEST 0x42
+
+
+namespace {
+	struct Link {
+		int device_fd;
+		int coprocessor_fd;
+	};
+
+
+	bool openLink(Link & link) {
+		if(openpty(&link.device_fd, &link.coprocessor_fd, nullptr, nullptr, nullptr) != 0)
+			return false;
+		termios attributes;
+		tcgetattr(link.coprocessor_fd, &attributes);
+		cfmakeraw(&attributes); // no echo, no line discipline, bytes pass unchanged
+		tcsetattr(link.coprocessor_fd, TCSANOW, &attributes);
+		return true;
+	}
+
+
+	uint32_t readUint32(const uint8_t * data) {
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+
+	void writeUint32(uint8_t * data, uint32_t value) {
+		memcpy(data, &value, sizeof(value));
+	}
+
+
+	struct Receiver {
+		std::atomic<uint32_t> received{0};
+		uint32_t expected = 0;
+		uint32_t out_of_order = 0;
+		std::vector<uint32_t> latencies; // microseconds, queued on the device to delivered on the co-processor
+
+		void onCommand(uint8_t command, const uint8_t * data, uint8_t len) {
+			if(command != COMMAND_TEST or len != COMMAND_DATA)
+				return;
+			uint32_t sequence = readUint32(data);
+			uint32_t queued_at = readUint32(data + 4);
+			if(sequence != this->expected)
+				this->out_of_order++;
+			this->expected = sequence + 1;
+			this->latencies.push_back((uint32_t) micros() - queued_at);
+			this->received++;
+		}
+	};
+
+
+	void makeCommand(uint8_t * data, uint32_t sequence) {
+		memset(data, 0xA5, COMMAND_DATA);
+		writeUint32(data, sequence);
+		writeUint32(data + 4, micros());
+	}
+
+
+	uint32_t percentile(std::vector<uint32_t> values, int percent) {
+		if(values.empty())
+			return 0;
+		std::sort(values.begin(), values.end());
+		return values[(values.size() - 1) * percent / 100];
+	}
+
+
+	/*
+	* @param saturate: keep the device queue full, otherwise send one command and wait for it
+	* @return true if every command arrived once and in order
+	*/
+	bool run(uint32_t baud, bool saturate) {
+		Link link;
+		if(not openLink(link)){
+			printf("openpty failed\n");
+			return false;
+		}
+
+		PtyStream device_stream(link.device_fd, baud);
+		PtyStream coprocessor_stream(link.coprocessor_fd, baud);
+		UartBridge device(device_stream, baud);
+		UartBridge coprocessor(coprocessor_stream, baud);
+		Receiver receiver;
+		coprocessor.onCommand([&receiver](uint8_t command, const uint8_t * data, uint8_t len){
+			receiver.onCommand(command, data, len);
+		});
+
+		std::atomic<bool> running{true};
+		std::thread coprocessor_thread([&](){
+			while(running){
+				coprocessor.loop();
+				std::this_thread::yield();
+			}
+		});
+
+		uint32_t sent = 0;
+		uint32_t start = millis();
+		uint8_t data[COMMAND_DATA];
+		if(saturate){
+			while(millis() - start < RUN_TIME){
+				makeCommand(data, sent);
+				while(device.send(COMMAND_TEST, data, sizeof(data))){
+					sent++;
+					makeCommand(data, sent);
+				}
+				device.loop();
+			}
+		} else {
+			for(; sent < PING_COUNT; sent++){
+				makeCommand(data, sent);
+				device.send(COMMAND_TEST, data, sizeof(data));
+				uint32_t ping_start = millis();
+				while(receiver.received <= sent and millis() - ping_start < 1000)
+					device.loop();
+			}
+		}
+
+		// let the frames in flight arrive and be acknowledged, throughput counts until the last one
+		uint32_t drain_start = millis();
+		while((device.inFlight() > 0 or receiver.received < sent) and millis() - drain_start < 2000)
+			device.loop();
+		uint32_t elapsed = millis() - start;
+		running = false;
+		coprocessor_thread.join();
+		close(link.device_fd);
+		close(link.coprocessor_fd);
+
+		const XeoSmartHomeInternals::UartBridgeStats & stats = device.getStats();
+		const XeoSmartHomeInternals::UartBridgeStats & coprocessor_stats = coprocessor.getStats();
+		uint32_t received = receiver.received;
+		if(saturate){
+			// payload bytes per second against the line rate of 10 bits per byte
+			double throughput = received * (2.0 + COMMAND_DATA) * 1000 / elapsed;
+			printf("%6u baud  throughput %4u commands/s, %6.0f B/s of commands, %3.0f%% of the line; latency p50 %u us, p99 %u us; ack max %u ms; frames %u, retransmissions %u\n",
+				baud, received * 1000 / elapsed, throughput, 100 * throughput / (baud / 10.0), percentile(receiver.latencies, 50), percentile(receiver.latencies, 99),
+				stats.max_latency, stats.frames_sent, stats.retransmissions);
+		} else {
+			printf("%6u baud  one at a time: latency p50 %u us, p99 %u us, max %u us; ack max %u ms; retransmissions %u\n",
+				baud, percentile(receiver.latencies, 50), percentile(receiver.latencies, 99), percentile(receiver.latencies, 100), stats.max_latency, stats.retransmissions);
+		}
+
+		bool ok = received == sent and receiver.out_of_order == 0 and stats.failures == 0 and stats.crc_errors == 0 and coprocessor_stats.crc_errors == 0;
+		if(not ok)
+			printf("FAIL: sent %u, received %u, out of order %u, failures %u, crc errors %u/%u\n",
+				sent, received, receiver.out_of_order, stats.failures, stats.crc_errors, coprocessor_stats.crc_errors);
+		return ok;
+	}
+};
+
+
+int main() {
+	bool ok = true;
+	for(uint32_t baud : {9600, 115200}){
+		ok = run(baud, true) and ok;
+		ok = run(baud, false) and ok;
+	}
+	return ok ? 0 : 1;
+}
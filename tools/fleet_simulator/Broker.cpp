@@ -0,0 +1,385 @@
+#include "Broker.hpp"
+#include <algorithm>
+#include <vector>
+
+
+#define PRESENCE_OFFLINE "offline"
+#define MQTT_PACKET_OVERHEAD 4 // fixed header and topic length bytes
+#define MQTT_ACK_SIZE 4 // PUBACK, PUBREC, PUBREL and PUBCOMP: fixed header and packet id
+#define MQTT_WILL_QOS 1 // setWill() in _initMqtt()
+
+
+XeoFleetSimulator::Broker :: Broker(EventLoop & loop, FleetStats & stats, const BrokerConfig & config, uint32_t seed) : _loop(loop), _stats(stats), _config(config), _random(seed) {
+	this->_loop.after(SECOND, [this](){
+		this->_sweepKeepAlive();
+	});
+}
+
+
+// <DEVICE-PACKETS>
+
+void XeoFleetSimulator::Broker :: connect(BrokerClient * client, const std::string & client_id, uint16_t keep_alive, const std::string & will_topic) {
+	SimTime latency = this->_link();
+	this->_loop.after(latency, [this, client, client_id, keep_alive, will_topic](){
+		this->_stats.connects++;
+		if(this->_loop.now() < this->_downUntil){
+			// nothing listens on the port, the device sees a reset after one more trip
+			this->_stats.refused++;
+			this->_loop.after(this->_link(), [client](){
+				client->onConnack(false);
+			});
+			return;
+		}
+
+		uint32_t epoch = this->_epoch;
+		this->_receive(0, this->_config.connect_cost, client_id.size() + will_topic.size() + 2 * MQTT_PACKET_OVERHEAD, [this, client, client_id, keep_alive, will_topic, epoch](){
+			// a reconnect before the broker noticed the old connection, or another device with the same serial
+			auto existing = this->_clientIds.find(client_id);
+			if(existing != this->_clientIds.end()){
+				this->_stats.takeovers++;
+				this->_drop(existing->second, false, existing->second != client);
+			}
+			if(this->_sessions.count(client) > 0)
+				this->_drop(client, false, false);
+
+			Session & session = this->_sessions[client];
+			session.client_id = client_id;
+			session.will_topic = will_topic;
+			session.keep_alive = keep_alive * SECOND;
+			session.last_seen = this->_loop.now();
+			this->_clientIds[client_id] = client;
+
+			this->_loop.after(this->_link(), [this, client, epoch](){
+				if(epoch == this->_epoch)
+					client->onConnack(true);
+			});
+		});
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: subscribe(BrokerClient * client, const std::string & filter, uint8_t qos) {
+	this->_receive(this->_link(), this->_config.subscribe_cost, filter.size() + 1 + MQTT_PACKET_OVERHEAD, [this, client, filter, qos](){
+		auto session = this->_sessions.find(client);
+		if(session == this->_sessions.end())
+			return;
+
+		this->_touch(client);
+		size_t literal = filter.find_first_of("+#");
+		std::vector<Subscription> & subscribers = literal == std::string::npos ? this->_subscriptions[filter] : this->_wildcards[filter];
+		auto existing = std::find_if(subscribers.begin(), subscribers.end(), [client](const Subscription & subscription){
+			return subscription.client == client;
+		});
+		if(existing != subscribers.end()){
+			existing->qos = qos;
+		} else {
+			subscribers.push_back(Subscription{client, qos});
+			session->second.subscriptions.push_back(filter);
+		}
+
+		// retained messages matching the filter are sent right away
+		std::string prefix = filter.substr(0, literal);
+		for(auto retained = this->_retained.lower_bound(prefix); retained != this->_retained.end() and retained->first.compare(0, prefix.size(), prefix) == 0; retained++){
+			if(_matches(filter, retained->first))
+				this->_deliver(client, retained->first, retained->second.payload, std::min(qos, retained->second.qos));
+		}
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: publish(BrokerClient * client, const std::string & topic, const std::string & payload, uint8_t qos, bool retain) {
+	SimTime sent_at = this->_loop.now();
+	this->_receive(this->_link(), this->_config.publish_cost, topic.size() + payload.size() + MQTT_PACKET_OVERHEAD + (qos > 0 ? 2 : 0), [this, client, topic, payload, qos, retain, sent_at](){
+		if(this->_sessions.count(client) == 0)
+			return; // connection was reset before the packet arrived
+
+		this->_touch(client);
+		if(retain){
+			if(payload.empty())
+				this->_retained.erase(topic);
+			else
+				this->_retained[topic] = RetainedMessage{payload, qos};
+		}
+
+		// QoS 2 messages are forwarded when the PUBLISH arrives, the handshake only releases the packet id
+		this->_handshake(client, _handshakePackets(qos), true, sent_at);
+		this->_route(topic, payload, qos, true, sent_at);
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: ping(BrokerClient * client) {
+	this->_receive(this->_link(), this->_config.ping_cost, 2, [this, client](){
+		if(this->_sessions.count(client) == 0)
+			return;
+
+		this->_stats.pings++;
+		this->_touch(client);
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: disconnect(BrokerClient * client) {
+	this->_receive(this->_link(), this->_config.ping_cost, 2, [this, client](){
+		if(this->_sessions.count(client) > 0)
+			this->_drop(client, false, false);
+	});
+}
+
+// </DEVICE-PACKETS>
+// <CLOUD>
+
+void XeoFleetSimulator::Broker :: setCloudSubscriber(CloudCallback callback) {
+	this->_cloud = callback;
+}
+
+
+void XeoFleetSimulator::Broker :: cloudPublish(const std::string & topic, const std::string & payload) {
+	uint8_t qos = this->_config.cloud_qos;
+	this->_receive(this->_config.cloud_latency, this->_config.publish_cost, topic.size() + payload.size() + MQTT_PACKET_OVERHEAD + (qos > 0 ? 2 : 0), [this, topic, payload, qos](){
+		this->_handshake(nullptr, _handshakePackets(qos), true, 0);
+		this->_route(topic, payload, qos, false, 0);
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: restart(SimTime down_for) {
+	this->_epoch++;
+	for(auto & session : this->_sessions){
+		BrokerClient * client = session.first;
+		this->_loop.after(this->_link(), [client](){
+			client->onConnectionLost();
+		});
+	}
+
+	// retained messages are persisted, sessions and queued packets are not
+	this->_sessions.clear();
+	this->_clientIds.clear();
+	this->_subscriptions.clear();
+	this->_wildcards.clear();
+	this->_busyUntil = this->_loop.now();
+	this->_downUntil = this->_loop.now() + down_for;
+}
+
+
+size_t XeoFleetSimulator::Broker :: getSessionCount() const {
+	return this->_sessions.size();
+}
+
+
+size_t XeoFleetSimulator::Broker :: getRetainedCount() const {
+	return this->_retained.size();
+}
+
+// </CLOUD>
+// <INTERNALS>
+
+XeoFleetSimulator::SimTime XeoFleetSimulator::Broker :: _link() {
+	if(this->_config.link_jitter == 0)
+		return this->_config.link_latency;
+	return this->_config.link_latency + this->_random() % this->_config.link_jitter;
+}
+
+
+void XeoFleetSimulator::Broker :: _receive(SimTime latency, uint32_t cost, size_t bytes, std::function<void()> handler) {
+	uint32_t epoch = this->_epoch;
+	this->_loop.after(latency, [this, cost, bytes, handler, epoch](){
+		if(epoch != this->_epoch or this->_loop.now() < this->_downUntil)
+			return; // connection was reset by a restart
+
+		SimTime arrival = this->_loop.now();
+		SimTime start = std::max(arrival, this->_busyUntil);
+		this->_busyUntil = start + cost;
+		this->_stats.inbound++;
+		this->_stats.inbound_bytes += bytes;
+		this->_stats.queue_delay.record(start - arrival);
+		this->_stats._secondQueue.record(start - arrival);
+
+		this->_loop.at(this->_busyUntil, [this, handler, epoch](){
+			if(epoch == this->_epoch)
+				handler();
+		});
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: _deliver(BrokerClient * client, const std::string & topic, const std::string & payload, uint8_t qos) {
+	this->_busyUntil = std::max(this->_busyUntil, this->_loop.now()) + this->_config.deliver_cost;
+	this->_stats.outbound++;
+	this->_stats.outbound_bytes += topic.size() + payload.size() + MQTT_PACKET_OVERHEAD + (qos > 0 ? 2 : 0);
+
+	uint32_t epoch = this->_epoch;
+	this->_loop.at(this->_busyUntil + this->_link(), [this, client, topic, payload, qos, epoch](){
+		if(epoch != this->_epoch or this->_sessions.count(client) == 0)
+			return;
+
+		client->onMessage(topic, payload);
+		this->_handshake(client, _handshakePackets(qos), false, 0);
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: _route(const std::string & topic, const std::string & payload, uint8_t qos, bool from_device, SimTime sent_at) {
+	auto subscribers = this->_subscriptions.find(topic);
+	if(subscribers != this->_subscriptions.end()){
+		for(const Subscription & subscription : subscribers->second)
+			this->_deliver(subscription.client, topic, payload, std::min(qos, subscription.qos));
+	}
+
+	// devices subscribe to exact topics, this is only walked for filters given to subscribe() by hand
+	for(const auto & wildcard : this->_wildcards){
+		if(not _matches(wildcard.first, topic))
+			continue;
+		for(const Subscription & subscription : wildcard.second)
+			this->_deliver(subscription.client, topic, payload, std::min(qos, subscription.qos));
+	}
+
+	if(not from_device)
+		return;
+
+	// device/<serial>/<suffix>, counted by suffix so the report groups the fleet
+	size_t suffix = topic.find('/', topic.find('/') + 1);
+	this->_stats.topics[suffix == std::string::npos ? topic : topic.substr(suffix + 1)]++;
+
+	uint8_t cloud_qos = std::min(qos, this->_config.cloud_qos);
+	this->_busyUntil = std::max(this->_busyUntil, this->_loop.now()) + this->_config.deliver_cost;
+	this->_stats.outbound++;
+	this->_stats.outbound_bytes += topic.size() + payload.size() + MQTT_PACKET_OVERHEAD + (cloud_qos > 0 ? 2 : 0);
+	this->_loop.at(this->_busyUntil + this->_config.cloud_latency, [this, topic, payload, cloud_qos, sent_at](){
+		this->_stats.publish_latency.record(this->_loop.now() - sent_at);
+		if(this->_cloud)
+			this->_cloud(topic, payload, sent_at);
+		this->_handshake(nullptr, _handshakePackets(cloud_qos), false, 0);
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: _drop(BrokerClient * client, bool publish_will, bool notify) {
+	auto session = this->_sessions.find(client);
+	if(session == this->_sessions.end())
+		return;
+
+	std::string will_topic = session->second.will_topic;
+	auto client_id = this->_clientIds.find(session->second.client_id);
+	if(client_id != this->_clientIds.end() and client_id->second == client)
+		this->_clientIds.erase(client_id);
+	for(const std::string & filter : session->second.subscriptions){
+		if(filter.find_first_of("+#") == std::string::npos)
+			_unsubscribe(this->_subscriptions, filter, client);
+		else
+			_unsubscribe(this->_wildcards, filter, client);
+	}
+	this->_sessions.erase(session);
+
+	if(publish_will and not will_topic.empty()){
+		this->_stats.wills++;
+		this->_retained[will_topic] = RetainedMessage{PRESENCE_OFFLINE, MQTT_WILL_QOS};
+		this->_route(will_topic, PRESENCE_OFFLINE, MQTT_WILL_QOS, true, this->_loop.now());
+	}
+
+	if(notify){
+		this->_loop.after(this->_link(), [client](){
+			client->onConnectionLost();
+		});
+	}
+}
+
+
+template <typename Table>
+void XeoFleetSimulator::Broker :: _unsubscribe(Table & table, const std::string & filter, BrokerClient * client) {
+	auto subscribers = table.find(filter);
+	if(subscribers == table.end())
+		return;
+
+	std::vector<Subscription> & list = subscribers->second;
+	list.erase(std::remove_if(list.begin(), list.end(), [client](const Subscription & subscription){
+		return subscription.client == client;
+	}), list.end());
+	if(list.empty())
+		table.erase(subscribers);
+}
+
+
+void XeoFleetSimulator::Broker :: _handshake(BrokerClient * client, uint8_t packets, bool broker_sends, SimTime sent_at) {
+	if(packets == 0)
+		return;
+
+	SimTime latency = client == nullptr ? this->_config.cloud_latency : this->_link();
+	if(not broker_sends){
+		this->_receive(latency, this->_config.ack_cost, MQTT_ACK_SIZE, [this, client, packets, sent_at](){
+			if(client != nullptr){
+				if(this->_sessions.count(client) == 0)
+					return;
+				this->_touch(client);
+			}
+			this->_stats.handshakes++;
+			this->_handshake(client, packets - 1, true, sent_at);
+		});
+		return;
+	}
+
+	this->_busyUntil = std::max(this->_busyUntil, this->_loop.now()) + this->_config.ack_cost;
+	this->_stats.handshakes++;
+	this->_stats.outbound_bytes += MQTT_ACK_SIZE;
+
+	uint32_t epoch = this->_epoch;
+	this->_loop.at(this->_busyUntil + latency, [this, client, packets, sent_at, epoch](){
+		if(epoch != this->_epoch or (client != nullptr and this->_sessions.count(client) == 0))
+			return;
+
+		// PUBACK or PUBCOMP reached the device, AsyncMqttClient calls onPublish()
+		if(packets == 1 and sent_at > 0)
+			this->_stats.ack_latency.record(this->_loop.now() - sent_at);
+		this->_handshake(client, packets - 1, false, sent_at);
+	});
+}
+
+
+uint8_t XeoFleetSimulator::Broker :: _handshakePackets(uint8_t qos) {
+	return qos >= 2 ? 3 : qos;
+}
+
+
+bool XeoFleetSimulator::Broker :: _matches(const std::string & filter, const std::string & topic) {
+	size_t filter_start = 0;
+	size_t topic_start = 0;
+	for(;;){
+		size_t filter_end = std::min(filter.find('/', filter_start), filter.size());
+		if(filter.compare(filter_start, filter_end - filter_start, "#") == 0)
+			return true;
+		if(topic_start > topic.size())
+			return false; // topic has fewer levels than the filter
+
+		size_t topic_end = std::min(topic.find('/', topic_start), topic.size());
+		if(filter.compare(filter_start, filter_end - filter_start, "+") != 0 and filter.compare(filter_start, filter_end - filter_start, topic, topic_start, topic_end - topic_start) != 0)
+			return false;
+		if(filter_end == filter.size())
+			return topic_end == topic.size();
+
+		filter_start = filter_end + 1;
+		topic_start = topic_end + 1;
+	}
+}
+
+
+void XeoFleetSimulator::Broker :: _sweepKeepAlive() {
+	std::vector<BrokerClient *> expired;
+	for(auto & session : this->_sessions){
+		// MQTT allows 1.5 keepalive intervals without a packet
+		if(this->_loop.now() - session.second.last_seen > session.second.keep_alive * 3 / 2)
+			expired.push_back(session.first);
+	}
+	for(BrokerClient * client : expired)
+		this->_drop(client, true, true);
+
+	this->_loop.after(SECOND, [this](){
+		this->_sweepKeepAlive();
+	});
+}
+
+
+void XeoFleetSimulator::Broker :: _touch(BrokerClient * client) {
+	this->_sessions[client].last_seen = this->_loop.now();
+}
+
+// </INTERNALS>
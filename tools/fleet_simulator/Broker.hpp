@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "EventLoop.hpp"
+#include "FleetStats.hpp"
+
+
+namespace XeoFleetSimulator {
+	/*
+	* Device side of an MQTT connection, callbacks run when the packet reaches the device
+	*/
+	class BrokerClient {
+		public:
+			virtual ~BrokerClient() {}
+
+			/*
+			* @param accepted: false if the broker was down, the device sees a refused connection
+			*/
+			virtual void onConnack(bool accepted) = 0;
+
+			/*
+			* Connection reset by the broker: restart or keepalive timeout
+			*/
+			virtual void onConnectionLost() = 0;
+
+			virtual void onMessage(const std::string & topic, const std::string & payload) = 0;
+	};
+
+
+	struct BrokerConfig {
+		// broker CPU time per packet, microseconds; packets wait in one FIFO queue, like a single threaded broker
+		uint32_t connect_cost = 300; // session setup, will and retained state
+		uint32_t subscribe_cost = 40;
+		uint32_t publish_cost = 12; // per received publish, routing included
+		uint32_t deliver_cost = 4; // per message sent to a subscriber
+		uint32_t ack_cost = 2; // per PUBACK, PUBREC, PUBREL or PUBCOMP, sent or received
+		uint32_t ping_cost = 2;
+
+		uint8_t cloud_qos = 1; // QoS of the backend's device/# subscription and of its action publishes
+
+		// one way network latency between a device and the broker
+		SimTime link_latency = 3 * MILLISECOND;
+		SimTime link_jitter = 2 * MILLISECOND; // uniform, added to link_latency
+		SimTime cloud_latency = 500; // broker to cloud subscriber, same data center
+	};
+
+
+	/*
+	* Broker stand-in: sessions, last wills, retained messages, keepalive, subscriptions and the QoS 1 and 2 handshakes
+	* The cloud subscriber receives every device publication, like the backend's device/# subscription.
+	* Packet handling costs broker time, so bursts (boot storms, mass reconnects) queue up and show as latency.
+	* The device side of a handshake (PUBREL after PUBREC, PUBACK and PUBREC of received messages) is answered by the
+	* stand-in, like AsyncMqttClient does without the sketch.
+	*/
+	class Broker {
+		public:
+			/*
+			* @param topic: device topic
+			* @param payload: message
+			* @param sent_at: time the device published it
+			*/
+			typedef std::function<void(const std::string & topic, const std::string & payload, SimTime sent_at)> CloudCallback;
+
+			Broker(EventLoop & loop, FleetStats & stats, const BrokerConfig & config, uint32_t seed);
+
+			// device packets, sent now
+
+			/*
+			* @param client_id: an existing session with this id is replaced
+			* @param keep_alive: seconds, the will is published after 1.5x this without a packet
+			* @param will_topic: retained "offline" is published there when the session times out
+			*/
+			void connect(BrokerClient * client, const std::string & client_id, uint16_t keep_alive, const std::string & will_topic);
+
+			/*
+			* @param filter: exact topic, the form devices use, or a filter with '+' and '#' wildcards
+			* @param qos: maximum QoS of the messages delivered for this filter
+			*/
+			void subscribe(BrokerClient * client, const std::string & filter, uint8_t qos);
+
+			/*
+			* @param qos: 1 is answered with PUBACK, 2 with PUBREC, PUBREL from the device and PUBCOMP
+			*/
+			void publish(BrokerClient * client, const std::string & topic, const std::string & payload, uint8_t qos, bool retain);
+
+			void ping(BrokerClient * client);
+
+			/*
+			* Clean disconnect, the will is not published
+			*/
+			void disconnect(BrokerClient * client);
+
+			// cloud side
+
+			void setCloudSubscriber(CloudCallback callback);
+
+			/*
+			* Publish from the backend at cloud_qos, delivered to the sessions subscribed to topic
+			*/
+			void cloudPublish(const std::string & topic, const std::string & payload);
+
+			/*
+			* Drop every session without publishing wills and refuse connections for down_for
+			*/
+			void restart(SimTime down_for);
+
+			size_t getSessionCount() const;
+			size_t getRetainedCount() const;
+
+		private:
+			struct Session {
+				std::string client_id;
+				std::string will_topic;
+				std::vector<std::string> subscriptions; // filters, removed from the broker's tables when the session ends
+				SimTime keep_alive;
+				SimTime last_seen;
+			};
+
+			struct Subscription {
+				BrokerClient * client;
+				uint8_t qos;
+			};
+
+			struct RetainedMessage {
+				std::string payload;
+				uint8_t qos;
+			};
+
+			EventLoop & _loop;
+			FleetStats & _stats;
+			BrokerConfig _config;
+			std::mt19937 _random;
+			CloudCallback _cloud;
+
+			std::unordered_map<BrokerClient *, Session> _sessions;
+			std::unordered_map<std::string, BrokerClient *> _clientIds;
+			std::unordered_map<std::string, std::vector<Subscription>> _subscriptions; // exact topic filters, found by the topic
+			std::map<std::string, std::vector<Subscription>> _wildcards; // filters with '+' or '#', matched one by one
+			std::map<std::string, RetainedMessage> _retained; // ordered, a subscription reads the range of its literal prefix
+			SimTime _busyUntil = 0; // broker CPU is busy until then
+			SimTime _downUntil = 0;
+			uint32_t _epoch = 0; // incremented by restart(), packets sent before it are lost
+
+			SimTime _link();
+
+			/*
+			* Queue a packet for the broker CPU when it arrives
+			* @param latency: network latency to the broker
+			* @param cost: broker CPU microseconds
+			* @param bytes: packet size
+			* @param handler: runs when the broker is done with the packet, skipped if the broker restarted meanwhile
+			*/
+			void _receive(SimTime latency, uint32_t cost, size_t bytes, std::function<void()> handler);
+
+			/*
+			* Send a message to a session, costs broker CPU after the packet being handled
+			* @param qos: granted QoS, the session acknowledges 1 and 2
+			*/
+			void _deliver(BrokerClient * client, const std::string & topic, const std::string & payload, uint8_t qos);
+
+			/*
+			* Deliver a message to the subscribed sessions, and device messages to the cloud
+			* @param qos: publish QoS, each subscriber gets at most its subscription QoS
+			* @param from_device: false for cloud messages, they are not sent back to the cloud
+			* @param sent_at: device publish time, the latency is measured when the cloud receives it
+			*/
+			void _route(const std::string & topic, const std::string & payload, uint8_t qos, bool from_device, SimTime sent_at);
+
+			/*
+			* Acknowledgement packets of a QoS 1 or 2 publish, each one costs ack_cost
+			* @param client: other side of the handshake, nullptr for the cloud subscriber
+			* @param packets: packets left, see _handshakePackets()
+			* @param broker_sends: the broker sends the next packet, false if the other side sends it
+			* @param sent_at: device publish time, the acknowledgement latency is recorded when the last packet reaches the
+			* device; 0 if the device did not publish
+			*/
+			void _handshake(BrokerClient * client, uint8_t packets, bool broker_sends, SimTime sent_at);
+
+			/*
+			* @return PUBACK for QoS 1; PUBREC, PUBREL and PUBCOMP for QoS 2
+			*/
+			static uint8_t _handshakePackets(uint8_t qos);
+
+			/*
+			* Remove the client from the subscribers of filter, and the filter once nobody is subscribed
+			* @param table: _subscriptions or _wildcards
+			*/
+			template <typename Table>
+			static void _unsubscribe(Table & table, const std::string & filter, BrokerClient * client);
+
+			/*
+			* MQTT filter matching, '+' matches one level and a trailing '#' the rest of the topic
+			*/
+			static bool _matches(const std::string & filter, const std::string & topic);
+
+			/*
+			* @param publish_will: the session timed out
+			* @param notify: tell the client its connection was reset
+			*/
+			void _drop(BrokerClient * client, bool publish_will, bool notify);
+			void _sweepKeepAlive();
+			void _touch(BrokerClient * client);
+	};
+};
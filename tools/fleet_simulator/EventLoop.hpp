@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+
+namespace XeoFleetSimulator {
+	typedef uint64_t SimTime; // microseconds of simulated time
+
+	const SimTime MILLISECOND = 1000;
+	const SimTime SECOND = 1000 * MILLISECOND;
+
+
+	/*
+	* Single threaded event loop on simulated time
+	* Events run in time order, events at the same time in the order they were scheduled. Nothing sleeps, the clock
+	* jumps to the next event, so thousands of devices run faster than real time in one process.
+	*/
+	class EventLoop {
+		public:
+			typedef std::function<void()> Callback;
+
+			SimTime now() const {
+				return this->_now;
+			}
+
+			/*
+			* @param delay: microseconds from now
+			*/
+			void after(SimTime delay, Callback callback) {
+				this->at(this->_now + delay, std::move(callback));
+			}
+
+			/*
+			* @param time: simulated time, events in the past run next
+			*/
+			void at(SimTime time, Callback callback) {
+				this->_events.push(Event{time < this->_now ? this->_now : time, this->_sequence++, std::move(callback)});
+			}
+
+			/*
+			* Run events until the queue is empty or the next event is after end
+			*/
+			void runUntil(SimTime end) {
+				while(not this->_events.empty() and this->_events.top().time <= end){
+					// the callback may schedule new events, it is moved out before the queue changes
+					Event event = std::move(const_cast<Event &>(this->_events.top()));
+					this->_events.pop();
+					this->_now = event.time;
+					this->_executed++;
+					event.callback();
+				}
+				this->_now = end;
+			}
+
+			uint64_t getExecuted() const {
+				return this->_executed;
+			}
+
+		private:
+			struct Event {
+				SimTime time;
+				uint64_t sequence;
+				Callback callback;
+
+				bool operator>(const Event & other) const {
+					return time != other.time ? time > other.time : sequence > other.sequence;
+				}
+			};
+
+			std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _events;
+			SimTime _now = 0;
+			uint64_t _sequence = 0;
+			uint64_t _executed = 0;
+	};
+};
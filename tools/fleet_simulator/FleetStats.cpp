@@ -0,0 +1,102 @@
+#include "FleetStats.hpp"
+#include <algorithm>
+
+
+// <LATENCY-HISTOGRAM>
+
+int XeoFleetSimulator::LatencyHistogram :: _bucket(uint64_t value) {
+	if(value < SUB_BUCKETS)
+		return value;
+
+	// the top 4 bits under the leading one pick the sub-bucket
+	int exponent = 63 - __builtin_clzll(value);
+	int sub_bucket = (value >> (exponent - 4)) & (SUB_BUCKETS - 1);
+	return (exponent - 3) * SUB_BUCKETS + sub_bucket;
+}
+
+
+uint64_t XeoFleetSimulator::LatencyHistogram :: _upperBound(int bucket) {
+	if(bucket < SUB_BUCKETS)
+		return bucket;
+
+	int exponent = bucket / SUB_BUCKETS + 3;
+	uint64_t sub_bucket = bucket % SUB_BUCKETS;
+	return ((SUB_BUCKETS + sub_bucket + 1) << (exponent - 4)) - 1;
+}
+
+
+void XeoFleetSimulator::LatencyHistogram :: record(uint64_t value) {
+	this->_buckets[_bucket(value)]++;
+	this->_count++;
+	if(value > this->_max)
+		this->_max = value;
+}
+
+
+uint64_t XeoFleetSimulator::LatencyHistogram :: percentile(double percentile) const {
+	if(this->_count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t) (percentile / 100 * this->_count);
+	if(rank >= this->_count)
+		rank = this->_count - 1;
+
+	uint64_t seen = 0;
+	for(int i = 0; i < BUCKETS; i++){
+		seen += this->_buckets[i];
+		if(seen > rank)
+			return std::min(_upperBound(i), this->_max);
+	}
+	return this->_max;
+}
+
+
+uint64_t XeoFleetSimulator::LatencyHistogram :: getCount() const {
+	return this->_count;
+}
+
+
+uint64_t XeoFleetSimulator::LatencyHistogram :: getMax() const {
+	return this->_max;
+}
+
+// </LATENCY-HISTOGRAM>
+// <FLEET-STATS>
+
+void XeoFleetSimulator::FleetStats :: closeSecond(uint32_t second, uint32_t connected) {
+	TimelineRow row;
+	row.second = second;
+	row.connected = connected;
+	row.inbound = this->inbound - this->_lastInbound;
+	row.outbound = this->outbound - this->_lastOutbound;
+	row.connects = this->connects - this->_lastConnects;
+	row.queue_p99 = this->_secondQueue.percentile(99);
+	this->_timeline.push_back(row);
+
+	this->_lastInbound = this->inbound;
+	this->_lastOutbound = this->outbound;
+	this->_lastConnects = this->connects;
+	this->_secondQueue = LatencyHistogram();
+}
+
+
+const std::vector<XeoFleetSimulator::TimelineRow> & XeoFleetSimulator::FleetStats :: getTimeline() const {
+	return this->_timeline;
+}
+
+
+uint32_t XeoFleetSimulator::FleetStats :: getPeakInbound() const {
+	uint32_t peak = 0;
+	for(const TimelineRow & row : this->_timeline)
+		peak = std::max(peak, row.inbound);
+	return peak;
+}
+
+
+void XeoFleetSimulator::FleetStats :: printTimeline(FILE * out) const {
+	fprintf(out, "%8s %10s %10s %10s %10s %14s\n", "second", "connected", "inbound", "outbound", "connects", "queue_p99_us");
+	for(const TimelineRow & row : this->_timeline)
+		fprintf(out, "%8u %10u %10u %10u %10u %14llu\n", row.second, row.connected, row.inbound, row.outbound, row.connects, (unsigned long long) row.queue_p99);
+}
+
+// </FLEET-STATS>
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "EventLoop.hpp"
+
+
+namespace XeoFleetSimulator {
+	/*
+	* Latency histogram with logarithmic buckets, 16 sub-buckets per power of two (about 6% resolution)
+	* Constant memory, so long runs with millions of messages do not keep every sample
+	*/
+	class LatencyHistogram {
+		public:
+			/*
+			* @param value: microseconds
+			*/
+			void record(uint64_t value);
+
+			/*
+			* @param percentile: 0 to 100
+			* @return upper bound of the bucket holding the percentile, microseconds; 0 if empty
+			*/
+			uint64_t percentile(double percentile) const;
+
+			uint64_t getCount() const;
+			uint64_t getMax() const;
+
+		private:
+			static const int SUB_BUCKETS = 16;
+			static const int BUCKETS = 64 * SUB_BUCKETS;
+
+			uint64_t _buckets[BUCKETS] = {};
+			uint64_t _count = 0;
+			uint64_t _max = 0;
+
+			static int _bucket(uint64_t value);
+			static uint64_t _upperBound(int bucket);
+	};
+
+
+	// one row of the per second timeline
+	struct TimelineRow {
+		uint32_t second;
+		uint32_t connected; // devices with an MQTT session at the end of the second
+		uint32_t inbound; // packets received by the broker
+		uint32_t outbound; // messages delivered to devices and to the cloud subscriber
+		uint32_t connects; // CONNECT packets, accepted or refused
+		uint64_t queue_p99; // broker queueing delay, microseconds
+	};
+
+
+	/*
+	* Counters shared by the broker and the devices
+	*/
+	class FleetStats {
+		public:
+			// broker
+			uint64_t inbound = 0; // packets received from devices
+			uint64_t inbound_bytes = 0;
+			uint64_t outbound = 0; // messages delivered
+			uint64_t outbound_bytes = 0;
+			uint64_t connects = 0;
+			uint64_t refused = 0; // CONNECTs while the broker was down
+			uint64_t takeovers = 0; // sessions replaced by a new CONNECT with the same client id
+			uint64_t wills = 0; // last wills published after keepalive timeouts
+			uint64_t pings = 0;
+			uint64_t handshakes = 0; // PUBACK, PUBREC, PUBREL and PUBCOMP packets, sent and received
+			std::map<std::string, uint64_t> topics; // publishes per topic, device prefix removed
+
+			// devices
+			uint64_t dropped = 0; // readings and publishes lost: no session, pending snapshot or MessagePack batch full, too old to replay
+			uint64_t replayed = 0; // pending sensor values sent after a reconnect
+			uint64_t actions_sent = 0; // cloud actions published
+			uint64_t actions_answered = 0; // status updates received for cloud actions
+
+			LatencyHistogram publish_latency; // device publish to cloud subscriber
+			LatencyHistogram action_latency; // cloud action to status update
+			LatencyHistogram ack_latency; // device QoS 1 or 2 publish to its PUBACK or PUBCOMP
+			LatencyHistogram connect_latency; // CONNECT sent to CONNACK received
+			LatencyHistogram queue_delay; // time packets wait for the broker
+
+			/*
+			* Move counters of the current second into the timeline
+			* @param second: simulated second that ended
+			* @param connected: devices connected at the end of the second
+			*/
+			void closeSecond(uint32_t second, uint32_t connected);
+
+			const std::vector<TimelineRow> & getTimeline() const;
+
+			/*
+			* @return highest inbound rate of a single second
+			*/
+			uint32_t getPeakInbound() const;
+
+			void printTimeline(FILE * out) const;
+
+		private:
+			std::vector<TimelineRow> _timeline;
+			LatencyHistogram _secondQueue; // queue_delay of the current second, reset by closeSecond()
+			uint64_t _lastInbound = 0;
+			uint64_t _lastOutbound = 0;
+			uint64_t _lastConnects = 0;
+
+			friend class Broker;
+	};
+};
@@ -0,0 +1,362 @@
+#include "VirtualDevice.hpp"
+#include <algorithm>
+#include <cstdio>
+
+
+// from XeoSmartHomeDevice.h, which needs the ESP8266 SDK and is not built on the host
+#define MQTT_PRESENCE_ONLINE "online"
+#define SNAPSHOT_PENDING_COUNT 4 // sensor values waiting for MQTT kept across warm restarts
+#define SNAPSHOT_PENDING_MAX_AGE 3600 // seconds, older pending sensor values are dropped
+#define TELEMETRY_BATCH_SIZE 512 // bytes, MessagePack telemetry batch document capacity
+
+#define MQTT_SUBSCRIBE_QOS 2 // _onMqttConnected()
+#define JSON_SLOT_SIZE 16 // ArduinoJson 6 on the ESP8266: one slot per object member or array element, JSON_OBJECT_SIZE(1)
+#define MSGPACK_FLOAT_SIZE 5 // float32, ArduinoJson writes floats that fit exactly that way
+#define MSGPACK_WINDOW_SIZE 41 // map of 5 without the count value: "min", "max", "mean", "last" floats and the "n" key
+#define TIMESTAMP_BASE 1700000000 // unix time of the simulation start, ts fields
+
+
+/*
+* @return bytes of a MessagePack positive integer
+*/
+static size_t msgpackUintSize(uint32_t value) {
+	return value < 128 ? 1 : value < 256 ? 2 : value < 65536 ? 3 : 5;
+}
+
+
+/*
+* @return bytes of a map or array header: fixmap and fixarray up to 15 members, 16 bit length above
+*/
+static size_t msgpackHeaderSize(size_t count) {
+	return count < 16 ? 1 : 3;
+}
+
+
+/*
+* @return bytes of a MessagePack string: fixstr up to 31 bytes, 8 bit length above
+*/
+static size_t msgpackStringSize(size_t len) {
+	return len + (len < 32 ? 1 : 2);
+}
+
+
+XeoFleetSimulator::VirtualDevice :: VirtualDevice(uint32_t index, EventLoop & loop, Broker & broker, FleetStats & stats, const DeviceProfile & profile, uint32_t seed) :
+	_loop(loop), _broker(broker), _stats(stats), _profile(profile), _random(seed) {
+
+	char serial[16];
+	snprintf(serial, sizeof(serial), "SIM%07u", index);
+	this->_serial = serial;
+	this->_prefix = "device/" + this->_serial + "/";
+	this->_statuses.assign(this->_profile.statuses, 0);
+
+	// same routes as _initTopicRouter(), the device subscribes to each pattern
+	this->_router.add("action", [this](char * payload, size_t len, size_t index, size_t total){
+		unsigned status = 0;
+		int value = 0;
+		const char * parameters = strstr(payload, "\"parameters\":[");
+		if(parameters == nullptr or sscanf(parameters, "\"parameters\":[%u,%d]", &status, &value) != 2 or status >= this->_statuses.size())
+			return;
+
+		this->_statuses[status] = value;
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "status/status_%u", status);
+		this->_publish(suffix, std::to_string(value), 2);
+	});
+	this->_router.add("get_state", [this](char * payload, size_t len, size_t index, size_t total){
+		this->_sendState();
+	});
+	this->_router.add("config", [this](char * payload, size_t len, size_t index, size_t total){
+		this->_publish("config/status", "{\"status\":\"applied\",\"changed\":0,\"reboot\":false}", 1);
+	});
+
+	// the simulated backend does not send these, they are routed for their subscriptions
+	for(const char * pattern : {"action/msgpack", "schedule_update", "ota", "ota/chunk"})
+		this->_router.add(pattern, [](char * payload, size_t len, size_t index, size_t total){});
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: boot(SimTime at) {
+	this->_loop.at(at, [this](){
+		// sensors run from boot: JSON windows completed without a connection are lost, MessagePack windows wait in the
+		// batch and values in the pending snapshot
+		SimTime window = this->_profile.sample_period * this->_profile.window_samples;
+		this->_every(window, this->_random() % window + 1, &VirtualDevice::_sampleSensors, false);
+		if(this->_profile.value_interval > 0)
+			this->_every(this->_profile.value_interval, this->_random() % this->_profile.value_interval + 1, &VirtualDevice::_sendSensorValues, false);
+		if(this->_profile.msgpack)
+			this->_every(this->_profile.telemetry_interval, this->_profile.telemetry_interval, &VirtualDevice::_flushTelemetry, false);
+
+		SimTime wifi = this->_profile.wifi_connect / 2 + this->_random() % (this->_profile.wifi_connect + 1);
+		this->_loop.after(wifi, [this](){
+			this->_connect();
+		});
+	});
+}
+
+
+bool XeoFleetSimulator::VirtualDevice :: isConnected() const {
+	return this->_connected;
+}
+
+
+const std::string & XeoFleetSimulator::VirtualDevice :: getSerial() const {
+	return this->_serial;
+}
+
+// <MQTT>
+
+void XeoFleetSimulator::VirtualDevice :: onConnack(bool accepted) {
+	this->_connection++;
+	if(not accepted){
+		this->_failures++;
+		this->_scheduleReconnect();
+		return;
+	}
+
+	this->_stats.connect_latency.record(this->_loop.now() - this->_connectSentAt);
+	this->_connected = true;
+	this->_failures = 0;
+
+	// same order as _onMqttConnected(): the handled topics only, the device does not get its own publications back
+	this->_router.forEachPattern([this](const char * pattern){
+		this->_broker.subscribe(this, this->_prefix + pattern, MQTT_SUBSCRIBE_QOS);
+	});
+	this->_publish("presence", MQTT_PRESENCE_ONLINE, 1, true);
+	this->_sendState();
+	this->_sendPendingSensorValues();
+	this->_flushTelemetry(); // windows batched while disconnected
+
+	if(this->_profile.health_interval > 0)
+		this->_every(this->_profile.health_interval * SECOND, this->_profile.health_interval * SECOND, &VirtualDevice::_sendHealthReport, true);
+	this->_checkKeepAlive();
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: onConnectionLost() {
+	if(not this->_connected)
+		return;
+
+	this->_connected = false;
+	this->_connection++;
+	this->_scheduleReconnect();
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: onMessage(const std::string & topic, const std::string & payload) {
+	if(not this->_connected or topic.compare(0, this->_prefix.size(), this->_prefix) != 0)
+		return;
+
+	std::string buffer = payload; // handlers may decode in place
+	this->_router.route(topic.c_str() + this->_prefix.size(), &buffer[0], buffer.size(), 0, buffer.size());
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _connect() {
+	this->_connectSentAt = this->_loop.now();
+	this->_lastSent = this->_loop.now();
+	this->_broker.connect(this, this->_serial, this->_profile.keep_alive, this->_prefix + "presence");
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _scheduleReconnect() {
+	SimTime delay;
+	switch(this->_profile.reconnect){
+	case RECONNECT_FIXED:
+		delay = this->_profile.retry_delay;
+		break;
+
+	case RECONNECT_BACKOFF: {
+		// full jitter: uniform in [0, min(max, base * 2^failures)]
+		SimTime cap = std::min(this->_profile.backoff_max, this->_profile.retry_delay << std::min<uint8_t>(this->_failures, 16));
+		delay = this->_random() % (cap + 1);
+		break;
+	}
+
+	default:
+		return; // AsyncMqttClient does not reconnect by itself, the firmware waits for a WiFi reconnect
+	}
+
+	uint32_t connection = this->_connection;
+	this->_loop.after(delay, [this, connection](){
+		if(connection == this->_connection)
+			this->_connect();
+	});
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _publish(const char * suffix, const std::string & payload, uint8_t qos, bool retain) {
+	if(not this->_connected){
+		this->_stats.dropped++;
+		return;
+	}
+
+	this->_broker.publish(this, this->_prefix + suffix, payload, qos, retain);
+	this->_lastSent = this->_loop.now();
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _every(SimTime interval, SimTime first, void (VirtualDevice::*callback)(), bool per_connection) {
+	uint32_t connection = this->_connection;
+	this->_loop.after(first, [this, interval, callback, per_connection, connection](){
+		if(per_connection and connection != this->_connection)
+			return;
+
+		(this->*callback)();
+		this->_every(interval, interval, callback, per_connection);
+	});
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _checkKeepAlive() {
+	// AsyncMqttClient pings when nothing was sent for a keepalive interval
+	SimTime keep_alive = this->_profile.keep_alive * SECOND;
+	if(this->_loop.now() - this->_lastSent >= keep_alive){
+		this->_broker.ping(this);
+		this->_lastSent = this->_loop.now();
+	}
+
+	uint32_t connection = this->_connection;
+	this->_loop.at(this->_lastSent + keep_alive, [this, connection](){
+		if(connection == this->_connection)
+			this->_checkKeepAlive();
+	});
+}
+
+// </MQTT>
+// <TELEMETRY>
+
+void XeoFleetSimulator::VirtualDevice :: _sampleSensors() {
+	for(uint8_t i = 0; i < this->_profile.sensors; i++){
+		char name[16];
+		snprintf(name, sizeof(name), "sensor_%u", i);
+
+		float mean = 20 + (this->_random() % 1000) / 100.0f;
+		if(this->_profile.msgpack){
+			// same room check as _sendSensorWindow(): a new key, its array, the window object and the key copy
+			if(this->_telemetryMemory + 7 * JSON_SLOT_SIZE + strlen(name) + 8 > TELEMETRY_BATCH_SIZE){
+				if(not this->_connected){
+					this->_stats.dropped++; // batch is full until the next connection
+					continue;
+				}
+				this->_flushTelemetry();
+			}
+
+			// windows of a sensor are appended to its array, the array element and the 5 members of the window
+			std::string key = std::string(name) + "/window";
+			auto entry = this->_telemetryBatch.find(key);
+			if(entry == this->_telemetryBatch.end()){
+				entry = this->_telemetryBatch.emplace(key, BatchEntry{0, 0}).first;
+				this->_telemetryMemory += JSON_SLOT_SIZE + key.size() + 1;
+			}
+			entry->second.bytes += MSGPACK_WINDOW_SIZE + msgpackUintSize(this->_profile.window_samples);
+			entry->second.values++;
+			this->_telemetryMemory += 6 * JSON_SLOT_SIZE;
+			continue;
+		}
+
+		if(not this->_connected){
+			this->_stats.dropped++; // _sendSensorWindow() does not keep JSON windows
+			continue;
+		}
+
+		char payload[128];
+		snprintf(payload, sizeof(payload), "{\"min\":%.3f,\"max\":%.3f,\"mean\":%.3f,\"last\":%.3f,\"n\":%u}",
+			mean - 0.5f, mean + 0.5f, mean, mean + 0.1f, this->_profile.window_samples);
+		this->_publish((std::string("sensor/") + name + "/window").c_str(), payload, 1);
+	}
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _sendSensorValues() {
+	for(uint8_t i = 0; i < this->_profile.sensors; i++){
+		float value = 20 + (this->_random() % 1000) / 100.0f;
+		if(not this->_connected){
+			this->_snapshotPendingSensorValue(i, value);
+			continue;
+		}
+
+		char name[16];
+		snprintf(name, sizeof(name), "sensor_%u", i);
+		if(this->_profile.msgpack){
+			// same room check as sendSensorData(): a new key, a nested array and the value
+			if(this->_telemetryMemory + 2 * JSON_SLOT_SIZE + strlen(name) + 1 > TELEMETRY_BATCH_SIZE)
+				this->_flushTelemetry();
+
+			auto entry = this->_telemetryBatch.find(name);
+			if(entry == this->_telemetryBatch.end()){
+				entry = this->_telemetryBatch.emplace(name, BatchEntry{0, 0}).first;
+				this->_telemetryMemory += JSON_SLOT_SIZE + strlen(name) + 1;
+			}
+			entry->second.bytes += MSGPACK_FLOAT_SIZE;
+			entry->second.values++;
+			this->_telemetryMemory += JSON_SLOT_SIZE;
+			continue;
+		}
+
+		// String(float), two decimals
+		char payload[16];
+		snprintf(payload, sizeof(payload), "%.2f", value);
+		this->_publish((std::string("sensor/") + name).c_str(), payload, 2);
+	}
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _snapshotPendingSensorValue(uint8_t sensor, float value) {
+	if(this->_pending.size() == SNAPSHOT_PENDING_COUNT){
+		this->_pending.erase(this->_pending.begin());
+		this->_stats.dropped++;
+	}
+	this->_pending.push_back(PendingValue{sensor, value, this->_loop.now()});
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _sendPendingSensorValues() {
+	for(const PendingValue & entry : this->_pending){
+		if(this->_loop.now() - entry.read_at > SNAPSHOT_PENDING_MAX_AGE * SECOND){
+			this->_stats.dropped++;
+			continue;
+		}
+
+		char suffix[48];
+		char payload[64];
+		snprintf(suffix, sizeof(suffix), "sensor/sensor_%u/pending", entry.sensor);
+		snprintf(payload, sizeof(payload), "{\"value\":%.3f,\"ts\":%u}", entry.value, (unsigned) (TIMESTAMP_BASE + entry.read_at / SECOND));
+		this->_publish(suffix, payload, 2);
+		this->_stats.replayed++;
+	}
+	this->_pending.clear();
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _flushTelemetry() {
+	// without a connection the batch waits for the next flush
+	if(this->_telemetryBatch.empty() or not this->_connected)
+		return;
+
+	size_t len = msgpackHeaderSize(this->_telemetryBatch.size());
+	for(const auto & entry : this->_telemetryBatch)
+		len += msgpackStringSize(entry.first.size()) + msgpackHeaderSize(entry.second.values) + entry.second.bytes;
+
+	this->_publish("sensors/msgpack", std::string(std::min<size_t>(len, TELEMETRY_BATCH_SIZE), '\0'), 1);
+	this->_telemetryBatch.clear();
+	this->_telemetryMemory = 0;
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _sendHealthReport() {
+	char payload[128];
+	snprintf(payload, sizeof(payload), "{\"uptime\":%lu,\"heap\":%u,\"rssi\":%d,\"resets\":%u,\"stalls\":%u}",
+		(unsigned long) (this->_loop.now() / SECOND), 24000 + (unsigned) (this->_random() % 4000), -50 - (int) (this->_random() % 30), 1u, 0u);
+	this->_publish("health", payload, 0);
+}
+
+
+void XeoFleetSimulator::VirtualDevice :: _sendState() {
+	std::string payload = "{\"ts\":" + std::to_string(TIMESTAMP_BASE + this->_loop.now() / SECOND) + ",\"status\":{";
+	for(size_t i = 0; i < this->_statuses.size(); i++)
+		payload += (i > 0 ? ",\"status_" : "\"status_") + std::to_string(i) + "\":" + std::to_string(this->_statuses[i]);
+	payload += "}}";
+	this->_publish("state", payload, 1, true);
+}
+
+// </TELEMETRY>
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "EventLoop.hpp"
+#include "Broker.hpp"
+#include "FleetStats.hpp"
+#include "TopicRouter.hpp"
+
+
+namespace XeoFleetSimulator {
+	enum ReconnectPolicy {
+		RECONNECT_NONE, // firmware behavior: MQTT is only started again when WiFi reconnects
+		RECONNECT_FIXED, // retry after a fixed delay, the usual AsyncMqttClient example
+		RECONNECT_BACKOFF // exponential backoff with full jitter
+	};
+
+	// defaults follow the firmware, see XeoSmartHomeDevice.h
+	struct DeviceProfile {
+		uint16_t keep_alive = 60; // MQTT_KEEP_ALIVE, seconds
+		uint32_t health_interval = 0; // setHealthReportInterval(), seconds, 0 disables it like the firmware default
+		uint8_t sensors = 2;
+		SimTime sample_period = SECOND;
+		uint32_t window_samples = 10; // readings aggregated in a sensor window, addSensor()
+		SimTime value_interval = 60 * SECOND; // sendSensorData() of each sensor from the sketch, 0 disables it
+		bool msgpack = false; // WIRE_FORMAT_MSGPACK: windows and values are batched on sensors/msgpack
+		SimTime telemetry_interval = 10 * SECOND; // TELEMETRY_BATCH_INTERVAL
+		uint8_t statuses = 4; // statuses in the retained state
+
+		SimTime wifi_connect = 2 * SECOND; // mean WiFi association and DHCP time after boot
+		ReconnectPolicy reconnect = RECONNECT_NONE;
+		SimTime retry_delay = 2 * SECOND; // fixed delay, first backoff step
+		SimTime backoff_max = 60 * SECOND;
+	};
+
+
+	/*
+	* One simulated XeoSmartHome device
+	* Publishes what the firmware publishes, with the same topics, QoS and payload sizes: retained presence and state on
+	* connect, sensor windows and values (JSON, or MessagePack batches), health reports and keepalive pings. Values read
+	* without a connection are kept like the snapshot's pending values and sent on sensor/<name>/pending on connect.
+	* The device subscribes to the patterns of the firmware's TopicRouter, messages are routed through it; actions are
+	* answered with a status update.
+	*/
+	class VirtualDevice : public BrokerClient {
+		public:
+			/*
+			* @param index: device number, the serial is derived from it
+			*/
+			VirtualDevice(uint32_t index, EventLoop & loop, Broker & broker, FleetStats & stats, const DeviceProfile & profile, uint32_t seed);
+
+			/*
+			* Power on the device
+			* @param at: boot time
+			*/
+			void boot(SimTime at);
+
+			bool isConnected() const;
+			const std::string & getSerial() const;
+
+			void onConnack(bool accepted) override;
+			void onConnectionLost() override;
+			void onMessage(const std::string & topic, const std::string & payload) override;
+
+		private:
+			// a sensor value read without a connection, see SnapshotSensorValue
+			struct PendingValue {
+				uint8_t sensor;
+				float value;
+				SimTime read_at;
+			};
+
+			// member of the MessagePack batch document
+			struct BatchEntry {
+				size_t bytes; // MessagePack of the array elements, without the header of the array
+				uint32_t values; // elements of the array: sensor values, or windows under "<sensor>/window"
+			};
+
+			EventLoop & _loop;
+			Broker & _broker;
+			FleetStats & _stats;
+			DeviceProfile _profile;
+			std::mt19937 _random;
+			XeoSmartHomeInternals::TopicRouter _router;
+
+			std::string _serial;
+			std::string _prefix; // "device/<serial>/"
+			bool _connected = false;
+			uint32_t _connection = 0; // incremented on every connect and disconnect, timers of an old connection stop
+			SimTime _connectSentAt = 0;
+			SimTime _lastSent = 0; // keepalive starts from the last packet
+			uint8_t _failures = 0; // connection attempts since the last CONNACK
+
+			std::vector<int32_t> _statuses;
+			std::vector<PendingValue> _pending; // oldest first, SNAPSHOT_PENDING_COUNT at most
+			std::map<std::string, BatchEntry> _telemetryBatch; // one array per key, like in the JsonDocument
+			size_t _telemetryMemory = 0; // memoryUsage() of the batch document
+
+			void _connect();
+			void _scheduleReconnect();
+			void _publish(const char * suffix, const std::string & payload, uint8_t qos, bool retain = false);
+
+			/*
+			* Repeat callback
+			* @param first: delay of the first call
+			* @param per_connection: stop when the connection is lost, otherwise run until the simulation ends
+			*/
+			void _every(SimTime interval, SimTime first, void (VirtualDevice::*callback)(), bool per_connection);
+
+			void _sampleSensors();
+			void _sendSensorValues();
+			void _snapshotPendingSensorValue(uint8_t sensor, float value);
+			void _sendPendingSensorValues();
+			void _flushTelemetry();
+			void _sendHealthReport();
+			void _sendState();
+			void _checkKeepAlive();
+	};
+};
@@ -0,0 +1,266 @@
+// Fleet simulator: N virtual XeoSmartHome devices against a broker stand-in, in one process on simulated time
+//
+// Build and run from this directory:
+//   make
+//   ./fleet_simulator --devices 5000 --duration 600
+//   ./fleet_simulator --devices 5000 --scenario broker-restart --reconnect backoff --timeline
+//
+// Devices publish what the firmware publishes (presence, state, sensor windows and values, pending values after a
+// reconnect, health, action answers) with its topics, QoS, intervals and payload sizes; they subscribe to the patterns
+// of the firmware's TopicRouter and route incoming messages through it. The broker charges CPU time per packet,
+// QoS 1 and 2 handshakes included, in one FIFO queue, so boot storms and mass reconnects show up as queueing latency.
+// Broker costs and link latency are model parameters, calibrate them against the real broker before trusting
+// absolute numbers; rates, burst shapes and relative changes do not depend on them.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "EventLoop.hpp"
+#include "Broker.hpp"
+#include "FleetStats.hpp"
+#include "VirtualDevice.hpp"
+
+using namespace XeoFleetSimulator;
+
+
+enum Scenario {
+	SCENARIO_STEADY, // devices boot over the ramp and run
+	SCENARIO_BOOT_STORM, // every device boots in the same second, e.g. after a power cut
+	SCENARIO_BROKER_RESTART // the broker restarts and drops every session
+};
+
+
+struct Options {
+	uint32_t devices = 1000;
+	uint32_t duration = 300; // seconds of simulated time
+	uint32_t ramp = 60; // seconds over which devices boot
+	Scenario scenario = SCENARIO_STEADY;
+	uint32_t restart_at = 0; // seconds, 0 for the middle of the run
+	uint32_t down = 10; // seconds the broker is down
+	double action_rate = 1; // cloud actions per second, fleet wide
+	uint32_t seed = 1;
+	bool timeline = false;
+	DeviceProfile profile;
+	BrokerConfig broker;
+};
+
+
+static void usage(const char * name) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --devices N            virtual devices (1000)\n"
+		"  --duration S           simulated seconds (300)\n"
+		"  --ramp S               devices boot over S seconds (60)\n"
+		"  --scenario NAME        steady, boot-storm or broker-restart (steady)\n"
+		"  --restart-at S         broker restart time (middle of the run)\n"
+		"  --down S               broker downtime (10)\n"
+		"  --reconnect POLICY     none (firmware), fixed or backoff (none)\n"
+		"  --retry-ms MS          fixed retry delay, first backoff step (2000)\n"
+		"  --backoff-max-ms MS    longest backoff (60000)\n"
+		"  --sensors N            sensors per device (2)\n"
+		"  --sample-ms MS         sensor sample period (1000)\n"
+		"  --window N             samples per sensor window (10)\n"
+		"  --value-s S            sendSensorData() interval per sensor, 0 disables it (60)\n"
+		"  --format FORMAT        json or msgpack (json)\n"
+		"  --health S             health report interval, 0 disables (0)\n"
+		"  --keep-alive S         MQTT keepalive (60)\n"
+		"  --action-rate R        cloud actions per second (1)\n"
+		"  --latency-ms MS        device to broker latency (3)\n"
+		"  --jitter-ms MS         latency jitter (2)\n"
+		"  --connect-cost-us US   broker CPU per CONNECT (300)\n"
+		"  --publish-cost-us US   broker CPU per PUBLISH (12)\n"
+		"  --deliver-cost-us US   broker CPU per delivered message (4)\n"
+		"  --ack-cost-us US       broker CPU per PUBACK, PUBREC, PUBREL or PUBCOMP (2)\n"
+		"  --cloud-qos N          QoS of the backend subscription and actions (1)\n"
+		"  --seed N               random seed (1)\n"
+		"  --timeline             print one line per simulated second\n",
+		name);
+	exit(2);
+}
+
+
+static Options parseOptions(int argc, char ** argv) {
+	Options options;
+	for(int i = 1; i < argc; i++){
+		const char * option = argv[i];
+		if(strcmp(option, "--timeline") == 0){
+			options.timeline = true;
+			continue;
+		}
+		if(i + 1 >= argc)
+			usage(argv[0]);
+		const char * value = argv[++i];
+		unsigned long number = strtoul(value, nullptr, 10);
+
+		if(strcmp(option, "--devices") == 0) options.devices = number;
+		else if(strcmp(option, "--duration") == 0) options.duration = number;
+		else if(strcmp(option, "--ramp") == 0) options.ramp = number;
+		else if(strcmp(option, "--restart-at") == 0) options.restart_at = number;
+		else if(strcmp(option, "--down") == 0) options.down = number;
+		else if(strcmp(option, "--retry-ms") == 0) options.profile.retry_delay = number * MILLISECOND;
+		else if(strcmp(option, "--backoff-max-ms") == 0) options.profile.backoff_max = number * MILLISECOND;
+		else if(strcmp(option, "--sensors") == 0) options.profile.sensors = number;
+		else if(strcmp(option, "--sample-ms") == 0) options.profile.sample_period = number * MILLISECOND;
+		else if(strcmp(option, "--window") == 0) options.profile.window_samples = number;
+		else if(strcmp(option, "--value-s") == 0) options.profile.value_interval = number * SECOND;
+		else if(strcmp(option, "--health") == 0) options.profile.health_interval = number;
+		else if(strcmp(option, "--keep-alive") == 0) options.profile.keep_alive = number;
+		else if(strcmp(option, "--action-rate") == 0) options.action_rate = atof(value);
+		else if(strcmp(option, "--latency-ms") == 0) options.broker.link_latency = number * MILLISECOND;
+		else if(strcmp(option, "--jitter-ms") == 0) options.broker.link_jitter = number * MILLISECOND;
+		else if(strcmp(option, "--connect-cost-us") == 0) options.broker.connect_cost = number;
+		else if(strcmp(option, "--publish-cost-us") == 0) options.broker.publish_cost = number;
+		else if(strcmp(option, "--deliver-cost-us") == 0) options.broker.deliver_cost = number;
+		else if(strcmp(option, "--ack-cost-us") == 0) options.broker.ack_cost = number;
+		else if(strcmp(option, "--cloud-qos") == 0) options.broker.cloud_qos = number;
+		else if(strcmp(option, "--seed") == 0) options.seed = number;
+		else if(strcmp(option, "--format") == 0){
+			if(strcmp(value, "json") != 0 and strcmp(value, "msgpack") != 0)
+				usage(argv[0]);
+			options.profile.msgpack = strcmp(value, "msgpack") == 0;
+		}
+		else if(strcmp(option, "--scenario") == 0){
+			if(strcmp(value, "steady") == 0) options.scenario = SCENARIO_STEADY;
+			else if(strcmp(value, "boot-storm") == 0) options.scenario = SCENARIO_BOOT_STORM;
+			else if(strcmp(value, "broker-restart") == 0) options.scenario = SCENARIO_BROKER_RESTART;
+			else usage(argv[0]);
+		}
+		else if(strcmp(option, "--reconnect") == 0){
+			if(strcmp(value, "none") == 0) options.profile.reconnect = RECONNECT_NONE;
+			else if(strcmp(value, "fixed") == 0) options.profile.reconnect = RECONNECT_FIXED;
+			else if(strcmp(value, "backoff") == 0) options.profile.reconnect = RECONNECT_BACKOFF;
+			else usage(argv[0]);
+		}
+		else usage(argv[0]);
+	}
+
+	if(options.devices == 0 or options.duration == 0 or options.profile.window_samples == 0 or options.profile.sample_period == 0 or options.profile.keep_alive == 0 or options.broker.cloud_qos > 2)
+		usage(argv[0]);
+	if(options.scenario == SCENARIO_BOOT_STORM)
+		options.ramp = 1;
+	if(options.restart_at == 0)
+		options.restart_at = options.duration / 2;
+	return options;
+}
+
+
+static void printLatency(const char * name, const LatencyHistogram & histogram) {
+	printf("%-22s n=%-10llu p50=%8.2f ms  p90=%8.2f ms  p99=%8.2f ms  p99.9=%8.2f ms  max=%8.2f ms\n", name,
+		(unsigned long long) histogram.getCount(), histogram.percentile(50) / 1000.0, histogram.percentile(90) / 1000.0,
+		histogram.percentile(99) / 1000.0, histogram.percentile(99.9) / 1000.0, histogram.getMax() / 1000.0);
+}
+
+
+/*
+* Seconds after the broker came back until count sessions were connected again
+* @return -1 if it did not happen before the end of the run
+*/
+static int recoveryTime(const FleetStats & stats, uint32_t up_at, uint32_t count) {
+	for(const TimelineRow & row : stats.getTimeline()){
+		if(row.second >= up_at and row.connected >= count)
+			return row.second - up_at;
+	}
+	return -1;
+}
+
+
+int main(int argc, char ** argv) {
+	Options options = parseOptions(argc, argv);
+
+	EventLoop loop;
+	FleetStats stats;
+	Broker broker(loop, stats, options.broker, options.seed);
+	std::mt19937 random(options.seed);
+
+	std::vector<std::unique_ptr<VirtualDevice>> devices;
+	devices.reserve(options.devices);
+	for(uint32_t i = 0; i < options.devices; i++){
+		devices.emplace_back(new VirtualDevice(i, loop, broker, stats, options.profile, random()));
+		devices.back()->boot(random() % (options.ramp * SECOND));
+	}
+
+	// backend: actions to random connected devices, answered by a status update
+	std::unordered_map<std::string, SimTime> pending_actions; // serial, time the action was sent
+	broker.setCloudSubscriber([&](const std::string & topic, const std::string & payload, SimTime sent_at){
+		if(topic.find("/status/") == std::string::npos)
+			return;
+		std::string serial = topic.substr(strlen("device/"), topic.find('/', strlen("device/")) - strlen("device/"));
+		auto pending = pending_actions.find(serial);
+		if(pending == pending_actions.end())
+			return;
+		stats.action_latency.record(loop.now() - pending->second);
+		stats.actions_answered++;
+		pending_actions.erase(pending);
+	});
+
+	std::function<void()> send_action = [&](){
+		VirtualDevice & device = *devices[random() % devices.size()];
+		if(device.isConnected() and pending_actions.count(device.getSerial()) == 0){
+			char payload[64];
+			snprintf(payload, sizeof(payload), "{\"name\":\"set_status\",\"parameters\":[%u,%u]}", (unsigned) (random() % options.profile.statuses), (unsigned) (random() % 2));
+			pending_actions[device.getSerial()] = loop.now();
+			stats.actions_sent++;
+			broker.cloudPublish("device/" + device.getSerial() + "/action", payload);
+		}
+		loop.after((SimTime) (SECOND / options.action_rate), send_action);
+	};
+	if(options.action_rate > 0)
+		loop.after((SimTime) (SECOND / options.action_rate), send_action);
+
+	uint32_t sessions_before_restart = 0;
+	if(options.scenario == SCENARIO_BROKER_RESTART){
+		loop.at(options.restart_at * SECOND, [&](){
+			sessions_before_restart = broker.getSessionCount();
+			broker.restart(options.down * SECOND);
+		});
+	}
+
+	std::clock_t cpu_start = std::clock();
+	for(uint32_t second = 1; second <= options.duration; second++){
+		loop.runUntil(second * SECOND);
+		stats.closeSecond(second, broker.getSessionCount());
+	}
+	double cpu_seconds = (double) (std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+	if(options.timeline)
+		stats.printTimeline(stdout);
+
+	printf("devices %u, %u s simulated, %llu events, %.2f s CPU (%.0fx real time)\n", options.devices, options.duration,
+		(unsigned long long) loop.getExecuted(), cpu_seconds, cpu_seconds > 0 ? options.duration / cpu_seconds : 0);
+	printf("simulator CPU          %.2f us per device per simulated second\n", cpu_seconds * 1e6 / options.devices / options.duration);
+	printf("broker inbound         %.1f msg/s average, %u msg/s peak, %.1f kB/s\n", (double) stats.inbound / options.duration, stats.getPeakInbound(), stats.inbound_bytes / 1024.0 / options.duration);
+	printf("broker outbound        %.1f msg/s average, %.1f kB/s\n", (double) stats.outbound / options.duration, stats.outbound_bytes / 1024.0 / options.duration);
+	printf("sessions               %zu at the end, %llu connects, %llu refused, %llu takeovers, %llu wills, %llu pings, %zu retained\n",
+		broker.getSessionCount(), (unsigned long long) stats.connects, (unsigned long long) stats.refused, (unsigned long long) stats.takeovers,
+		(unsigned long long) stats.wills, (unsigned long long) stats.pings, broker.getRetainedCount());
+	printf("handshakes             %.1f packets/s (PUBACK, PUBREC, PUBREL, PUBCOMP)\n", (double) stats.handshakes / options.duration);
+	printf("device readings lost   %llu (no session, pending snapshot or batch full, too old), %llu pending values replayed\n",
+		(unsigned long long) stats.dropped, (unsigned long long) stats.replayed);
+	printf("actions                %llu sent, %llu answered\n", (unsigned long long) stats.actions_sent, (unsigned long long) stats.actions_answered);
+	printLatency("publish latency", stats.publish_latency);
+	printLatency("publish ack", stats.ack_latency);
+	printLatency("action round trip", stats.action_latency);
+	printLatency("connect latency", stats.connect_latency);
+	printLatency("broker queue delay", stats.queue_delay);
+
+	printf("topics (per device per minute):\n");
+	for(const auto & topic : stats.topics)
+		printf("  %-24s %10llu  %8.2f\n", topic.first.c_str(), (unsigned long long) topic.second, topic.second * 60.0 / options.devices / options.duration);
+
+	if(options.scenario == SCENARIO_BROKER_RESTART){
+		uint32_t up_at = options.restart_at + options.down;
+		int recovered_99 = recoveryTime(stats, up_at, (sessions_before_restart * 99 + 99) / 100);
+		int recovered_all = recoveryTime(stats, up_at, sessions_before_restart);
+		printf("broker restart         %u sessions before, %zu at the end; 99%% back after %d s, all back after %d s (-1: not within the run)\n",
+			sessions_before_restart, broker.getSessionCount(), recovered_99, recovered_all);
+		if(options.profile.reconnect == RECONNECT_NONE and broker.getSessionCount() < sessions_before_restart)
+			printf("                       firmware does not reconnect MQTT until WiFi drops, try --reconnect fixed or backoff\n");
+	}
+	return 0;
+}
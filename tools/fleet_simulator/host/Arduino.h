@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stand-in for the Arduino core, only what the library modules built by the simulator use
+// (TopicRouter). Modules that need the ESP8266 SDK are not built on the host.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define PROGMEM
+#define PSTR(s) (s)
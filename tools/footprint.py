@@ -0,0 +1,84 @@
+# Footprint report: RAM and flash used by each XeoSmartHome module
+#
+# Added to the build by extra_scripts in platformio.ini, run it with:
+#   pio run -e d1_mini -t footprint
+#
+# Sizes are taken from the library object files, before the linker drops unused sections, so they are an
+# upper bound for each module. On ESP8266 .rodata is copied to RAM at boot, strings that are not in PROGMEM
+# show up in both columns.
+
+import os
+import subprocess
+
+Import("env")
+
+
+LIBRARY_PREFIX = "XeoSmartHome"
+
+
+def section_kind(name):
+    if name.startswith((".irom", ".text", ".literal")):
+        return "flash"
+    if name.startswith((".data", ".rodata")):
+        return "data" # initial values in flash, copied to RAM
+    if name.startswith((".bss", "COMMON")):
+        return "ram"
+    return None
+
+
+def object_footprint(size_tool, path):
+    output = subprocess.check_output([size_tool, "-A", path]).decode()
+    flash = ram = 0
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) < 2 or not fields[1].isdigit():
+            continue
+        kind = section_kind(fields[0])
+        size = int(fields[1])
+        if kind in ("flash", "data"):
+            flash += size
+        if kind in ("data", "ram"):
+            ram += size
+    return flash, ram
+
+
+def library_objects(build_dir):
+    for root, _, files in os.walk(build_dir):
+        if LIBRARY_PREFIX not in root:
+            continue
+        for name in files:
+            if name.endswith(".o"):
+                yield os.path.join(root, name)
+
+
+def footprint_report(target, source, env):
+    size_tool = env.subst("$SIZETOOL")
+    rows = []
+    for path in library_objects(env.subst("$BUILD_DIR")):
+        module = os.path.basename(path)[:-len(".o")]
+        module = os.path.splitext(module)[0] # XeoSmartHomeDevice.cpp.o -> XeoSmartHomeDevice
+        flash, ram = object_footprint(size_tool, path)
+        rows.append((module, flash, ram))
+
+    if not rows:
+        print("No %s objects in %s, build the firmware first" % (LIBRARY_PREFIX, env.subst("$BUILD_DIR")))
+        return
+
+    rows.sort(key=lambda row: row[1], reverse=True)
+    print("%-34s %10s %10s" % ("module", "flash", "ram"))
+    for module, flash, ram in rows:
+        print("%-34s %10d %10d" % (module, flash, ram))
+    print("%-34s %10d %10d" % ("total", sum(row[1] for row in rows), sum(row[2] for row in rows)))
+
+    features = [flag for flag in env.get("CPPDEFINES", []) if isinstance(flag, tuple) and str(flag[0]).startswith("XEO_FEATURE_")]
+    if features:
+        print("features: " + ", ".join("%s=%s" % flag for flag in features))
+
+
+env.AddCustomTarget(
+    name="footprint",
+    dependencies="$BUILD_DIR/${PROGNAME}.elf",
+    actions=[footprint_report],
+    title="Footprint",
+    description="Print RAM and flash used by each XeoSmartHome module"
+)
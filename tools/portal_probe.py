@@ -0,0 +1,113 @@
+# Captive portal probe: time from an OS connectivity probe to the portal page, as a phone sees it
+#
+# Run from a computer joined to the access point of a device in config mode:
+#   python3 tools/portal_probe.py [--repeat 20] [--device 8.8.8.8]
+#
+# For every probe in the table of XeoSmartHomeDeviceConfigPortal.cpp it times the DNS answer of the device, the
+# probe answer (302 to the portal, or the refresh page for Apple probes) and the portal page it leads to. The
+# device keeps its own view of the same flow in getCaptivePortalStats(): first_probe_after and opened_after.
+
+import argparse
+import http.client
+import os
+import re
+import socket
+import statistics
+import struct
+import time
+
+
+PORTAL_SOURCE = os.path.join(os.path.dirname(__file__), "..", "lib", "XeoSmartHomeDevice", "XeoSmartHomeDeviceConfigPortal.cpp")
+
+# host names the operating systems resolve for each probe path, the device answers them all with its own address
+PROBE_HOSTS = {
+    "/generate_204": "connectivitycheck.gstatic.com",
+    "/gen_204": "clients3.google.com",
+    "/hotspot-detect.html": "captive.apple.com",
+    "/library/test/success.html": "www.apple.com",
+    "/connecttest.txt": "www.msftconnecttest.com",
+    "/ncsi.txt": "www.msftncsi.com",
+    "/redirect": "www.msftconnecttest.com",
+    "/canonical.html": "detectportal.firefox.com",
+    "/success.txt": "detectportal.firefox.com",
+    "/check_network_status.txt": "network-test.debian.org",
+}
+
+TIMEOUT = 5 # seconds
+
+
+def read_probes():
+    with open(PORTAL_SOURCE) as source:
+        return re.findall(r'\{"(/[^"]*)", (PROBE_REDIRECT|PROBE_PAGE)\}', source.read())
+
+
+def resolve(device, host):
+    """Return the A record the device DNS server gives for host"""
+    query = struct.pack(">HHHHHH", 0x5845, 0x0100, 1, 0, 0, 0)
+    query += b"".join(bytes([len(label)]) + label.encode() for label in host.split(".")) + b"\0"
+    query += struct.pack(">HH", 1, 1) # A, IN
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as udp:
+        udp.settimeout(TIMEOUT)
+        udp.sendto(query, (device, 53))
+        answer, _ = udp.recvfrom(512)
+    if struct.unpack(">H", answer[6:8])[0] == 0:
+        raise RuntimeError("no DNS answer for " + host)
+    return socket.inet_ntoa(answer[-4:])
+
+
+def get(address, host, path):
+    """Return status, Location header and body of a GET"""
+    connection = http.client.HTTPConnection(address, 80, timeout=TIMEOUT)
+    try:
+        connection.request("GET", path, headers={"Host": host, "Cache-Control": "no-cache"})
+        response = connection.getresponse()
+        return response.status, response.getheader("Location"), response.read()
+    finally:
+        connection.close()
+
+
+def probe(device, path, kind):
+    """Return DNS, probe and portal times in miliseconds"""
+    host = PROBE_HOSTS.get(path, "example.com")
+    start = time.perf_counter()
+    address = resolve(device, host)
+    resolved = time.perf_counter()
+
+    status, location, body = get(address, host, path)
+    if kind == "PROBE_REDIRECT" and status != 302:
+        raise RuntimeError("%s: %d instead of a redirect" % (path, status))
+    if kind == "PROBE_PAGE":
+        if status != 200:
+            raise RuntimeError("%s: %d instead of the refresh page" % (path, status))
+        location = re.search(rb'url=([^"]+)"', body).group(1).decode()
+    answered = time.perf_counter()
+
+    portal = re.match(r"http://([^/]+)(/.*)", location)
+    status, _, _ = get(portal.group(1), portal.group(1), portal.group(2))
+    if status != 200:
+        raise RuntimeError("%s: portal answered %d" % (location, status))
+    opened = time.perf_counter()
+    return (resolved - start) * 1000, (answered - resolved) * 1000, (opened - answered) * 1000
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Time captive portal probes of a device in config mode")
+    parser.add_argument("--device", default="8.8.8.8", help="address of the device access point")
+    parser.add_argument("--repeat", type=int, default=20, help="probes of each kind")
+    args = parser.parse_args()
+
+    print("%-28s %10s %10s %10s %16s" % ("probe", "dns ms", "probe ms", "portal ms", "total p50/max"))
+    for path, kind in read_probes():
+        runs = [probe(args.device, path, kind) for _ in range(args.repeat)]
+        totals = [sum(run) for run in runs]
+        print("%-28s %10.1f %10.1f %10.1f %8.1f/%-7.1f" % (
+            path,
+            statistics.median(run[0] for run in runs),
+            statistics.median(run[1] for run in runs),
+            statistics.median(run[2] for run in runs),
+            statistics.median(totals),
+            max(totals)))
+
+
+if __name__ == "__main__":
+    main()